@@ -2,12 +2,16 @@
 
 #include "common/types.h"
 #include "common/logger.h"
+#include "datastructures/buffer_pool.h"
 #include <openssl/evp.h>
 #include <openssl/rand.h>
 #include <vector>
 #include <cstring>
 #include <string>
 #include <array>
+#include <cstdint>
+#include <memory>
+#include <unistd.h>
 
 namespace ecpb {
 
@@ -34,45 +38,10 @@ public:
 
     // Encrypt data. Returns IV prepended to ciphertext.
     static std::vector<uint8_t> encrypt(const uint8_t* plaintext, size_t len, const Key& key) {
-        IV iv = generate_iv();
-        std::vector<uint8_t> output;
-        // Prepend IV
-        output.insert(output.end(), iv.begin(), iv.end());
-
-        EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
-        if (!ctx) {
-            LOG_ERR("AES256: failed to create cipher context");
-            return {};
-        }
-
-        if (EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), nullptr, key.data(), iv.data()) != 1) {
-            LOG_ERR("AES256: EncryptInit failed");
-            EVP_CIPHER_CTX_free(ctx);
-            return {};
-        }
-
-        // Output buffer: plaintext + block size for padding
-        size_t out_alloc = len + AES_BLOCK_SIZE;
-        size_t offset = output.size();
-        output.resize(offset + out_alloc);
-
-        int out_len1 = 0;
-        if (EVP_EncryptUpdate(ctx, output.data() + offset, &out_len1,
-                              plaintext, static_cast<int>(len)) != 1) {
-            LOG_ERR("AES256: EncryptUpdate failed");
-            EVP_CIPHER_CTX_free(ctx);
-            return {};
-        }
-
-        int out_len2 = 0;
-        if (EVP_EncryptFinal_ex(ctx, output.data() + offset + out_len1, &out_len2) != 1) {
-            LOG_ERR("AES256: EncryptFinal failed");
-            EVP_CIPHER_CTX_free(ctx);
-            return {};
-        }
-
-        output.resize(offset + out_len1 + out_len2);
-        EVP_CIPHER_CTX_free(ctx);
+        std::vector<uint8_t> output(AES_IV_LEN + len + AES_BLOCK_SIZE);
+        size_t n = encrypt_raw(plaintext, len, key, output.data());
+        if (n == FAILED) return {};
+        output.resize(n);
         return output;
     }
 
@@ -86,47 +55,87 @@ public:
             LOG_ERR("AES256: data too short for IV");
             return {};
         }
+        std::vector<uint8_t> output(len - AES_IV_LEN + AES_BLOCK_SIZE);
+        size_t n = decrypt_raw(data, len, key, output.data());
+        if (n == FAILED) return {};
+        output.resize(n);
+        return output;
+    }
 
-        IV iv{};
-        std::memcpy(iv.data(), data, AES_IV_LEN);
-        const uint8_t* ciphertext = data + AES_IV_LEN;
-        size_t cipher_len = len - AES_IV_LEN;
-
-        EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
-        if (!ctx) {
-            LOG_ERR("AES256: failed to create cipher context");
-            return {};
-        }
+    static std::vector<uint8_t> decrypt(const std::vector<uint8_t>& data, const Key& key) {
+        return decrypt(data.data(), data.size(), key);
+    }
 
-        if (EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), nullptr, key.data(), iv.data()) != 1) {
-            LOG_ERR("AES256: DecryptInit failed");
-            EVP_CIPHER_CTX_free(ctx);
-            return {};
-        }
+    // Into-buffer forms for the chunk path: `out` is resized to the result
+    // and keeps its capacity; the cipher context is per thread and only
+    // re-keyed per call. False on failure.
+    static bool encrypt_into(const uint8_t* plaintext, size_t len, const Key& key, ByteBuffer& out) {
+        out.resize(AES_IV_LEN + len + AES_BLOCK_SIZE);
+        size_t n = encrypt_raw(plaintext, len, key, out.data());
+        out.resize(n == FAILED ? 0 : n);
+        return n != FAILED;
+    }
 
-        std::vector<uint8_t> output(cipher_len + AES_BLOCK_SIZE);
-        int out_len1 = 0;
-        if (EVP_DecryptUpdate(ctx, output.data(), &out_len1,
-                              ciphertext, static_cast<int>(cipher_len)) != 1) {
-            LOG_ERR("AES256: DecryptUpdate failed");
-            EVP_CIPHER_CTX_free(ctx);
-            return {};
+    static bool decrypt_into(const uint8_t* data, size_t len, const Key& key, ByteBuffer& out) {
+        if (len < AES_IV_LEN) {
+            LOG_ERR("AES256: data too short for IV");
+            out.clear();
+            return false;
         }
+        out.resize(len - AES_IV_LEN + AES_BLOCK_SIZE);
+        size_t n = decrypt_raw(data, len, key, out.data());
+        out.resize(n == FAILED ? 0 : n);
+        return n != FAILED;
+    }
 
-        int out_len2 = 0;
-        if (EVP_DecryptFinal_ex(ctx, output.data() + out_len1, &out_len2) != 1) {
-            LOG_ERR("AES256: DecryptFinal failed (bad key or corrupt data)");
-            EVP_CIPHER_CTX_free(ctx);
-            return {};
+    // AES-256-GCM for chunks: 12-byte nonce | ciphertext | 16-byte tag.
+    // `aad` is authenticated with the ciphertext but not stored; decrypting
+    // succeeds only if neither was changed, so callers need not hash the
+    // plaintext again. Nonces come from next_nonce(), not a RAND_bytes call
+    // per chunk. Same buffer and context reuse as the CBC forms.
+    static bool encrypt_gcm_into(const uint8_t* plaintext, size_t len, const Key& key,
+                                 const uint8_t* aad, size_t aad_len, ByteBuffer& out) {
+        out.resize(AES_GCM_NONCE_LEN + len + AES_GCM_TAG_LEN);
+        uint8_t* nonce = out.data();
+        uint8_t* tag = out.data() + AES_GCM_NONCE_LEN + len;
+        EVP_CIPHER_CTX* ctx = gcm_ctx(true, key);
+        int n = 0;
+        bool ok = ctx && next_nonce(nonce) &&
+                  EVP_EncryptInit_ex(ctx, nullptr, nullptr, nullptr, nonce) == 1 &&
+                  (aad_len == 0 || EVP_EncryptUpdate(ctx, nullptr, &n, aad, static_cast<int>(aad_len)) == 1) &&
+                  EVP_EncryptUpdate(ctx, out.data() + AES_GCM_NONCE_LEN, &n, plaintext, static_cast<int>(len)) == 1 &&
+                  EVP_EncryptFinal_ex(ctx, tag, &n) == 1 &&
+                  EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, static_cast<int>(AES_GCM_TAG_LEN), tag) == 1;
+        if (!ok) {
+            LOG_ERR("AES256: GCM encryption failed");
+            out.clear();
         }
-
-        output.resize(out_len1 + out_len2);
-        EVP_CIPHER_CTX_free(ctx);
-        return output;
+        return ok;
     }
 
-    static std::vector<uint8_t> decrypt(const std::vector<uint8_t>& data, const Key& key) {
-        return decrypt(data.data(), data.size(), key);
+    static bool decrypt_gcm_into(const uint8_t* data, size_t len, const Key& key,
+                                 const uint8_t* aad, size_t aad_len, ByteBuffer& out) {
+        if (len < AES_GCM_NONCE_LEN + AES_GCM_TAG_LEN) {
+            LOG_ERR("AES256: data too short for GCM nonce and tag");
+            out.clear();
+            return false;
+        }
+        size_t body = len - AES_GCM_NONCE_LEN - AES_GCM_TAG_LEN;
+        out.resize(body);
+        EVP_CIPHER_CTX* ctx = gcm_ctx(false, key);
+        int n = 0;
+        bool ok = ctx &&
+                  EVP_DecryptInit_ex(ctx, nullptr, nullptr, nullptr, data) == 1 &&
+                  (aad_len == 0 || EVP_DecryptUpdate(ctx, nullptr, &n, aad, static_cast<int>(aad_len)) == 1) &&
+                  EVP_DecryptUpdate(ctx, out.data(), &n, data + AES_GCM_NONCE_LEN, static_cast<int>(body)) == 1 &&
+                  EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, static_cast<int>(AES_GCM_TAG_LEN),
+                                      const_cast<uint8_t*>(data + len - AES_GCM_TAG_LEN)) == 1 &&
+                  EVP_DecryptFinal_ex(ctx, out.data() + body, &n) == 1;
+        if (!ok) {
+            LOG_ERR("AES256: GCM authentication failed (bad key or corrupt data)");
+            out.clear();
+        }
+        return ok;
     }
 
     // Key <-> hex string conversions
@@ -148,6 +157,136 @@ public:
         }
         return key;
     }
+
+private:
+    static constexpr size_t FAILED = SIZE_MAX;
+
+    // IV then ciphertext written to dst (room for len + IV + one block);
+    // bytes written or FAILED
+    static size_t encrypt_raw(const uint8_t* plaintext, size_t len, const Key& key, uint8_t* dst) {
+        EVP_CIPHER_CTX* ctx = thread_ctx(true);
+        if (!ctx) {
+            LOG_ERR("AES256: failed to create cipher context");
+            return FAILED;
+        }
+        if (RAND_bytes(dst, AES_IV_LEN) != 1) {
+            LOG_ERR("AES256: failed to generate random IV");
+            return FAILED;
+        }
+        if (EVP_EncryptInit_ex(ctx, nullptr, nullptr, key.data(), dst) != 1) {
+            LOG_ERR("AES256: EncryptInit failed");
+            return FAILED;
+        }
+
+        uint8_t* out = dst + AES_IV_LEN;
+        int out_len1 = 0;
+        if (EVP_EncryptUpdate(ctx, out, &out_len1, plaintext, static_cast<int>(len)) != 1) {
+            LOG_ERR("AES256: EncryptUpdate failed");
+            return FAILED;
+        }
+
+        int out_len2 = 0;
+        if (EVP_EncryptFinal_ex(ctx, out + out_len1, &out_len2) != 1) {
+            LOG_ERR("AES256: EncryptFinal failed");
+            return FAILED;
+        }
+        return AES_IV_LEN + static_cast<size_t>(out_len1 + out_len2);
+    }
+
+    // Plaintext of IV-prefixed data written to dst (room for the
+    // ciphertext plus one block); bytes written or FAILED
+    static size_t decrypt_raw(const uint8_t* data, size_t len, const Key& key, uint8_t* dst) {
+        EVP_CIPHER_CTX* ctx = thread_ctx(false);
+        if (!ctx) {
+            LOG_ERR("AES256: failed to create cipher context");
+            return FAILED;
+        }
+        if (EVP_DecryptInit_ex(ctx, nullptr, nullptr, key.data(), data) != 1) {
+            LOG_ERR("AES256: DecryptInit failed");
+            return FAILED;
+        }
+
+        const uint8_t* ciphertext = data + AES_IV_LEN;
+        int out_len1 = 0;
+        if (EVP_DecryptUpdate(ctx, dst, &out_len1, ciphertext, static_cast<int>(len - AES_IV_LEN)) != 1) {
+            LOG_ERR("AES256: DecryptUpdate failed");
+            return FAILED;
+        }
+
+        int out_len2 = 0;
+        if (EVP_DecryptFinal_ex(ctx, dst + out_len1, &out_len2) != 1) {
+            LOG_ERR("AES256: DecryptFinal failed (bad key or corrupt data)");
+            return FAILED;
+        }
+        return static_cast<size_t>(out_len1 + out_len2);
+    }
+
+    struct Ctx {
+        std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)> ctx;
+        Key  key{};
+        bool keyed = false;
+        Ctx(const EVP_CIPHER* cipher, bool enc) : ctx(EVP_CIPHER_CTX_new(), &EVP_CIPHER_CTX_free) {
+            if (ctx && EVP_CipherInit_ex(ctx.get(), cipher, nullptr, nullptr, nullptr, enc ? 1 : 0) != 1) {
+                ctx.reset();
+            }
+        }
+    };
+
+    // One encrypt and one decrypt context per thread, set up for AES-256-CBC
+    // once; each call passes only key and IV, which reuses the cipher state
+    // instead of fetching and allocating it again
+    static EVP_CIPHER_CTX* thread_ctx(bool encrypt) {
+        thread_local Ctx enc(EVP_aes_256_cbc(), true);
+        thread_local Ctx dec(EVP_aes_256_cbc(), false);
+        return encrypt ? enc.ctx.get() : dec.ctx.get();
+    }
+
+    // The same for GCM, keyed only when the key changes: the key schedule
+    // and GHASH table are kept, and each call sets just the nonce
+    static EVP_CIPHER_CTX* gcm_ctx(bool encrypt, const Key& key) {
+        thread_local Ctx enc(EVP_aes_256_gcm(), true);
+        thread_local Ctx dec(EVP_aes_256_gcm(), false);
+        Ctx& c = encrypt ? enc : dec;
+        if (!c.ctx) {
+            LOG_ERR("AES256: failed to create cipher context");
+            return nullptr;
+        }
+        if (!c.keyed || c.key != key) {
+            if (EVP_CipherInit_ex(c.ctx.get(), nullptr, nullptr, key.data(), nullptr, encrypt ? 1 : 0) != 1) {
+                c.keyed = false;
+                return nullptr;
+            }
+            c.key = key;
+            c.keyed = true;
+        }
+        return c.ctx.get();
+    }
+
+    // 12-byte GCM nonce: 8 random bytes drawn once per thread, then a
+    // 32-bit counter. Threads and forked workers share a key, so the prefix
+    // is drawn again in a new process (same thread-local state after fork)
+    // and when the counter runs out.
+    static bool next_nonce(uint8_t* nonce) {
+        struct State {
+            uint8_t  prefix[8];
+            uint32_t counter = 0;
+            pid_t    pid = 0;
+        };
+        thread_local State st;
+        pid_t pid = getpid();
+        if (st.pid != pid || st.counter == UINT32_MAX) {
+            if (RAND_bytes(st.prefix, sizeof(st.prefix)) != 1) {
+                LOG_ERR("AES256: failed to generate nonce prefix");
+                return false;
+            }
+            st.pid = pid;
+            st.counter = 0;
+        }
+        uint32_t count = st.counter++;
+        std::memcpy(nonce, st.prefix, sizeof(st.prefix));
+        std::memcpy(nonce + sizeof(st.prefix), &count, sizeof(count));
+        return true;
+    }
 };
 
 } // namespace ecpb
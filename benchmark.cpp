@@ -0,0 +1,1135 @@
+// Enterprise Communication Platform with Distributed Backup (ECPB)
+// Micro-benchmarks for the storage hot path, run with `make bench`
+// (optionally `./build/ecpb_bench <name>...`). `make test` runs only the
+// checks, "alloc", "sha-kat" and "commit-fail"; the process exits 1 if any
+// check fails.
+
+#include "common/types.h"
+#include "common/logger.h"
+#include "crypto/sha256.h"
+#include "storage/chunker.h"
+#include "storage/bloom_filter.h"
+#include "storage/chunk_store.h"
+#include "compression/compressibility.h"
+#include "compression/compressor.h"
+#include "backup/snapshot.h"
+#include "backup/worker.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <set>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <filesystem>
+#include <atomic>
+#include <cstdlib>
+
+// ─── Allocation counting ─────────────────────────────────────────────
+// The bench binary replaces the glibc malloc family with counting
+// forwarders so "alloc" can check the chunk kernels allocate nothing once
+// warm. operator new and the codec/OpenSSL libraries all land here.
+namespace {
+std::atomic<bool>     g_count_allocs{false};
+std::atomic<uint64_t> g_allocs{0};
+
+inline void note_alloc() {
+    if (g_count_allocs.load(std::memory_order_relaxed)) g_allocs.fetch_add(1, std::memory_order_relaxed);
+}
+} // namespace
+
+#ifdef __GLIBC__
+extern "C" {
+void* __libc_malloc(size_t);
+void* __libc_calloc(size_t, size_t);
+void* __libc_realloc(void*, size_t);
+void* __libc_memalign(size_t, size_t);
+
+void* malloc(size_t n) noexcept { note_alloc(); return __libc_malloc(n); }
+void* calloc(size_t n, size_t m) noexcept { note_alloc(); return __libc_calloc(n, m); }
+void* realloc(void* p, size_t n) noexcept { note_alloc(); return __libc_realloc(p, n); }
+void* memalign(size_t a, size_t n) noexcept { note_alloc(); return __libc_memalign(a, n); }
+void* aligned_alloc(size_t a, size_t n) noexcept { note_alloc(); return __libc_memalign(a, n); }
+int posix_memalign(void** out, size_t a, size_t n) noexcept {
+    note_alloc();
+    void* p = __libc_memalign(a, n);
+    if (!p) return ENOMEM;
+    *out = p;
+    return 0;
+}
+}
+#define ECPB_COUNTS_ALLOCS 1
+#endif
+
+using namespace ecpb;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Set by a failed check; main() then exits non-zero
+bool g_check_failed = false;
+
+double seconds_since(Clock::time_point t0) {
+    return std::chrono::duration<double>(Clock::now() - t0).count();
+}
+
+double mb_per_sec(uint64_t bytes, double secs) {
+    return secs > 0 ? (static_cast<double>(bytes) / (1024.0 * 1024.0)) / secs : 0.0;
+}
+
+// Deterministic xorshift data so runs are comparable
+std::vector<uint8_t> random_bytes(size_t len, uint64_t seed) {
+    std::vector<uint8_t> out(len);
+    uint64_t x = seed ? seed : 0x2545F4914F6CDD1DULL;
+    for (size_t i = 0; i < len; ++i) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        out[i] = static_cast<uint8_t>(x);
+    }
+    return out;
+}
+
+// Insert `count` short random runs at spread-out positions
+std::vector<uint8_t> shifted_copy(const std::vector<uint8_t>& base, int count, uint64_t seed) {
+    std::vector<uint8_t> out = base;
+    auto noise = random_bytes(static_cast<size_t>(count) * 8, seed);
+    for (int i = count - 1; i >= 0; --i) {
+        size_t pos = (base.size() / static_cast<size_t>(count + 1)) * static_cast<size_t>(i + 1);
+        size_t n = 1 + static_cast<size_t>(noise[i * 8] % 7);
+        out.insert(out.begin() + static_cast<long>(pos),
+                   noise.begin() + i * 8, noise.begin() + i * 8 + static_cast<long>(n));
+    }
+    return out;
+}
+
+std::vector<size_t> chunk_all(const Chunker& chunker, const std::vector<uint8_t>& data) {
+    std::vector<size_t> cuts;
+    size_t pos = 0;
+    while (pos < data.size()) {
+        size_t n = chunker.next_cut(data.data() + pos, data.size() - pos, true);
+        cuts.push_back(n);
+        pos += n;
+    }
+    return cuts;
+}
+
+// ─── Chunking: dedup ratio + throughput on shifted inserts ──────────
+void bench_chunking() {
+    const size_t base_len = 32 * 1024 * 1024;
+    auto v1 = random_bytes(base_len, 1);
+    const int edits[] = {1, 16, 256};
+
+    struct Mode { const char* name; ChunkerParams params; };
+    Mode modes[] = {
+        {"fixed-64K", ChunkerParams::fixed()},
+        {"cdc-16K",   ChunkerParams::cdc(16 * 1024)},
+        {"cdc-64K",   ChunkerParams::cdc(64 * 1024)},
+    };
+
+    std::printf("%-10s %6s %10s %10s %10s\n", "mode", "edits", "chunks", "dedup%", "MB/s");
+    for (auto& mode : modes) {
+        Chunker chunker(mode.params);
+
+        std::set<HashDigest> seen;
+        size_t pos = 0;
+        for (size_t n : chunk_all(chunker, v1)) {
+            seen.insert(SHA256::hash(v1.data() + pos, n));
+            pos += n;
+        }
+
+        for (int e : edits) {
+            auto v2 = shifted_copy(v1, e, 7 + static_cast<uint64_t>(e));
+
+            // Time the full boundary + SHA-256 path, as store_file runs it
+            auto t0 = Clock::now();
+            auto cuts = chunk_all(chunker, v2);
+            std::vector<HashDigest> digests;
+            digests.reserve(cuts.size());
+            pos = 0;
+            for (size_t n : cuts) {
+                digests.push_back(SHA256::hash(v2.data() + pos, n));
+                pos += n;
+            }
+            double secs = seconds_since(t0);
+
+            uint64_t dup_bytes = 0;
+            for (size_t i = 0; i < cuts.size(); ++i) {
+                if (seen.count(digests[i])) dup_bytes += cuts[i];
+            }
+            double ratio = 100.0 * static_cast<double>(dup_bytes) / static_cast<double>(v2.size());
+            std::printf("%-10s %6d %10zu %9.2f%% %10.1f\n",
+                        mode.name, e, cuts.size(), ratio, mb_per_sec(v2.size(), secs));
+        }
+    }
+}
+
+// ─── Chunk hashing: SHA-256 kernels, GB/s on one core ──────────────
+void bench_hash() {
+    auto data = random_bytes(64 * 1024 * 1024, 6);
+    Chunker chunker(ChunkerParams::cdc(64 * 1024));
+    std::vector<SHA256::Buffer> bufs;
+    size_t pos = 0;
+    for (size_t n : chunk_all(chunker, data)) {
+        bufs.push_back({data.data() + pos, n});
+        pos += n;
+    }
+    std::vector<HashDigest> ref(bufs.size()), out(bufs.size());
+    for (size_t i = 0; i < bufs.size(); ++i) ref[i] = SHA256::hash_evp(bufs[i].data, bufs[i].len);
+
+    const SHA256::Impl initial = SHA256::impl();
+    const int rounds = 4;
+    auto run = [&](const char* name, const std::function<void()>& fn, double base) {
+        fn();  // warm up
+        auto t0 = Clock::now();
+        for (int r = 0; r < rounds; ++r) fn();
+        double secs = seconds_since(t0);
+        double gbs = secs > 0 ? static_cast<double>(data.size()) * rounds / secs / 1e9 : 0.0;
+        bool ok = (out == ref);
+        if (!ok) g_check_failed = true;
+        std::printf("%-20s %10.2f %9.2fx %s\n", name, gbs, base > 0 ? gbs / base : 1.0, ok ? "" : "MISMATCH");
+        return gbs;
+    };
+
+    std::printf("%zu CDC chunks, default impl: %s\n", bufs.size(), SHA256::impl_name(initial));
+    std::printf("%-20s %10s %10s\n", "path", "GB/s", "vs evp");
+    // The pre-dispatch path: a fresh EVP context per chunk
+    double base = run("evp (ctx per call)", [&] {
+        for (size_t i = 0; i < bufs.size(); ++i) {
+            EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+            unsigned int len = 0;
+            EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr);
+            EVP_DigestUpdate(ctx, bufs[i].data, bufs[i].len);
+            EVP_DigestFinal_ex(ctx, out[i].data(), &len);
+            EVP_MD_CTX_free(ctx);
+        }
+    }, 0.0);
+    for (auto im : {SHA256::Impl::EVP, SHA256::Impl::PORTABLE, SHA256::Impl::SHANI}) {
+        if (!SHA256::set_impl(im)) {
+            std::printf("%-20s %10s\n", SHA256::impl_name(im), "n/a");
+            continue;
+        }
+        std::string name = SHA256::impl_name(im);
+        run(name.c_str(), [&] {
+            for (size_t i = 0; i < bufs.size(); ++i) out[i] = SHA256::hash(bufs[i].data, bufs[i].len);
+        }, base);
+        name += " hash_many";
+        run(name.c_str(), [&] {
+            // Batches the size the ingest pipeline forms
+            for (size_t i = 0; i < bufs.size();) {
+                size_t n = 0, bytes = 0;
+                while (i + n < bufs.size() && bytes < PIPELINE_BATCH_BYTES) bytes += bufs[i + n++].len;
+                SHA256::hash_many(bufs.data() + i, n, out.data() + i);
+                i += n;
+            }
+        }, base);
+    }
+    SHA256::set_impl(initial);
+}
+
+// ─── SHA-256 known answers, every kernel the CPU has ────────────────
+// FIPS 180-2 vectors through hash(), then hash() and hash_many() against
+// OpenSSL on lengths around the padding edges (55/56/64 bytes per block)
+// and odd sizes, in batches that pair unequal lengths in the two-lane
+// SHA-NI kernel
+void bench_sha_kat() {
+    struct Vector { const char* msg; const char* hex; };
+    const Vector fips[] = {
+        {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+        {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+        {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+         "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+    };
+
+    std::vector<size_t> lens;
+    for (size_t base : {size_t(0), size_t(64), size_t(128), size_t(4096)}) {
+        for (size_t d : {55, 56, 57, 63, 64, 65}) lens.push_back(base + d);
+    }
+    for (size_t n = 1; n < 300; n += 2) lens.push_back(n);
+    for (size_t n : {size_t(1000003), size_t(65537), size_t(0), size_t(131071)}) lens.push_back(n);
+    auto data = random_bytes(2 * 1024 * 1024, 8);
+    std::vector<SHA256::Buffer> bufs;
+    size_t pos = 0;
+    for (size_t n : lens) {
+        bufs.push_back({data.data() + pos, n});
+        pos = (pos + n + 7) % (data.size() - 1100000);   // overlapping, odd alignments
+    }
+    std::vector<HashDigest> ref(bufs.size()), out(bufs.size());
+    for (size_t i = 0; i < bufs.size(); ++i) ref[i] = SHA256::hash_evp(bufs[i].data, bufs[i].len);
+
+    const SHA256::Impl initial = SHA256::impl();
+    for (auto im : {SHA256::Impl::EVP, SHA256::Impl::PORTABLE, SHA256::Impl::SHANI}) {
+        if (!SHA256::set_impl(im)) {
+            std::printf("%-10s n/a\n", SHA256::impl_name(im));
+            continue;
+        }
+        int bad = 0;
+        for (auto& v : fips) {
+            if (std::strcmp(SHA256::to_hex(SHA256::hash(std::string(v.msg))).c_str(), v.hex) != 0) {
+                std::printf("%-10s FIPS \"%s\": MISMATCH\n", SHA256::impl_name(im), v.msg);
+                ++bad;
+            }
+        }
+        for (size_t i = 0; i < bufs.size(); ++i) {
+            if (SHA256::hash(bufs[i].data, bufs[i].len) != ref[i]) {
+                std::printf("%-10s hash %zu bytes: MISMATCH\n", SHA256::impl_name(im), bufs[i].len);
+                ++bad;
+            }
+        }
+        for (size_t batch : {size_t(2), size_t(3), size_t(7), bufs.size()}) {
+            std::fill(out.begin(), out.end(), HashDigest{});
+            for (size_t i = 0; i < bufs.size(); i += batch) {
+                SHA256::hash_many(bufs.data() + i, std::min(batch, bufs.size() - i), out.data() + i);
+            }
+            for (size_t i = 0; i < bufs.size(); ++i) {
+                if (out[i] != ref[i]) {
+                    std::printf("%-10s hash_many(%zu) %zu bytes: MISMATCH\n",
+                                SHA256::impl_name(im), batch, bufs[i].len);
+                    ++bad;
+                }
+            }
+        }
+        std::printf("%-10s %zu vectors, %zu buffers: %s\n", SHA256::impl_name(im),
+                    sizeof(fips) / sizeof(fips[0]), bufs.size(), bad ? "FAIL" : "OK");
+        if (bad) g_check_failed = true;
+    }
+    SHA256::set_impl(initial);
+}
+
+// ─── Bloom filter: FP rate, memory and probe cost vs fill ───────────
+void bench_bloom() {
+    const uint64_t capacity = 1000000;
+    auto keys = random_bytes(2 * capacity * 16, 3);   // two words per key
+    auto probes = random_bytes(capacity * 16, 4);
+    auto word = [](const std::vector<uint8_t>& v, size_t i) {
+        uint64_t w;
+        std::memcpy(&w, v.data() + i * 8, sizeof(w));
+        return w;
+    };
+
+    std::printf("%-8s %10s %12s %10s %10s %10s\n",
+                "fp", "entries", "bytes/M", "est fp%", "obs fp%", "ns/probe");
+    for (double fp : {0.01, 0.001}) {
+        BloomFilter filter;
+        if (!filter.create_anonymous(capacity, fp)) return;
+        uint64_t added = 0;
+        for (uint64_t fill : {capacity / 2, capacity, 2 * capacity}) {
+            for (; added < fill; ++added) {
+                filter.add(word(keys, added * 2), word(keys, added * 2 + 1));
+            }
+
+            uint64_t hits = 0;
+            auto t0 = Clock::now();
+            for (uint64_t i = 0; i < capacity; ++i) {
+                hits += filter.maybe_contains(word(probes, i * 2), word(probes, i * 2 + 1));
+            }
+            double secs = seconds_since(t0);
+
+            std::printf("%-8.3f %10llu %12s %9.3f%% %9.3f%% %10.1f\n", fp,
+                        static_cast<unsigned long long>(added),
+                        format_bytes(filter.bit_count() / 8 * 1000000 / capacity).c_str(),
+                        filter.estimated_fp_rate() * 100.0,
+                        100.0 * static_cast<double>(hits) / static_cast<double>(capacity),
+                        secs * 1e9 / static_cast<double>(capacity));
+        }
+    }
+}
+
+// ─── Chunk pipeline: store_file throughput vs worker threads ────────
+void bench_pipeline() {
+    namespace fs = std::filesystem;
+    char tmpl[] = "/tmp/ecpb_bench_XXXXXX";
+    if (!mkdtemp(tmpl)) return;
+    std::string root = tmpl;
+
+    // Roughly 2:1 compressible, so LZ4 and AES both do real work
+    auto data = random_bytes(128 * 1024 * 1024, 5);
+    for (size_t i = 0; i < data.size(); i += 2) data[i] &= 0x0f;
+    std::string src = root + "/input.bin";
+    {
+        std::ofstream out(src, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    }
+
+    std::printf("cores: %u\n", std::thread::hardware_concurrency());
+    std::printf("%-8s %10s %10s\n", "threads", "MB/s", "speedup");
+    double base = 0.0;
+    for (size_t threads : {1, 2, 4, 8}) {
+        std::string dir = root + "/run" + std::to_string(threads);
+        fs::create_directories(dir);
+        Database db;
+        if (!db.open(dir + "/ecpb.db")) break;
+        BackupJob job;
+        job.source_path = src;
+        job.backup_name = "bench";
+        int job_id = db.create_job(job);
+
+        double secs;
+        {
+            ChunkStore store(db, dir + "/storage");
+            store.set_pipeline_threads(threads);
+            auto key = AES256::generate_key();
+            auto t0 = Clock::now();
+            store.store_file(src, CompressionType::LZ4, true, key, job_id);
+            store.flush();
+            secs = seconds_since(t0);
+        }
+        double rate = mb_per_sec(data.size(), secs);
+        if (threads == 1) base = rate;
+        std::printf("%-8zu %10.1f %9.2fx\n", threads, rate, base > 0 ? rate / base : 0.0);
+    }
+    fs::remove_all(root);
+}
+
+// ─── File pool: small-file backup rate vs file-level threads ────────
+void bench_files() {
+    namespace fs = std::filesystem;
+    char tmpl[] = "/tmp/ecpb_bench_XXXXXX";
+    if (!mkdtemp(tmpl)) return;
+    std::string root = tmpl;
+
+    const int file_count = 5000;
+    std::string src = root + "/src";
+    for (int i = 0; i < file_count; ++i) {
+        std::string dir = src + "/d" + std::to_string(i / 500);
+        fs::create_directories(dir);
+        auto data = random_bytes(4096, static_cast<uint64_t>(i) + 11);
+        std::ofstream out(dir + "/f" + std::to_string(i), std::ios::binary);
+        out.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    }
+
+    std::printf("cores: %u, %d x 4 KB files\n", std::thread::hardware_concurrency(), file_count);
+    std::printf("%-8s %-9s %10s %10s %10s\n", "threads", "commits", "files/s", "speedup", "txns");
+    double base = 0.0;
+    // First one thread with a transaction per row, as before group commit
+    for (size_t run = 0; run < 5; ++run) {
+        bool per_row = run == 0;
+        size_t threads = per_row ? 1 : size_t{1} << (run - 1);
+        std::string dir = root + "/run" + std::to_string(run);
+        fs::create_directories(dir);
+        Database db;
+        if (!db.open(dir + "/ecpb.db")) break;
+        BackupJob job;
+        job.source_path = src;
+        job.backup_name = "bench";
+        job.job_id = db.create_job(job);
+
+        double secs;
+        BackupWorker::Result result;
+        {
+            ChunkStore store(db, dir + "/storage");
+            if (per_row) store.set_group_commit(1, 0);
+            SnapshotManager snaps(db, dir + "/snapshots");
+            BackupWorker worker(db, store, snaps);
+            worker.set_threads(threads);
+            auto t0 = Clock::now();
+            result = worker.execute(job, AES256::generate_key());
+            secs = seconds_since(t0);
+        }
+        double rate = secs > 0 ? file_count / secs : 0.0;
+        if (per_row) base = rate;
+        std::printf("%-8zu %-9s %10.0f %9.2fx %10llu\n", threads, per_row ? "per row" : "grouped", rate,
+                    base > 0 ? rate / base : 0.0, static_cast<unsigned long long>(result.commits));
+    }
+    fs::remove_all(root);
+}
+
+// ─── Group commit failure: the job must fail, not report success ────
+// A trigger aborts every manifest insert, so the job's last group cannot
+// be written; the same backup without it must complete
+void bench_commit_fail() {
+    namespace fs = std::filesystem;
+    char tmpl[] = "/tmp/ecpb_bench_XXXXXX";
+    if (!mkdtemp(tmpl)) return;
+    std::string root = tmpl;
+    std::string src = root + "/src";
+    fs::create_directories(src);
+    for (int i = 0; i < 3; ++i) {
+        auto data = random_bytes(100000, static_cast<uint64_t>(i) + 21);
+        std::ofstream out(src + "/f" + std::to_string(i), std::ios::binary);
+        out.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    }
+
+    Database db;
+    if (!db.open(root + "/ecpb.db")) {
+        g_check_failed = true;
+        return;
+    }
+    std::printf("%-26s %10s %10s\n", "case", "expected", "status");
+    for (bool inject : {true, false}) {
+        const char* sql = inject
+            ? "CREATE TRIGGER fail_manifests BEFORE INSERT ON file_manifests "
+              "BEGIN SELECT RAISE(ABORT, 'injected'); END"
+            : "DROP TRIGGER fail_manifests";
+        sqlite3_exec(db.raw(), sql, nullptr, nullptr, nullptr);
+        BackupJob job;
+        job.source_path = src;
+        job.backup_name = inject ? "fail" : "ok";
+        job.job_id = db.create_job(job);
+
+        BackupWorker::Result result;
+        {
+            ChunkStore store(db, root + "/storage");
+            SnapshotManager snaps(db, root + "/snapshots");
+            BackupWorker worker(db, store, snaps);
+            result = worker.execute(job, AES256::generate_key());
+        }
+        auto row = db.get_job(job.job_id);
+        JobStatus want = inject ? JobStatus::FAILED : JobStatus::COMPLETED;
+        bool ok = row && row->status == want && result.success == !inject;
+        std::printf("%-26s %10s %10s%s\n", inject ? "manifest insert aborted" : "no fault",
+                    job_status_str(want), row ? job_status_str(row->status) : "-", ok ? "" : "  FAIL");
+        if (!ok) g_check_failed = true;
+    }
+    fs::remove_all(root);
+}
+
+// ─── Catalog upgrade: a database from the first release opens ───────
+// The first release's schema (hex TEXT digests, loose chunk files under
+// storage_path, none of the later columns) with one job, file and chunk.
+// Opening it migrates it, fills the statistics from its rows, and the
+// triggers keep them from there.
+void bench_old_catalog() {
+    namespace fs = std::filesystem;
+    char tmpl[] = "/tmp/ecpb_bench_XXXXXX";
+    if (!mkdtemp(tmpl)) return;
+    std::string root = tmpl;
+    std::string path = root + "/ecpb.db";
+    std::string hex(64, 'a');
+
+    sqlite3* raw = nullptr;
+    std::string baseline =
+        "CREATE TABLE jobs (job_id INTEGER PRIMARY KEY AUTOINCREMENT, source_path TEXT NOT NULL, "
+        "  backup_name TEXT NOT NULL, status INTEGER DEFAULT 0, priority INTEGER DEFAULT 1, "
+        "  compression INTEGER DEFAULT 1, encrypt INTEGER DEFAULT 1, incremental INTEGER DEFAULT 0, "
+        "  parent_job_id INTEGER DEFAULT -1, created_at INTEGER, started_at INTEGER, completed_at INTEGER, "
+        "  total_bytes INTEGER DEFAULT 0, processed_bytes INTEGER DEFAULT 0, stored_bytes INTEGER DEFAULT 0, "
+        "  dedup_savings INTEGER DEFAULT 0, file_count INTEGER DEFAULT 0, error_message TEXT DEFAULT '');"
+        "CREATE TABLE chunks (hash TEXT PRIMARY KEY, storage_path TEXT NOT NULL, original_size INTEGER, "
+        "  stored_size INTEGER, compression INTEGER DEFAULT 0, encrypted INTEGER DEFAULT 0, "
+        "  ref_count INTEGER DEFAULT 1);"
+        "CREATE TABLE file_manifests (manifest_id INTEGER PRIMARY KEY AUTOINCREMENT, job_id INTEGER NOT NULL, "
+        "  file_path TEXT NOT NULL, file_name TEXT NOT NULL, file_size INTEGER, modified_time INTEGER, "
+        "  file_hash TEXT, FOREIGN KEY (job_id) REFERENCES jobs(job_id));"
+        "CREATE TABLE file_chunks (id INTEGER PRIMARY KEY AUTOINCREMENT, manifest_id INTEGER NOT NULL, "
+        "  chunk_hash TEXT NOT NULL, chunk_index INTEGER, offset INTEGER, size INTEGER, "
+        "  deduplicated INTEGER DEFAULT 0, FOREIGN KEY (manifest_id) REFERENCES file_manifests(manifest_id));"
+        "CREATE TABLE encryption_keys (job_id INTEGER PRIMARY KEY, key_hex TEXT NOT NULL, "
+        "  FOREIGN KEY (job_id) REFERENCES jobs(job_id));"
+        "CREATE TABLE job_dependencies (job_id INTEGER, depends_on INTEGER, PRIMARY KEY (job_id, depends_on));"
+        "CREATE TABLE channels (channel_id INTEGER PRIMARY KEY AUTOINCREMENT, name TEXT UNIQUE NOT NULL, "
+        "  created_at INTEGER);"
+        "CREATE TABLE messages (msg_id INTEGER PRIMARY KEY AUTOINCREMENT, channel_name TEXT NOT NULL, "
+        "  sender TEXT NOT NULL, content TEXT, msg_type TEXT DEFAULT 'text', created_at INTEGER);"
+        "CREATE INDEX idx_jobs_status ON jobs(status);"
+        "CREATE INDEX idx_chunks_hash ON chunks(hash);"
+        "CREATE INDEX idx_file_manifests_job ON file_manifests(job_id);"
+        "CREATE INDEX idx_file_chunks_manifest ON file_chunks(manifest_id);"
+        "CREATE INDEX idx_messages_channel ON messages(channel_name, created_at);"
+        "INSERT INTO jobs (source_path, backup_name, status, dedup_savings) VALUES ('/src', 'old', 2, 500);"
+        "INSERT INTO chunks VALUES ('" + hex + "', 'chunks/aa/aa/" + hex + "', 4096, 1000, 1, 0, 1);"
+        "INSERT INTO file_manifests (job_id, file_path, file_name, file_size, modified_time, file_hash) "
+        "  VALUES (1, 'f', 'f', 4096, 0, '" + hex + "');"
+        "INSERT INTO file_chunks (manifest_id, chunk_hash, chunk_index, offset, size) "
+        "  VALUES (1, '" + hex + "', 0, 0, 4096);";
+    bool built = sqlite3_open(path.c_str(), &raw) == SQLITE_OK &&
+                 sqlite3_exec(raw, baseline.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK;
+    sqlite3_close(raw);
+
+    HashDigest old_hash;
+    old_hash.fill(0xaa);
+    Database::ChunkMeta row{};
+    row.hash = SHA256::hash(reinterpret_cast<const uint8_t*>("new"), 3);
+    row.location = {1, 0, 700};
+    row.original_size = 4096;
+    row.stored_size = 700;
+    row.compression = static_cast<int>(CompressionType::ZSTD);
+    row.ref_count = 1;
+    Database::WriteBatch batch;
+    batch.chunks.push_back(row);
+
+    std::printf("%-26s %10s %10s\n", "case", "expected", "got");
+    auto check = [](const char* name, int64_t want, int64_t got) {
+        std::printf("%-26s %10lld %10lld%s\n", name, static_cast<long long>(want), static_cast<long long>(got),
+                    want == got ? "" : "  FAIL");
+        if (want != got) g_check_failed = true;
+    };
+    for (int pass = 0; pass < 2; ++pass) {
+        Database db;
+        bool opened = built && db.open(path);
+        check(pass ? "reopens" : "opens", 1, opened);
+        if (!opened) break;
+        auto meta = db.get_chunk_meta(old_hash);
+        auto stats = db.get_stats();
+        if (pass == 0) {
+            check("old chunk readable", 1000, meta ? meta->stored_size : -1);
+            check("completed jobs", 1, stats.completed_jobs);
+            check("dedup savings", 500, static_cast<int64_t>(stats.total_dedup_savings));
+            check("files", 1, stats.total_files);
+            check("chunks", 1, stats.total_chunks);
+            check("new chunk written", 1, db.write_batch(batch));
+            stats = db.get_stats();
+        }
+        check(pass ? "chunks after reopen" : "chunks by trigger", 2, stats.total_chunks);
+        check(pass ? "bytes after reopen" : "bytes by trigger", 1700, static_cast<int64_t>(stats.total_stored_bytes));
+    }
+    fs::remove_all(root);
+}
+
+// ─── Compression pre-check: cost of the check vs a wasted attempt ───
+void bench_precheck() {
+    const size_t chunk = 64 * 1024;
+    const size_t count = 256;
+    auto random = random_bytes(chunk * count, 11);
+    std::vector<uint8_t> text(chunk * count);
+    const char* words[] = {"INFO ", "request ", "served ", "in ", "12ms ", "user=", "4711 ", "ok\n"};
+    for (size_t i = 0, w = 0; i < text.size(); ++w) {
+        const char* s = words[(w * 2654435761u >> 7) % 8];
+        for (; *s && i < text.size(); ++s) text[i++] = static_cast<uint8_t>(*s);
+    }
+
+    std::printf("%-8s %-6s %12s %12s %10s\n", "data", "codec", "check ns/c", "codec ns/c", "ratio");
+    for (auto* data : {&random, &text}) {
+        const char* name = data == &random ? "random" : "text";
+        for (auto type : {CompressionType::LZ4, CompressionType::ZSTD}) {
+            size_t skipped = 0;
+            auto t0 = Clock::now();
+            for (size_t i = 0; i < count; ++i) {
+                skipped += Compressibility::looks_incompressible(data->data() + i * chunk, chunk);
+            }
+            double check = seconds_since(t0);
+
+            uint64_t out = 0;
+            t0 = Clock::now();
+            for (size_t i = 0; i < count; ++i) {
+                out += Compressor::compress(data->data() + i * chunk, chunk, type).size();
+            }
+            double codec = seconds_since(t0);
+
+            std::printf("%-8s %-6s %12.0f %12.0f %9.3f %s\n", name, compression_str(type),
+                        check * 1e9 / count, codec * 1e9 / count,
+                        static_cast<double>(out) / static_cast<double>(data->size()),
+                        skipped == count ? "(skipped)" : skipped ? "(partly skipped)" : "");
+        }
+    }
+}
+
+// ─── Chunk encryption: CBC + re-hash vs GCM tag, MB/s on one core ───
+void bench_cipher() {
+    const size_t chunk = 64 * 1024;
+    const size_t count = 512;
+    auto data = random_bytes(chunk * count, 13);
+    auto at = [&](size_t i) { return data.data() + i * chunk; };
+    auto key = AES256::generate_key();
+    std::vector<HashDigest> digests(count);
+    for (size_t i = 0; i < count; ++i) digests[i] = SHA256::hash(at(i), chunk);
+
+    std::vector<ByteBuffer> cbc(count), gcm(count), own(count);
+    ByteBuffer back;
+    for (size_t i = 0; i < count; ++i) {
+        AES256::encrypt_into(at(i), chunk, key, cbc[i]);
+        AES256::encrypt_gcm_into(at(i), chunk, key, digests[i].data(), SHA256_BIN_LEN, gcm[i]);
+        AES256::encrypt_gcm_into(at(i), chunk, KeyStore::chunk_key(key, digests[i]),
+                                 digests[i].data(), SHA256_BIN_LEN, own[i]);
+    }
+
+    const int rounds = 4;
+    auto run = [&](const char* name, const std::function<bool(size_t)>& fn) {
+        for (size_t i = 0; i < count; ++i) fn(i);  // warm up
+        bool ok = true;
+        auto t0 = Clock::now();
+        for (int r = 0; r < rounds; ++r) {
+            for (size_t i = 0; i < count; ++i) ok = fn(i) && ok;
+        }
+        double secs = seconds_since(t0);
+        std::printf("%-26s %10.1f %s\n", name, mb_per_sec(data.size() * rounds, secs), ok ? "" : "FAILED");
+    };
+
+    std::printf("%-26s %10s\n", "path (64 KB chunks)", "MB/s");
+    run("cbc encrypt (random IV)", [&](size_t i) { return AES256::encrypt_into(at(i), chunk, key, back); });
+    run("gcm encrypt", [&](size_t i) {
+        return AES256::encrypt_gcm_into(at(i), chunk, key, digests[i].data(), SHA256_BIN_LEN, back);
+    });
+    // What the store does: derive the chunk's data key, re-key, encrypt
+    run("gcm encrypt (chunk key)", [&](size_t i) {
+        return AES256::encrypt_gcm_into(at(i), chunk, KeyStore::chunk_key(key, digests[i]),
+                                        digests[i].data(), SHA256_BIN_LEN, back);
+    });
+    // Restore side: CBC needs the plaintext hashed to trust it, GCM's tag
+    // already covers it unless --paranoid
+    run("cbc decrypt + sha256", [&](size_t i) {
+        return AES256::decrypt_into(cbc[i].data(), cbc[i].size(), key, back) &&
+               SHA256::hash(back.data(), back.size()) == digests[i];
+    });
+    run("gcm decrypt (tag)", [&](size_t i) {
+        return AES256::decrypt_gcm_into(gcm[i].data(), gcm[i].size(), key, digests[i].data(), SHA256_BIN_LEN, back);
+    });
+    run("gcm decrypt (chunk key)", [&](size_t i) {
+        return AES256::decrypt_gcm_into(own[i].data(), own[i].size(), KeyStore::chunk_key(key, digests[i]),
+                                        digests[i].data(), SHA256_BIN_LEN, back);
+    });
+    run("gcm decrypt + sha256", [&](size_t i) {
+        return AES256::decrypt_gcm_into(gcm[i].data(), gcm[i].size(), key, digests[i].data(), SHA256_BIN_LEN, back) &&
+               SHA256::hash(back.data(), back.size()) == digests[i];
+    });
+}
+
+// ─── Database: per-call latency of the chunk operations ─────────────
+// Each operation runs over the same digests with the statement cache off
+// (a prepare per call, as before the cache) and on. Then get_chunk_meta
+// from 1-8 threads, all through the writer connection (as under the old
+// process-wide lock) and through the reader pool.
+void bench_db() {
+    namespace fs = std::filesystem;
+    char tmpl[] = "/tmp/ecpb_bench_XXXXXX";
+    if (!mkdtemp(tmpl)) return;
+    std::string root = tmpl;
+
+    const size_t count = 5000;
+    auto seed = random_bytes(count * SHA256_BIN_LEN * 2, 31);
+    auto digest = [&](size_t i) {
+        HashDigest d;
+        std::memcpy(d.data(), seed.data() + i * SHA256_BIN_LEN, SHA256_BIN_LEN);
+        return d;
+    };
+
+    std::printf("%-20s %12s %12s %9s\n", "operation", "uncached us", "cached us", "speedup");
+    {
+        Database db;
+        if (!db.open(root + "/ecpb.db")) return;
+        // store_chunk inserts, so each mode gets its own half of the digests
+        auto time = [&](bool cached, size_t first, const std::function<bool(size_t)>& fn) {
+            db.set_statement_cache(cached);
+            fn(first);  // warm up (and fill the cache)
+            bool ok = true;
+            auto t0 = Clock::now();
+            for (size_t i = first + 1; i < first + count; ++i) ok = fn(i) && ok;
+            double us = seconds_since(t0) * 1e6 / static_cast<double>(count - 1);
+            return ok ? us : -1.0;
+        };
+        auto row = [&](const char* name, bool inserts, const std::function<bool(size_t)>& fn) {
+            double off = time(false, 0, fn);
+            double on = time(true, inserts ? count : 0, fn);
+            std::printf("%-20s %12.2f %12.2f %8.2fx%s\n", name, off, on, on > 0 ? off / on : 0.0,
+                        off < 0 || on < 0 ? "  FAILED" : "");
+        };
+        row("store_chunk", true, [&](size_t i) {
+            ChunkLocation loc{1, i * 4096, 4096};
+            return db.store_chunk(digest(i), loc, 8192, static_cast<int>(CompressionType::LZ4), true);
+        });
+        row("chunk_exists", false, [&](size_t i) { return db.chunk_exists(digest(i)); });
+        row("get_chunk_location", false, [&](size_t i) { return db.get_chunk_location(digest(i)).has_value(); });
+        row("get_chunk_meta", false, [&](size_t i) { return db.get_chunk_meta(digest(i)).has_value(); });
+
+        std::printf("\n%-20s %12s %12s %9s\n", "get_chunk_meta", "writer /s", "pool /s", "speedup");
+        for (size_t threads : {1, 2, 4, 8}) {
+            auto rate = [&](size_t readers) {
+                db.set_readers(readers);
+                std::atomic<size_t> found{0};
+                auto t0 = Clock::now();
+                std::vector<std::thread> pool;
+                for (size_t t = 0; t < threads; ++t) {
+                    pool.emplace_back([&, t] {
+                        size_t hits = 0;
+                        for (size_t i = t; i < count; i += threads) hits += db.get_chunk_meta(digest(i)).has_value();
+                        found += hits;
+                    });
+                }
+                for (auto& th : pool) th.join();
+                double secs = seconds_since(t0);
+                return found == count ? static_cast<double>(count) / secs : -1.0;
+            };
+            double writer = rate(0);
+            double pooled = rate(DB_READERS);
+            char name[32];
+            std::snprintf(name, sizeof(name), "%zu thread%s", threads, threads == 1 ? "" : "s");
+            std::printf("%-20s %12.0f %12.0f %8.2fx%s\n", name, writer, pooled, writer > 0 ? pooled / writer : 0.0,
+                        writer < 0 || pooled < 0 ? "  FAILED" : "");
+        }
+    }
+    fs::remove_all(root);
+}
+
+// ─── Manifests: chunk list layouts ──────────────────────────────────
+// A job of 20000 files with 8 chunks each, written and read back with a
+// file_chunks row per chunk and with packed lists, and the database size
+// of each. The row layout is also read the way restore used to (a chunk
+// query per manifest, every manifest kept in memory).
+void bench_manifests() {
+    namespace fs = std::filesystem;
+    char tmpl[] = "/tmp/ecpb_bench_XXXXXX";
+    if (!mkdtemp(tmpl)) return;
+    std::string root = tmpl;
+
+    const size_t files = 20000;
+    const size_t chunks = 8;
+    const uint32_t chunk_size = 64 * 1024;
+    auto digests = random_bytes(files * chunks * SHA256_BIN_LEN, 41);
+    Database::WriteBatch batch;
+    for (size_t f = 0; f < files; ++f) {
+        FileManifest m;
+        m.file_path = "dir" + std::to_string(f / 100) + "/file" + std::to_string(f);
+        m.file_name = "file" + std::to_string(f);
+        m.file_size = chunks * chunk_size;
+        for (size_t c = 0; c < chunks; ++c) {
+            ChunkInfo ci;
+            std::memcpy(ci.hash.data(), digests.data() + (f * chunks + c) * SHA256_BIN_LEN, SHA256_BIN_LEN);
+            ci.chunk_index = static_cast<uint32_t>(c);
+            ci.offset = c * chunk_size;
+            ci.size = chunk_size;
+            m.chunks.push_back(ci);
+        }
+        batch.manifests.emplace_back(0, std::move(m));
+    }
+
+    std::printf("%-22s %10s %12s %14s %12s\n", "layout", "write ms", "read files/s", "held at once", "db size");
+    for (ChunkListFormat format : {ChunkListFormat::ROWS, ChunkListFormat::PACKED}) {
+        std::string path = root + "/" + chunk_list_str(format) + ".db";
+        Database db;
+        if (!db.open(path)) break;
+        db.set_chunk_list_format(format);
+        BackupJob job;
+        job.source_path = root;
+        job.backup_name = "bench";
+        int job_id = db.create_job(job);
+        for (auto& m : batch.manifests) m.first = job_id;
+
+        auto t0 = Clock::now();
+        bool ok = db.write_batch(batch);
+        double write_secs = seconds_since(t0);
+        db.vacuum();
+        std::error_code ec;
+        uint64_t size = fs::file_size(path, ec);
+
+        auto report = [&](const char* name, double write, double secs, int64_t seen, size_t held) {
+            char w[16] = "";
+            if (write > 0) std::snprintf(w, sizeof(w), "%.1f", write * 1e3);
+            std::printf("%-22s %10s %12.0f %14zu %12s%s\n", name, w, static_cast<double>(seen) / secs, held,
+                        format_bytes(size).c_str(), ok && seen == static_cast<int64_t>(files) ? "" : "  FAILED");
+        };
+
+        if (format == ChunkListFormat::ROWS) {
+            t0 = Clock::now();
+            std::vector<FileManifest> all;
+            sqlite3_stmt* ms = nullptr;
+            sqlite3_prepare_v2(db.raw(), "SELECT manifest_id, file_path, file_name, file_size FROM file_manifests "
+                                         "WHERE job_id=?", -1, &ms, nullptr);
+            sqlite3_bind_int(ms, 1, job_id);
+            while (sqlite3_step(ms) == SQLITE_ROW) {
+                FileManifest m;
+                m.file_path = reinterpret_cast<const char*>(sqlite3_column_text(ms, 1));
+                m.file_name = reinterpret_cast<const char*>(sqlite3_column_text(ms, 2));
+                m.file_size = static_cast<uint64_t>(sqlite3_column_int64(ms, 3));
+                sqlite3_stmt* cs = nullptr;
+                sqlite3_prepare_v2(db.raw(), "SELECT chunk_hash, chunk_index, offset, size FROM file_chunks "
+                                             "WHERE manifest_id=? ORDER BY chunk_index", -1, &cs, nullptr);
+                sqlite3_bind_int(cs, 1, sqlite3_column_int(ms, 0));
+                while (sqlite3_step(cs) == SQLITE_ROW) {
+                    ChunkInfo ci;
+                    std::memcpy(ci.hash.data(), sqlite3_column_blob(cs, 0), SHA256_BIN_LEN);
+                    ci.chunk_index = static_cast<uint32_t>(sqlite3_column_int(cs, 1));
+                    ci.offset = static_cast<uint64_t>(sqlite3_column_int64(cs, 2));
+                    ci.size = static_cast<uint32_t>(sqlite3_column_int(cs, 3));
+                    m.chunks.push_back(ci);
+                }
+                sqlite3_finalize(cs);
+                all.push_back(std::move(m));
+            }
+            sqlite3_finalize(ms);
+            report("rows, query per file", 0, seconds_since(t0), static_cast<int64_t>(all.size()), all.size());
+        }
+
+        t0 = Clock::now();
+        int64_t seen = db.for_each_file_manifest(job_id, [&](const FileManifest& m) {
+            return m.chunks.size() == chunks;
+        });
+        report(format == ChunkListFormat::ROWS ? "rows, streaming join" : "packed, streaming", write_secs,
+               seconds_since(t0), seen, 1);
+    }
+    fs::remove_all(root);
+}
+
+// ─── Catalog statistics: counters against scans ─────────────────────
+// A catalog of 200000 chunks and 50000 files. get_stats reads the trigger
+// kept counters; the scans are the queries it used to run. Then what the
+// triggers cost: inserting the chunk rows with and without them.
+void bench_stats() {
+    namespace fs = std::filesystem;
+    char tmpl[] = "/tmp/ecpb_bench_XXXXXX";
+    if (!mkdtemp(tmpl)) return;
+    std::string root = tmpl;
+
+    const size_t chunk_rows = 200000;
+    const size_t files = 50000;
+    auto digests = random_bytes(chunk_rows * SHA256_BIN_LEN, 51);
+    Database::WriteBatch chunks_batch, files_batch;
+    for (size_t i = 0; i < chunk_rows; ++i) {
+        Database::ChunkMeta row{};
+        std::memcpy(row.hash.data(), digests.data() + i * SHA256_BIN_LEN, SHA256_BIN_LEN);
+        row.location = {1, i * 4096, 4096};
+        row.original_size = 8192;
+        row.stored_size = 4096;
+        row.compression = static_cast<int>(i % 3 ? CompressionType::LZ4 : CompressionType::ZSTD);
+        row.codec_level = i % 3 ? 0 : 3;
+        row.ref_count = 1;
+        chunks_batch.chunks.push_back(row);
+    }
+    for (size_t f = 0; f < files; ++f) {
+        FileManifest m;
+        m.file_path = "file" + std::to_string(f);
+        m.file_name = m.file_path;
+        m.file_size = 4096;
+        files_batch.manifests.emplace_back(0, std::move(m));
+    }
+
+    double insert_us[2] = {0, 0};
+    for (int counters = 1; counters >= 0; --counters) {
+        std::string path = root + "/ecpb" + std::to_string(counters) + ".db";
+        Database db;
+        if (!db.open(path)) break;
+        if (!counters) {
+            for (const char* t : {"stats_chunks_insert", "stats_manifests_insert"}) {
+                std::string sql = std::string("DROP TRIGGER ") + t;
+                sqlite3_exec(db.raw(), sql.c_str(), nullptr, nullptr, nullptr);
+            }
+        }
+        BackupJob job;
+        job.source_path = root;
+        job.backup_name = "bench";
+        int job_id = db.create_job(job);
+        for (auto& m : files_batch.manifests) m.first = job_id;
+        auto t0 = Clock::now();
+        bool ok = db.write_batch(chunks_batch);
+        insert_us[counters] = ok ? seconds_since(t0) * 1e6 / chunk_rows : -1.0;
+        if (!counters || !db.write_batch(files_batch)) continue;
+
+        // The scans get_stats ran before the counters
+        const char* scans[] = {
+            "SELECT COUNT(*) FROM jobs", "SELECT COUNT(*) FROM jobs WHERE status=2",
+            "SELECT COUNT(*) FROM jobs WHERE status=3", "SELECT COUNT(*), COALESCE(SUM(stored_size),0) FROM chunks",
+            "SELECT COALESCE(SUM(dedup_savings),0) FROM jobs", "SELECT COUNT(*) FROM file_manifests",
+            "SELECT COUNT(*) FROM dictionaries", "SELECT COUNT(*) FROM chunks WHERE dict_id != 0",
+            "SELECT compression, codec_level, COUNT(*), COALESCE(SUM(stored_size),0) FROM chunks "
+            "GROUP BY compression, codec_level ORDER BY compression, codec_level",
+        };
+        const int runs = 20;
+        t0 = Clock::now();
+        int64_t scanned = 0;
+        for (int r = 0; r < runs; ++r) {
+            for (const char* sql : scans) {
+                sqlite3_stmt* stmt = nullptr;
+                sqlite3_prepare_v2(db.raw(), sql, -1, &stmt, nullptr);
+                while (sqlite3_step(stmt) == SQLITE_ROW) scanned += sqlite3_column_int64(stmt, 0);
+                sqlite3_finalize(stmt);
+            }
+        }
+        double scan_us = seconds_since(t0) * 1e6 / runs;
+        t0 = Clock::now();
+        Database::DBStats stats{};
+        for (int r = 0; r < runs * 100; ++r) stats = db.get_stats();
+        double counter_us = seconds_since(t0) * 1e6 / (runs * 100);
+        bool match = stats.total_chunks == static_cast<int>(chunk_rows) && stats.total_files == static_cast<int>(files) &&
+                     stats.codecs.size() == 2 && scanned > 0;
+        std::printf("%-28s %12s %12s %9s\n", "get_stats", "scans us", "counters us", "speedup");
+        std::printf("%-28s %12.1f %12.2f %8.0fx%s\n\n", "200k chunks, 50k files", scan_us, counter_us,
+                    counter_us > 0 ? scan_us / counter_us : 0.0, match ? "" : "  FAILED");
+    }
+    std::printf("%-28s %12s %12s\n", "chunk row insert", "counters us", "none us");
+    std::printf("%-28s %12.2f %12.2f\n", "200k rows, one transaction", insert_us[1], insert_us[0]);
+    fs::remove_all(root);
+}
+
+// ─── Allocations: per-chunk kernels once warm ───────────────────────
+// Heap allocations made by `fn` on its second run
+uint64_t count_allocs(const std::function<void()>& fn) {
+    fn();
+    g_allocs = 0;
+    g_count_allocs = true;
+    fn();
+    g_count_allocs = false;
+    return g_allocs.load();
+}
+
+void bench_alloc() {
+#ifndef ECPB_COUNTS_ALLOCS
+    std::printf("allocation counting needs glibc; skipped\n");
+#else
+    const size_t chunk = 64 * 1024;
+    const size_t count = 64;
+    std::vector<uint8_t> text(chunk * count);
+    auto noise = random_bytes(text.size() / 16, 21);
+    const char* words[] = {"GET ", "/api/v1/", "items ", "200 ", "user=", "ms\n", "{\"id\":", "},"};
+    for (size_t i = 0, w = 0; i < text.size(); ++w) {
+        const char* s = words[(noise[w % noise.size()] ^ w) % 8];
+        for (; *s && i < text.size(); ++s) text[i++] = static_cast<uint8_t>(*s);
+    }
+    auto at = [&](size_t i) { return text.data() + i * chunk; };
+
+    std::vector<uint8_t> samples;
+    std::vector<size_t> sizes;
+    for (size_t i = 0; i < count; ++i) {
+        samples.insert(samples.end(), at(i), at(i) + 4096);
+        sizes.push_back(4096);
+    }
+    ZstdDict dict(1, Compressor::train_dictionary(samples, sizes, DICT_MAX_SIZE));
+    auto key = AES256::generate_key();
+
+    ByteBuffer out, back;
+    std::vector<SHA256::Buffer> bufs;
+    for (size_t i = 0; i < count; ++i) bufs.push_back({at(i), chunk});
+    std::vector<HashDigest> digests(count);
+
+    struct Kernel { const char* name; std::function<void()> fn; };
+    std::vector<Kernel> kernels = {
+        {"sha256 batch", [&] { SHA256::hash_many(bufs.data(), count, digests.data()); }},
+        {"lz4 compress", [&] { for (size_t i = 0; i < count; ++i) Compressor::compress_into(at(i), chunk, CompressionType::LZ4, out); }},
+        {"lz4hc compress", [&] {
+            for (size_t i = 0; i < count; ++i) Compressor::compress_into(at(i), chunk, CompressionType::LZ4HC, out, nullptr, 4);
+        }},
+        {"zstd compress", [&] { for (size_t i = 0; i < count; ++i) Compressor::compress_into(at(i), chunk, CompressionType::ZSTD, out); }},
+        {"zstd+dict compress", [&] {
+            for (size_t i = 0; i < count; ++i) Compressor::compress_into(at(i), chunk, CompressionType::ZSTD, out, &dict);
+        }},
+        {"delta encode", [&] { for (size_t i = 1; i < count; ++i) Compressor::delta_encode_into(at(i - 1), chunk, at(i), chunk, out); }},
+        {"aes encrypt", [&] { for (size_t i = 0; i < count; ++i) AES256::encrypt_into(at(i), chunk, key, out); }},
+        {"aes decrypt", [&] {
+            for (size_t i = 0; i < count; ++i) {
+                AES256::encrypt_into(at(i), chunk, key, out);
+                AES256::decrypt_into(out.data(), out.size(), key, back);
+            }
+        }},
+        {"aes-gcm round trip", [&] {
+            for (size_t i = 0; i < count; ++i) {
+                AES256::encrypt_gcm_into(at(i), chunk, key, digests[i].data(), SHA256_BIN_LEN, out);
+                AES256::decrypt_gcm_into(out.data(), out.size(), key, digests[i].data(), SHA256_BIN_LEN, back);
+            }
+        }},
+        {"aes-gcm chunk key trip", [&] {
+            for (size_t i = 0; i < count; ++i) {
+                AES256::Key data_key = KeyStore::chunk_key(key, digests[i]);
+                AES256::encrypt_gcm_into(at(i), chunk, data_key, digests[i].data(), SHA256_BIN_LEN, out);
+                AES256::decrypt_gcm_into(out.data(), out.size(), data_key, digests[i].data(), SHA256_BIN_LEN, back);
+            }
+        }},
+        {"lz4 round trip", [&] {
+            for (size_t i = 0; i < count; ++i) {
+                Compressor::compress_into(at(i), chunk, CompressionType::LZ4, out);
+                Compressor::decompress_into(out.data(), out.size(), chunk, CompressionType::LZ4, back);
+            }
+        }},
+        {"zstd+dict round trip", [&] {
+            for (size_t i = 0; i < count; ++i) {
+                Compressor::compress_into(at(i), chunk, CompressionType::ZSTD, out, &dict);
+                Compressor::decompress_into(out.data(), out.size(), chunk, CompressionType::ZSTD, back, &dict);
+            }
+        }},
+        {"delta round trip", [&] {
+            for (size_t i = 1; i < count; ++i) {
+                Compressor::delta_encode_into(at(i - 1), chunk, at(i), chunk, out);
+                Compressor::delta_decode_into(at(i - 1), chunk, out.data(), out.size(), chunk, back);
+            }
+        }},
+    };
+
+    std::printf("%-22s %10s %12s\n", "kernel", "allocs", "per chunk");
+    for (auto& k : kernels) {
+        uint64_t n = count_allocs(k.fn);
+        std::printf("%-22s %10llu %12.2f%s\n", k.name, static_cast<unsigned long long>(n),
+                    static_cast<double>(n) / count, n ? "  FAIL" : "");
+        if (n) g_check_failed = true;
+    }
+
+    // Whole store_file once warm, inline and through the worker pool.
+    // Opening the file, its manifest and its row cost a few allocations
+    // per file; a file with twice the chunks must not cost any more.
+    namespace fs = std::filesystem;
+    char tmpl[] = "/tmp/ecpb_bench_XXXXXX";
+    if (!mkdtemp(tmpl)) return;
+    std::string root = tmpl;
+    std::printf("\n%-22s %10s %12s\n", "store_file", "per file", "2x chunks");
+    {
+        Database db;
+        if (db.open(root + "/ecpb.db")) {
+            BackupJob job;
+            job.source_path = root;
+            job.backup_name = "bench";
+            int job_id = db.create_job(job);
+            int run = 0;
+            for (size_t threads : {1, 2}) {
+                ChunkStore store(db, root + "/storage" + std::to_string(threads));
+                store.set_pipeline_threads(threads);
+                store.set_chunker_params(ChunkerParams::fixed());
+                // Rows wait for flush(), which runs with counting paused
+                store.set_group_commit(1u << 20, 1u << 30);
+                // The index doubles now and then as it fills; not per chunk
+                store.dedup_index()->reserve(count * 16);
+                auto store_new = [&](size_t chunks) {
+                    return count_allocs([&] {
+                        // A new file each run, written with counting paused
+                        bool counting = g_count_allocs.exchange(false);
+                        std::string src = root + "/input" + std::to_string(run);
+                        auto data = random_bytes(chunk * chunks, static_cast<uint64_t>(++run));
+                        for (size_t i = 0; i < data.size(); i += 2) data[i] &= 0x0f;
+                        {
+                            std::ofstream f(src, std::ios::binary);
+                            f.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+                        }
+                        g_count_allocs = counting;
+                        store.store_file(src, CompressionType::ZSTD, true, key, job_id);
+                        g_count_allocs = false;
+                        store.flush();
+                        fs::remove(src);
+                        g_count_allocs = counting;
+                    });
+                };
+                uint64_t once = store_new(count);
+                uint64_t twice = store_new(count * 2);
+                char name[32];
+                std::snprintf(name, sizeof(name), "zstd+aes, %zu thread%s", threads, threads > 1 ? "s" : "");
+                std::printf("%-22s %10llu %12llu%s\n", name, static_cast<unsigned long long>(once),
+                            static_cast<unsigned long long>(twice), twice > once ? "  FAIL" : "");
+                if (twice > once) g_check_failed = true;
+            }
+        }
+    }
+    fs::remove_all(root);
+#endif
+}
+
+struct Bench { const char* name; std::function<void()> fn; };
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Logger::instance().set_level(LogLevel::WARN);
+
+    std::vector<Bench> benches = {
+        {"chunking", bench_chunking},
+        {"hash",     bench_hash},
+        {"sha-kat",  bench_sha_kat},
+        {"bloom",    bench_bloom},
+        {"pipeline", bench_pipeline},
+        {"files",    bench_files},
+        {"commit-fail", bench_commit_fail},
+        {"old-catalog", bench_old_catalog},
+        {"precheck", bench_precheck},
+        {"cipher",   bench_cipher},
+        {"db",       bench_db},
+        {"manifests", bench_manifests},
+        {"stats",    bench_stats},
+        {"alloc",    bench_alloc},
+    };
+
+    for (auto& b : benches) {
+        bool selected = (argc < 2);
+        for (int i = 1; i < argc; ++i) {
+            if (std::strcmp(argv[i], b.name) == 0) selected = true;
+        }
+        if (!selected) continue;
+        std::printf("=== %s ===\n", b.name);
+        b.fn();
+        std::printf("\n");
+    }
+    return g_check_failed ? 1 : 0;
+}
@@ -0,0 +1,276 @@
+#pragma once
+
+#include "common/logger.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <functional>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+
+namespace ecpb {
+
+// Bloom filter over pre-hashed keys (two independent 64-bit words per key,
+// combined by double hashing). The bit array lives in a MAP_SHARED mapping
+// (a file, or anonymous memory for in-process use) and bits are set with
+// atomic OR, so several processes can add to one filter concurrently.
+//
+// File layout (64-byte header, then the bit array):
+//   "ECPBBLOM" u32 version | u32 k | u64 nbits | u64 capacity |
+//   u64 lookups | u64 negatives | u64 false_positives | u64 replaced
+// The counters live in the mapping too, so lookups made by forked workers
+// show up in the parent's stats. `replaced` is set once a rebuild has
+// renamed a new file over this one; processes still mapping it check it
+// and map the new file (see replaced()).
+class BloomFilter {
+public:
+    static constexpr char     MAGIC[8]   = {'E','C','P','B','B','L','O','M'};
+    static constexpr uint32_t VERSION    = 1;
+    static constexpr size_t   HEADER_LEN = 64;
+    static constexpr size_t   REPLACED_AT = 56;
+
+    enum Counter { LOOKUPS = 0, NEGATIVES = 1, FALSE_POSITIVES = 2 };
+
+    BloomFilter() = default;
+    ~BloomFilter() { close(); }
+    BloomFilter(const BloomFilter&) = delete;
+    BloomFilter& operator=(const BloomFilter&) = delete;
+
+    // Optimal sizing for `capacity` keys at false-positive rate `fp`
+    static uint64_t bits_for(uint64_t capacity, double fp) {
+        double m = -static_cast<double>(capacity) * std::log(fp) / (std::log(2.0) * std::log(2.0));
+        uint64_t bits = static_cast<uint64_t>(m) + 63;
+        return bits - bits % 64;
+    }
+
+    static uint32_t hashes_for(uint64_t capacity, uint64_t bits) {
+        double k = static_cast<double>(bits) / static_cast<double>(capacity) * std::log(2.0);
+        return k < 1.0 ? 1 : static_cast<uint32_t>(std::lround(k));
+    }
+
+    // Build a new filter file: sized, filled by `fill`, then renamed into
+    // place, and the file it replaces marked replaced. Rebuilds by several
+    // processes are serialized by an flock on <path>.lock, and each builds
+    // under its own temporary name. If another process has put a file in
+    // place since this filter was opened and it is big enough, `fill` adds
+    // to that one instead and nothing is rebuilt.
+    bool create(const std::string& path, uint64_t capacity, double fp,
+                const std::function<void(BloomFilter&)>& fill) {
+        std::string lock_path = path + ".lock";
+        int lock = ::open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (lock < 0) {
+            LOG_WARN("BloomFilter: cannot open %s: %s", lock_path.c_str(), strerror(errno));
+            return false;
+        }
+        while (flock(lock, LOCK_EX) != 0 && errno == EINTR) {}
+        bool ok = create_locked(path, capacity, fp, fill);
+        ::close(lock);
+        return ok;
+    }
+
+    // Map an existing filter file
+    bool open(const std::string& path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < HEADER_LEN ||
+            !map(fd, static_cast<size_t>(st.st_size))) {
+            ::close(fd);
+            return false;
+        }
+        ::close(fd);
+        ino_ = st.st_ino;
+        if (!read_header() || HEADER_LEN + nbits_ / 8 != len_) {
+            LOG_WARN("BloomFilter: ignoring malformed %s", path.c_str());
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    // Anonymous shared mapping (inherited by forked children)
+    bool create_anonymous(uint64_t capacity, double fp) {
+        close();
+        uint64_t nbits = bits_for(capacity, fp);
+        void* p = mmap(nullptr, HEADER_LEN + nbits / 8, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return false;
+        base_ = static_cast<uint8_t*>(p);
+        len_ = HEADER_LEN + nbits / 8;
+        write_header(hashes_for(capacity, nbits), nbits, capacity);
+        return true;
+    }
+
+    void close() {
+        if (base_) munmap(base_, len_);
+        base_ = nullptr;
+        words_ = nullptr;
+        counters_ = nullptr;
+        len_ = 0;
+        nbits_ = 0;
+        ino_ = 0;
+    }
+
+    bool is_open() const { return base_ != nullptr; }
+
+    // A rebuild has put a new file in place of this one; adds made here
+    // from now on are seen by nobody else
+    bool replaced() const {
+        return counters_ && __atomic_load_n(&counters_[REPLACED], __ATOMIC_ACQUIRE) != 0;
+    }
+
+    void add(uint64_t h1, uint64_t h2) {
+        h2 |= 1;
+        for (uint32_t i = 0; i < k_; ++i) {
+            uint64_t bit = (h1 + i * h2) % nbits_;
+            __atomic_fetch_or(&words_[bit / 64], uint64_t(1) << (bit % 64), __ATOMIC_RELAXED);
+        }
+    }
+
+    bool maybe_contains(uint64_t h1, uint64_t h2) const {
+        h2 |= 1;
+        for (uint32_t i = 0; i < k_; ++i) {
+            uint64_t bit = (h1 + i * h2) % nbits_;
+            uint64_t w = __atomic_load_n(&words_[bit / 64], __ATOMIC_RELAXED);
+            if (!(w & (uint64_t(1) << (bit % 64)))) return false;
+        }
+        return true;
+    }
+
+    void count(Counter c) {
+        __atomic_fetch_add(&counters_[c], uint64_t(1), __ATOMIC_RELAXED);
+    }
+
+    uint64_t counter(Counter c) const {
+        return counters_ ? __atomic_load_n(&counters_[c], __ATOMIC_RELAXED) : 0;
+    }
+
+    uint64_t capacity() const { return capacity_; }
+    uint64_t bit_count() const { return nbits_; }
+    uint32_t hash_count() const { return k_; }
+    size_t   memory_bytes() const { return len_; }
+
+    // Fraction of set bits (full scan; for stats only)
+    double fill_ratio() const {
+        if (!nbits_) return 0.0;
+        uint64_t set = 0;
+        for (uint64_t i = 0; i < nbits_ / 64; ++i) {
+            set += static_cast<uint64_t>(__builtin_popcountll(__atomic_load_n(&words_[i], __ATOMIC_RELAXED)));
+        }
+        return static_cast<double>(set) / static_cast<double>(nbits_);
+    }
+
+    // Expected false-positive rate at the current fill
+    double estimated_fp_rate() const { return std::pow(fill_ratio(), static_cast<double>(k_)); }
+
+private:
+    uint8_t*  base_     = nullptr;
+    uint64_t* words_    = nullptr;
+    uint64_t* counters_ = nullptr;
+    size_t    len_      = 0;
+    uint64_t  nbits_    = 0;
+    uint64_t  capacity_ = 0;
+    uint32_t  k_        = 0;
+    ino_t     ino_      = 0;   // file last mapped, 0 if none
+
+    enum { REPLACED = (REPLACED_AT - 32) / 8 };   // counters_ index
+
+    bool create_locked(const std::string& path, uint64_t capacity, double fp,
+                       const std::function<void(BloomFilter&)>& fill) {
+        ino_t seen = ino_;
+        close();
+        BloomFilter current;
+        bool exists = current.open(path);
+        if (exists && current.ino_ != seen && current.capacity_ >= capacity) {
+            take(current);
+            fill(*this);
+            return true;
+        }
+
+        std::string tmp = path + ".tmp." + std::to_string(getpid());
+        uint64_t nbits = bits_for(capacity, fp);
+        size_t len = HEADER_LEN + nbits / 8;
+
+        int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            LOG_WARN("BloomFilter: cannot create %s: %s", tmp.c_str(), strerror(errno));
+            return false;
+        }
+        struct stat st;
+        if (ftruncate(fd, static_cast<off_t>(len)) != 0 || fstat(fd, &st) != 0 || !map(fd, len)) {
+            ::close(fd);
+            unlink(tmp.c_str());
+            return false;
+        }
+        ::close(fd);
+        ino_ = st.st_ino;
+        write_header(hashes_for(capacity, nbits), nbits, capacity);
+        fill(*this);
+        msync(base_, len_, MS_SYNC);
+        if (rename(tmp.c_str(), path.c_str()) != 0) {
+            LOG_WARN("BloomFilter: cannot install %s: %s", path.c_str(), strerror(errno));
+            unlink(tmp.c_str());
+            close();
+            return false;
+        }
+        if (exists) __atomic_store_n(&current.counters_[REPLACED], uint64_t(1), __ATOMIC_RELEASE);
+        return true;
+    }
+
+    // Adopt the mapping of `other`, leaving it closed
+    void take(BloomFilter& other) {
+        base_ = other.base_;
+        words_ = other.words_;
+        counters_ = other.counters_;
+        len_ = other.len_;
+        nbits_ = other.nbits_;
+        capacity_ = other.capacity_;
+        k_ = other.k_;
+        ino_ = other.ino_;
+        other.base_ = nullptr;
+        other.close();
+    }
+
+    bool map(int fd, size_t len) {
+        void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            LOG_WARN("BloomFilter: mmap failed: %s", strerror(errno));
+            return false;
+        }
+        base_ = static_cast<uint8_t*>(p);
+        len_ = len;
+        return true;
+    }
+
+    void write_header(uint32_t k, uint64_t nbits, uint64_t capacity) {
+        std::memcpy(base_, MAGIC, sizeof(MAGIC));
+        std::memcpy(base_ + 8, &VERSION, sizeof(VERSION));
+        std::memcpy(base_ + 12, &k, sizeof(k));
+        std::memcpy(base_ + 16, &nbits, sizeof(nbits));
+        std::memcpy(base_ + 24, &capacity, sizeof(capacity));
+        std::memset(base_ + 32, 0, HEADER_LEN - 32);
+        read_header();
+    }
+
+    bool read_header() {
+        uint32_t version;
+        if (std::memcmp(base_, MAGIC, sizeof(MAGIC)) != 0) return false;
+        std::memcpy(&version, base_ + 8, sizeof(version));
+        std::memcpy(&k_, base_ + 12, sizeof(k_));
+        std::memcpy(&nbits_, base_ + 16, sizeof(nbits_));
+        std::memcpy(&capacity_, base_ + 24, sizeof(capacity_));
+        counters_ = reinterpret_cast<uint64_t*>(base_ + 32);
+        words_ = reinterpret_cast<uint64_t*>(base_ + HEADER_LEN);
+        return version == VERSION && k_ > 0 && nbits_ > 0 && nbits_ % 64 == 0;
+    }
+};
+
+} // namespace ecpb
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <optional>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+
+namespace ecpb {
+
+// Blocking FIFO with a fixed capacity: push() waits while full, pop() waits
+// while empty. close() wakes everyone; pop() then drains what is left and
+// returns nullopt, push() fails. Items sit in a ring allocated up front, so
+// T must be default-constructible and steady traffic does not allocate.
+template<typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity ? capacity : 1), slots_(capacity_) {}
+
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        not_full_.wait(lock, [this] { return closed_ || count_ < capacity_; });
+        if (closed_) return false;
+        slots_[(head_ + count_) % capacity_] = std::move(item);
+        ++count_;
+        not_empty_.notify_one();
+        return true;
+    }
+
+    std::optional<T> pop() {
+        std::unique_lock<std::mutex> lock(mtx_);
+        not_empty_.wait(lock, [this] { return closed_ || count_ > 0; });
+        if (count_ == 0) return std::nullopt;
+        T item = std::move(slots_[head_]);
+        slots_[head_] = T();
+        head_ = (head_ + 1) % capacity_;
+        --count_;
+        not_full_.notify_one();
+        return item;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mtx_);
+        closed_ = true;
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return count_;
+    }
+
+    size_t capacity() const { return capacity_; }
+
+private:
+    size_t capacity_;
+    std::vector<T> slots_;
+    size_t head_ = 0;
+    size_t count_ = 0;
+    bool closed_ = false;
+    mutable std::mutex mtx_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+};
+
+} // namespace ecpb
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace ecpb {
+
+// ─── Byte Buffer ─────────────────────────────────────────────────────
+// Growable byte buffer for chunk data. Unlike std::vector<uint8_t> it is
+// 64-byte aligned and resize() neither shrinks the allocation nor fills new
+// bytes, so a buffer reused across chunks stops allocating once it has
+// held the largest one.
+class ByteBuffer {
+public:
+    static constexpr size_t ALIGN = 64;
+
+    ByteBuffer() = default;
+    ~ByteBuffer() { std::free(data_); }
+
+    ByteBuffer(ByteBuffer&& o) noexcept : data_(o.data_), size_(o.size_), cap_(o.cap_) {
+        o.data_ = nullptr;
+        o.size_ = o.cap_ = 0;
+    }
+    ByteBuffer& operator=(ByteBuffer&& o) noexcept {
+        if (this != &o) {
+            std::free(data_);
+            data_ = o.data_;
+            size_ = o.size_;
+            cap_ = o.cap_;
+            o.data_ = nullptr;
+            o.size_ = o.cap_ = 0;
+        }
+        return *this;
+    }
+    ByteBuffer(const ByteBuffer&) = delete;
+    ByteBuffer& operator=(const ByteBuffer&) = delete;
+
+    uint8_t* data() { return data_; }
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+    size_t capacity() const { return cap_; }
+    bool empty() const { return size_ == 0; }
+
+    // Bytes up to the old size are kept; bytes past it are uninitialised
+    void resize(size_t n) {
+        if (n > cap_) grow(n);
+        size_ = n;
+    }
+    void reserve(size_t n) {
+        if (n > cap_) grow(n);
+    }
+    void clear() { size_ = 0; }
+    void assign(const uint8_t* p, size_t n) {
+        resize(n);
+        if (n) std::memcpy(data_, p, n);
+    }
+    void swap(ByteBuffer& o) noexcept {
+        std::swap(data_, o.data_);
+        std::swap(size_, o.size_);
+        std::swap(cap_, o.cap_);
+    }
+
+private:
+    uint8_t* data_ = nullptr;
+    size_t   size_ = 0;
+    size_t   cap_ = 0;
+
+    void grow(size_t n) {
+        size_t cap = std::max(n, cap_ + cap_ / 2);
+        cap = (cap + ALIGN - 1) / ALIGN * ALIGN;
+        void* p = std::aligned_alloc(ALIGN, cap);
+        if (!p) throw std::bad_alloc();
+        if (size_) std::memcpy(p, data_, size_);
+        std::free(data_);
+        data_ = static_cast<uint8_t*>(p);
+        cap_ = cap;
+    }
+};
+
+// ─── Buffer Pool ─────────────────────────────────────────────────────
+// Spare ByteBuffers shared between threads, for buffers that live about as
+// long as one file (read windows, pipeline batches). acquire() hands out a
+// cached buffer with its capacity intact, or a new one; release() keeps up
+// to `max_cached` and frees the rest.
+class BufferPool {
+public:
+    explicit BufferPool(size_t max_cached = 16) : max_cached_(max_cached) {
+        free_.reserve(max_cached_);
+    }
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    ByteBuffer acquire() {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (free_.empty()) return ByteBuffer();
+        ByteBuffer b = std::move(free_.back());
+        free_.pop_back();
+        b.clear();
+        return b;
+    }
+
+    void release(ByteBuffer&& b) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (free_.size() < max_cached_ && b.capacity()) free_.push_back(std::move(b));
+    }
+
+    // A pooled buffer for the lifetime of a scope
+    class Lease {
+    public:
+        explicit Lease(BufferPool& pool) : pool_(pool), buf_(pool.acquire()) {}
+        ~Lease() { pool_.release(std::move(buf_)); }
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        ByteBuffer& operator*() { return buf_; }
+        ByteBuffer* operator->() { return &buf_; }
+
+    private:
+        BufferPool& pool_;
+        ByteBuffer  buf_;
+    };
+
+    size_t cached() const {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return free_.size();
+    }
+
+private:
+    size_t max_cached_;
+    std::vector<ByteBuffer> free_;
+    mutable std::mutex mtx_;
+};
+
+} // namespace ecpb
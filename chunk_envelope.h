@@ -0,0 +1,170 @@
+#pragma once
+
+#include "common/types.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+
+#if defined(__x86_64__)
+#define ECPB_CRC32C_X86 1
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+namespace ecpb {
+
+// ─── Chunk Envelope ──────────────────────────────────────────────────
+// Header in front of the stored bytes of every pack record written since
+// pack records carried the "ECHV" magic. It says how to read the chunk
+// back, so restore does not depend on the settings of the job that asked
+// for it (dedup shares chunks between jobs with different codecs and
+// keys):
+//
+//   u8 version | u8 kind | u8 codec | u8 level | u8 cipher | 3 zero bytes
+//   u64 key id | u32 dict id | u32 original length | u32 stored length
+//   u32 CRC32C | 32-byte base digest (DELTA only) | stored bytes
+//
+// Once decrypted, the stored bytes are the chunk itself (RAW), a frame of
+// `codec` (COMPRESSED, with dictionary `dict id` if non-zero) or a delta
+// against the chunk `base` (DELTA). `key id` names the encryption key
+// without revealing it (see ChunkStore::key_tag). New chunks use
+// AES256_GCM_CHUNK_KEY: GCM under the chunk's own data key, derived from
+// that key and the chunk digest (see KeyStore). AES256_GCM (the key itself)
+// and AES256_CBC are only read. GCM takes the chunk digest as associated
+// data. The CRC covers the header, with the CRC field zero, and the stored
+// bytes. Integers are little-endian on every host.
+struct ChunkEnvelope {
+    enum class Kind : uint8_t { RAW = 0, COMPRESSED = 1, DELTA = 2 };
+    enum class Cipher : uint8_t { NONE = 0, AES256_CBC = 1, AES256_GCM = 2, AES256_GCM_CHUNK_KEY = 3 };
+
+    static constexpr uint8_t VERSION   = 1;
+    static constexpr size_t  FIXED_LEN = 32;
+    static constexpr size_t  MAX_LEN   = FIXED_LEN + SHA256_BIN_LEN;
+    static constexpr size_t  CRC_AT    = 28;
+
+    Kind            kind = Kind::RAW;
+    CompressionType codec = CompressionType::NONE;
+    int             level = 0;
+    Cipher          cipher = Cipher::NONE;
+    int64_t         key_id = 0;        // 0: the caller's key (records without an envelope)
+    int             dict_id = 0;
+    uint32_t        original_len = 0;
+    uint32_t        stored_len = 0;
+    HashDigest      base{};            // DELTA only
+
+    size_t header_len() const { return kind == Kind::DELTA ? MAX_LEN : FIXED_LEN; }
+
+    // Header for the stored bytes `stored` (stored_len of them) into
+    // out[MAX_LEN]; returns its length
+    size_t encode(const uint8_t* stored, uint8_t* out) const {
+        size_t len = header_len();
+        std::memset(out, 0, FIXED_LEN);
+        out[0] = VERSION;
+        out[1] = static_cast<uint8_t>(kind);
+        out[2] = static_cast<uint8_t>(codec);
+        out[3] = static_cast<uint8_t>(level);
+        out[4] = static_cast<uint8_t>(cipher);
+        put_le64(out + 8, static_cast<uint64_t>(key_id));
+        put_le32(out + 16, static_cast<uint32_t>(dict_id));
+        put_le32(out + 20, original_len);
+        put_le32(out + 24, stored_len);
+        if (kind == Kind::DELTA) std::memcpy(out + FIXED_LEN, base.data(), SHA256_BIN_LEN);
+        put_le32(out + CRC_AT, crc32c(crc32c(0, out, len), stored, stored_len));
+        return len;
+    }
+
+    // Parse a record payload: header, then the stored bytes. Fails on an
+    // unknown version or kind, a length mismatch or a bad CRC. `body`
+    // receives the stored bytes.
+    static std::optional<ChunkEnvelope> decode(const uint8_t* p, size_t len, const uint8_t** body) {
+        if (len < FIXED_LEN || p[0] != VERSION || p[1] > static_cast<uint8_t>(Kind::DELTA)) return std::nullopt;
+        ChunkEnvelope env;
+        env.kind = static_cast<Kind>(p[1]);
+        env.codec = static_cast<CompressionType>(p[2]);
+        env.level = p[3];
+        env.cipher = static_cast<Cipher>(p[4]);
+        env.key_id = static_cast<int64_t>(get_le64(p + 8));
+        env.dict_id = static_cast<int>(get_le32(p + 16));
+        env.original_len = get_le32(p + 20);
+        env.stored_len = get_le32(p + 24);
+        uint32_t crc = get_le32(p + CRC_AT);
+        size_t head = env.header_len();
+        if (len != head + env.stored_len) return std::nullopt;
+        if (env.kind == Kind::DELTA) std::memcpy(env.base.data(), p + FIXED_LEN, SHA256_BIN_LEN);
+
+        static const uint8_t zero[4] = {};
+        uint32_t check = crc32c(0, p, CRC_AT);
+        check = crc32c(check, zero, sizeof(zero));
+        check = crc32c(check, p + FIXED_LEN, len - FIXED_LEN);
+        if (check != crc) return std::nullopt;
+        *body = p + head;
+        return env;
+    }
+
+    // CRC32C (Castagnoli), continuing from `crc` (0 to start). SSE4.2
+    // when the CPU has it, a table otherwise.
+    static uint32_t crc32c(uint32_t crc, const uint8_t* p, size_t len) {
+#ifdef ECPB_CRC32C_X86
+        static const bool hw = cpu_has_sse42();
+        if (hw) return ~crc32c_sse42(~crc, p, len);
+#endif
+        return ~crc32c_table(~crc, p, len);
+    }
+
+private:
+    static void put_le32(uint8_t* p, uint32_t v) {
+        for (int i = 0; i < 4; ++i) p[i] = static_cast<uint8_t>(v >> (8 * i));
+    }
+    static void put_le64(uint8_t* p, uint64_t v) {
+        for (int i = 0; i < 8; ++i) p[i] = static_cast<uint8_t>(v >> (8 * i));
+    }
+    static uint32_t get_le32(const uint8_t* p) {
+        uint32_t v = 0;
+        for (int i = 0; i < 4; ++i) v |= static_cast<uint32_t>(p[i]) << (8 * i);
+        return v;
+    }
+    static uint64_t get_le64(const uint8_t* p) {
+        uint64_t v = 0;
+        for (int i = 0; i < 8; ++i) v |= static_cast<uint64_t>(p[i]) << (8 * i);
+        return v;
+    }
+
+    static uint32_t crc32c_table(uint32_t crc, const uint8_t* p, size_t len) {
+        static const std::array<uint32_t, 256> table = [] {
+            std::array<uint32_t, 256> t{};
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k) c = (c >> 1) ^ (c & 1 ? 0x82F63B78u : 0);
+                t[i] = c;
+            }
+            return t;
+        }();
+        for (size_t i = 0; i < len; ++i) crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+        return crc;
+    }
+
+#ifdef ECPB_CRC32C_X86
+    __attribute__((target("sse4.2")))
+    static uint32_t crc32c_sse42(uint32_t crc, const uint8_t* p, size_t len) {
+        uint64_t c = crc;
+        for (; len >= 8; p += 8, len -= 8) {
+            uint64_t w;
+            std::memcpy(&w, p, sizeof(w));
+            c = _mm_crc32_u64(c, w);
+        }
+        uint32_t c32 = static_cast<uint32_t>(c);
+        for (; len > 0; ++p, --len) c32 = _mm_crc32_u8(c32, *p);
+        return c32;
+    }
+
+    static bool cpu_has_sse42() {
+        unsigned a, b, c, d;
+        return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSE4_2);
+    }
+#endif
+};
+
+} // namespace ecpb
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "common/types.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace ecpb {
+
+// ─── Packed Chunk List ───────────────────────────────────────────────
+// A manifest's chunk list as one blob (file_manifests.chunk_list), in
+// place of a file_chunks row per chunk:
+//
+//   u8 version | varint count | count entries of
+//   u8 flags | varint size | [varint offset] | [32-byte digest]
+//
+// Flags: DEDUP, ZERO_RUN (no digest follows) and OFFSET. Entries are in
+// chunk_index order and index is the position. A chunk starts where the
+// previous one ended unless OFFSET is set, in which case its offset
+// follows, so a contiguous file costs one byte of offsets in total.
+// A 64 KB chunk takes 36 bytes.
+class ChunkList {
+public:
+    static constexpr uint8_t VERSION = 1;
+
+    static void encode(const std::vector<ChunkInfo>& chunks, std::vector<uint8_t>& out) {
+        out.clear();
+        out.reserve(1 + 5 + chunks.size() * (2 + 5 + SHA256_BIN_LEN));
+        out.push_back(VERSION);
+        put_varint(out, chunks.size());
+        uint64_t next = 0;   // where the previous chunk ended
+        for (auto& c : chunks) {
+            uint8_t flags = (c.deduplicated ? DEDUP : 0) | (c.zero_run ? ZERO_RUN : 0) |
+                            (c.offset != next ? OFFSET : 0);
+            out.push_back(flags);
+            put_varint(out, c.size);
+            if (flags & OFFSET) put_varint(out, c.offset);
+            if (!c.zero_run) out.insert(out.end(), c.hash.begin(), c.hash.end());
+            next = c.offset + c.size;
+        }
+    }
+
+    // False on a truncated or malformed list; `out` is then incomplete
+    static bool decode(const uint8_t* p, size_t len, std::vector<ChunkInfo>& out) {
+        out.clear();
+        const uint8_t* end = p + len;
+        uint64_t count;
+        if (p == end || *p++ != VERSION || !get_varint(p, end, count)) return false;
+        if (count > len) return false;   // every entry takes at least two bytes
+        out.reserve(static_cast<size_t>(count));
+        uint64_t next = 0;
+        for (uint64_t i = 0; i < count; ++i) {
+            if (p == end) return false;
+            uint8_t flags = *p++;
+            uint64_t size, offset = next;
+            if (flags & ~(DEDUP | ZERO_RUN | OFFSET) || !get_varint(p, end, size) || size > UINT32_MAX ||
+                ((flags & OFFSET) && !get_varint(p, end, offset))) return false;
+            ChunkInfo c;
+            c.offset = offset;
+            c.size = static_cast<uint32_t>(size);
+            c.chunk_index = static_cast<uint32_t>(i);
+            c.deduplicated = flags & DEDUP;
+            c.zero_run = flags & ZERO_RUN;
+            if (!c.zero_run) {
+                if (static_cast<size_t>(end - p) < SHA256_BIN_LEN) return false;
+                std::memcpy(c.hash.data(), p, SHA256_BIN_LEN);
+                p += SHA256_BIN_LEN;
+            }
+            next = offset + size;
+            out.push_back(c);
+        }
+        return p == end;
+    }
+
+private:
+    enum : uint8_t { DEDUP = 1, ZERO_RUN = 2, OFFSET = 4 };
+
+    static void put_varint(std::vector<uint8_t>& out, uint64_t v) {
+        while (v >= 0x80) {
+            out.push_back(static_cast<uint8_t>(v) | 0x80);
+            v >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(v));
+    }
+
+    static bool get_varint(const uint8_t*& p, const uint8_t* end, uint64_t& v) {
+        v = 0;
+        for (int shift = 0; shift < 64 && p != end; shift += 7) {
+            uint8_t b = *p++;
+            v |= static_cast<uint64_t>(b & 0x7f) << shift;
+            if (!(b & 0x80)) return true;
+        }
+        return false;
+    }
+};
+
+} // namespace ecpb
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "common/types.h"
+#include "storage/rolling_checksum.h"
+#include <cstdint>
+#include <cstddef>
+
+namespace ecpb {
+
+// Chunk size bounds. FIXED mode uses max_size for every block.
+struct ChunkerParams {
+    ChunkingMode mode     = ChunkingMode::CDC;
+    size_t       min_size = CDC_MIN_SIZE;
+    size_t       avg_size = CDC_AVG_SIZE;
+    size_t       max_size = CDC_MAX_SIZE;
+
+    // Derive min/max from an average using the usual 1/4x .. 4x spread
+    static ChunkerParams cdc(size_t avg) {
+        ChunkerParams p;
+        p.avg_size = avg;
+        p.min_size = avg / 4;
+        p.max_size = avg * 4;
+        return p;
+    }
+
+    static ChunkerParams fixed(size_t size = CHUNK_SIZE) {
+        ChunkerParams p;
+        p.mode = ChunkingMode::FIXED;
+        p.min_size = p.avg_size = p.max_size = size;
+        return p;
+    }
+};
+
+// Splits a byte stream into chunks. In CDC mode boundaries are chosen by
+// content (FastCDC with normalized chunking), so an insert or delete only
+// disturbs the chunks around the edit instead of shifting every block after it.
+class Chunker {
+public:
+    using Params = ChunkerParams;
+
+    explicit Chunker(const Params& params = Params()) { configure(params); }
+
+    void configure(const Params& params) {
+        params_ = params;
+        if (params_.min_size == 0) params_.min_size = 1;
+        if (params_.avg_size < params_.min_size) params_.avg_size = params_.min_size;
+        if (params_.max_size < params_.avg_size) params_.max_size = params_.avg_size;
+
+        // Normalized chunking: a stricter mask (bits+2) before the average
+        // size and a looser one (bits-2) after it pulls sizes towards avg.
+        int bits = 0;
+        while ((size_t(1) << (bits + 1)) <= params_.avg_size) ++bits;
+        mask_small_ = top_bits(bits + 2);
+        mask_large_ = top_bits(bits > 2 ? bits - 2 : 1);
+    }
+
+    const Params& params() const { return params_; }
+
+    // Largest amount of data next_cut() may need to see before deciding
+    size_t max_chunk() const { return params_.max_size; }
+
+    // Length of the chunk starting at data[0]. Returns 0 when no boundary
+    // was found and more data is needed (only possible when !eof and
+    // len < max_chunk()).
+    size_t next_cut(const uint8_t* data, size_t len, bool eof) const {
+        if (len == 0) return 0;
+        if (params_.mode == ChunkingMode::FIXED) {
+            if (len >= params_.max_size) return params_.max_size;
+            return eof ? len : 0;
+        }
+
+        if (len <= params_.min_size) return eof ? len : 0;
+        size_t limit = len < params_.max_size ? len : params_.max_size;
+        size_t normal = params_.avg_size < limit ? params_.avg_size : limit;
+
+        // Cut points below min_size are never taken, so skip hashing them
+        GearHash gear;
+        size_t i = params_.min_size;
+        for (; i < normal; ++i) {
+            gear.roll(data[i]);
+            if ((gear.digest() & mask_small_) == 0) return i + 1;
+        }
+        for (; i < limit; ++i) {
+            gear.roll(data[i]);
+            if ((gear.digest() & mask_large_) == 0) return i + 1;
+        }
+        if (limit == params_.max_size || eof) return limit;
+        return 0;
+    }
+
+private:
+    Params   params_;
+    uint64_t mask_small_ = 0;
+    uint64_t mask_large_ = 0;
+
+    // The high bits of a gear fingerprint cover the widest byte window
+    static uint64_t top_bits(int n) {
+        if (n <= 0) return 0;
+        if (n >= 64) return ~0ULL;
+        return ~0ULL << (64 - n);
+    }
+};
+
+} // namespace ecpb
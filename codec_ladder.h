@@ -0,0 +1,194 @@
+#pragma once
+
+#include "common/types.h"
+#include "common/logger.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <sys/resource.h>
+
+namespace ecpb {
+
+// ─── Codec Ladder ────────────────────────────────────────────────────
+// Codec choice for ADAPTIVE jobs. Rungs run from cheapest (NONE) to
+// strongest (ZSTD 19); LZ4HC sits above LZ4 as the rung that keeps LZ4's
+// decode speed. Whoever compresses reports the bytes and codec time of
+// each chunk. Every ADAPT_WINDOW_BYTES of codec input the ladder takes the
+// codec cost per byte (spread over the cores) and either
+//   - holds a target rate: step down while the codec is slower than the
+//     target, up while the next rung is expected to keep up with it, or
+//   - with no target, spends idle CPU: the process's CPU time over the
+//     window says how busy the cores were. Step down above
+//     ADAPT_BUSY_HIGH (the codec competes with hashing, I/O and commits);
+//     step up while the next rung's extra cost is expected to keep the
+//     cores below it. Waiting on a slow disk or network shows up as idle.
+// At most one rung per window. The measured cost of each rung is kept for
+// ADAPT_MEMORY_WINDOWS windows, so a rung just left for being too slow is
+// not tried again at once; an unmeasured rung is assumed twice as costly
+// as the current one.
+//
+// Thread-safe; one ladder serves every file of a ChunkStore.
+class CodecLadder {
+public:
+    struct Rung {
+        CompressionType type;
+        int             level;   // 0: the codec's default
+    };
+
+    static constexpr Rung RUNGS[] = {
+        {CompressionType::NONE, 0},
+        {CompressionType::LZ4, 0},
+        {CompressionType::LZ4HC, 4},
+        {CompressionType::ZSTD, 1},
+        {CompressionType::ZSTD, 3},
+        {CompressionType::ZSTD, 6},
+        {CompressionType::ZSTD, 9},
+        {CompressionType::ZSTD, 12},
+        {CompressionType::ZSTD, 15},
+        {CompressionType::ZSTD, 19},
+    };
+    static constexpr size_t RUNG_COUNT = sizeof(RUNGS) / sizeof(RUNGS[0]);
+    static constexpr size_t START_RUNG = 1;   // LZ4, the fixed default
+
+    CodecLadder() {
+        unsigned hw = std::thread::hardware_concurrency();
+        parallel_ = hw ? hw : 1;
+    }
+
+    CodecLadder(const CodecLadder&) = delete;
+    CodecLadder& operator=(const CodecLadder&) = delete;
+
+    // Codec MB/s to hold (0: spend idle CPU on ratio)
+    void set_target(double mb_per_sec) { target_ = mb_per_sec > 0 ? mb_per_sec : 0; }
+    double target() const { return target_; }
+
+    // Rung index for the next chunk
+    size_t current() const { return rung_.load(std::memory_order_relaxed); }
+    static const Rung& rung(size_t index) { return RUNGS[index]; }
+
+    // `bytes` of input went through rung `index` in `ns` (0 for NONE).
+    // Chunks compressed on a rung already left are not counted.
+    void record_codec(size_t index, size_t bytes, uint64_t ns) {
+        if (index != current()) return;
+        if (!window_open_.load(std::memory_order_relaxed)) open_window();
+        codec_ns_.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t total = codec_bytes_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        if (total >= ADAPT_WINDOW_BYTES) evaluate();
+    }
+
+    // Moves made so far
+    uint64_t moves() const { return moves_.load(std::memory_order_relaxed); }
+
+    static std::string rung_str(size_t index) { return codec_str(RUNGS[index].type, RUNGS[index].level); }
+
+private:
+    std::atomic<size_t>   rung_{START_RUNG};
+    std::atomic<uint64_t> codec_bytes_{0};
+    std::atomic<uint64_t> codec_ns_{0};
+    std::atomic<uint64_t> moves_{0};
+    std::atomic<bool>     window_open_{false};
+    double target_ = 0;
+    size_t parallel_;
+
+    std::mutex mtx_;                       // held while deciding or opening a window
+    uint64_t window_ = 0;
+    uint64_t window_wall_ns_ = 0;          // when the open window started
+    uint64_t window_cpu_ns_ = 0;
+    double   cost_[RUNG_COUNT] = {};       // measured codec ns per byte, one core
+    uint64_t seen_[RUNG_COUNT] = {};       // window the cost was measured in (0: never)
+
+    void evaluate() {
+        std::unique_lock<std::mutex> lock(mtx_, std::try_to_lock);
+        if (!lock.owns_lock()) return;      // another thread is deciding
+        uint64_t bytes = codec_bytes_.exchange(0);
+        if (bytes < ADAPT_WINDOW_BYTES) {   // lost a race with a decision
+            codec_bytes_.fetch_add(bytes);
+            return;
+        }
+        uint64_t codec_ns = codec_ns_.exchange(0);
+        uint64_t wall_ns = wall_now() - window_wall_ns_;
+        uint64_t cpu_ns = cpu_now() - window_cpu_ns_;
+        window_open_.store(false);
+        ++window_;
+
+        size_t at = current();
+        double cost = static_cast<double>(codec_ns) / static_cast<double>(bytes);
+        cost_[at] = cost;
+        seen_[at] = window_;
+
+        double spread = cost / static_cast<double>(parallel_);
+        double next = at + 1 < RUNG_COUNT ? expected_cost(at + 1, cost) / static_cast<double>(parallel_) : 0;
+        double capacity = static_cast<double>(wall_ns) * static_cast<double>(parallel_);
+        double busy = capacity > 0 ? static_cast<double>(cpu_ns) / capacity : 1.0;
+        bool up = false, down = false;
+        if (target_ > 0) {
+            double budget = 1e9 / (target_ * 1024.0 * 1024.0);   // ns per byte at the target
+            down = spread > budget;
+            up = !down && next * ADAPT_TARGET_HEADROOM <= budget;
+        } else {
+            double extra = (next - spread) * static_cast<double>(bytes) * static_cast<double>(parallel_);
+            down = busy > ADAPT_BUSY_HIGH;
+            up = !down && capacity > 0 && busy + extra / capacity < ADAPT_BUSY_HIGH;
+        }
+        size_t to = at;
+        if (down && at > 0) to = at - 1;
+        if (up && at + 1 < RUNG_COUNT) to = at + 1;
+        if (to == at) return;
+
+        rung_.store(to, std::memory_order_relaxed);
+        moves_.fetch_add(1, std::memory_order_relaxed);
+        if (target_ > 0) {
+            LOG_INFO("Codec ladder: %s -> %s (codec %s on %zu core(s), target %.0f MB/s)",
+                     rung_str(at).c_str(), rung_str(to).c_str(), rate_str(spread).c_str(), parallel_, target_);
+        } else {
+            LOG_INFO("Codec ladder: %s -> %s (codec %s on %zu core(s), CPU %.0f%% busy)",
+                     rung_str(at).c_str(), rung_str(to).c_str(), rate_str(spread).c_str(), parallel_,
+                     busy * 100.0);
+        }
+    }
+
+    // A window starts with its first chunk, so time between jobs does not
+    // count as idle
+    void open_window() {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (window_open_.load()) return;
+        window_wall_ns_ = wall_now();
+        window_cpu_ns_ = cpu_now();
+        window_open_.store(true);
+    }
+
+    static uint64_t wall_now() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    // User + system time of the whole process
+    static uint64_t cpu_now() {
+        struct rusage ru;
+        if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+        auto ns = [](const timeval& tv) {
+            return static_cast<uint64_t>(tv.tv_sec) * 1000000000ull + static_cast<uint64_t>(tv.tv_usec) * 1000ull;
+        };
+        return ns(ru.ru_utime) + ns(ru.ru_stime);
+    }
+
+    double expected_cost(size_t index, double current_cost) const {
+        if (seen_[index] && window_ - seen_[index] < ADAPT_MEMORY_WINDOWS) return cost_[index];
+        return current_cost * 2;
+    }
+
+    static std::string rate_str(double ns_per_byte) {
+        if (ns_per_byte <= 0) return "unbounded";
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%.0f MB/s", 1e9 / ns_per_byte / (1024.0 * 1024.0));
+        return buf;
+    }
+};
+
+} // namespace ecpb
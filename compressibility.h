@@ -0,0 +1,87 @@
+#pragma once
+
+#include "common/types.h"
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+namespace ecpb {
+
+// ─── Compressibility Pre-check ───────────────────────────────────────
+// Cheap tests run before handing a chunk to LZ4/ZSTD, so data that will
+// not shrink (media, archives, encrypted or random bytes) is stored raw
+// without paying for a compression attempt. Either test may be wrong; the
+// cost of a miss is a chunk stored raw that would have shrunk a little.
+class Compressibility {
+public:
+    // Name of a compressed container format recognised from the first
+    // bytes of a file, or nullptr
+    static const char* compressed_format(const uint8_t* p, size_t len) {
+        struct Magic {
+            const char* name;
+            size_t      offset;
+            const char* bytes;
+            size_t      len;
+        };
+        static const Magic magics[] = {
+            {"jpeg", 0, "\xFF\xD8\xFF", 3},
+            {"png",  0, "\x89PNG\r\n\x1A\n", 8},
+            {"gif",  0, "GIF8", 4},
+            {"zip",  0, "PK\x03\x04", 4},          // also docx/xlsx/jar/apk
+            {"gzip", 0, "\x1F\x8B", 2},
+            {"bzip2", 0, "BZh", 3},
+            {"xz",   0, "\xFD" "7zXZ\x00", 6},
+            {"zstd", 0, "\x28\xB5\x2F\xFD", 4},
+            {"7z",   0, "7z\xBC\xAF\x27\x1C", 6},
+            {"mp4",  4, "ftyp", 4},                // also mov/m4a/heic
+            {"webm", 0, "\x1A\x45\xDF\xA3", 4},    // also mkv
+        };
+        for (auto& m : magics) {
+            if (len >= m.offset + m.len && std::memcmp(p + m.offset, m.bytes, m.len) == 0) return m.name;
+        }
+        return nullptr;
+    }
+
+    // Shannon entropy (bits per byte) of up to COMPRESS_SAMPLE_BYTES taken
+    // as evenly spaced slices across the chunk
+    static double sample_entropy(const uint8_t* data, size_t len) {
+        uint32_t counts[256] = {};
+        size_t sampled = 0;
+        if (len <= COMPRESS_SAMPLE_BYTES) {
+            for (size_t i = 0; i < len; ++i) ++counts[data[i]];
+            sampled = len;
+        } else {
+            size_t stride = (len - SLICE) / (SLICES - 1);
+            for (size_t s = 0; s < SLICES; ++s) {
+                const uint8_t* p = data + s * stride;
+                for (size_t i = 0; i < SLICE; ++i) ++counts[p[i]];
+            }
+            sampled = SLICES * SLICE;
+        }
+        if (sampled == 0) return 0.0;
+
+        double bits = 0.0;
+        double inv = 1.0 / static_cast<double>(sampled);
+        for (uint32_t c : counts) {
+            if (c == 0) continue;
+            double p = c * inv;
+            bits -= p * std::log2(p);
+        }
+        return bits;
+    }
+
+    // Byte statistics say the chunk will not shrink. Blind to repetition at
+    // distances longer than a slice (e.g. a random block repeated), which
+    // only LZ would find; small chunks are always worth a try.
+    static bool looks_incompressible(const uint8_t* data, size_t len) {
+        if (len < COMPRESS_SAMPLE_BYTES) return false;
+        return sample_entropy(data, len) > COMPRESS_ENTROPY_MAX;
+    }
+
+private:
+    static constexpr size_t SLICES = 8;
+    static constexpr size_t SLICE  = COMPRESS_SAMPLE_BYTES / SLICES;
+};
+
+} // namespace ecpb
@@ -2,38 +2,88 @@
 
 #include "common/types.h"
 #include "common/logger.h"
+#include "datastructures/buffer_pool.h"
 #include <lz4.h>
+#include <lz4hc.h>
 #include <zstd.h>
+#include <zdict.h>
 #include <vector>
+#include <memory>
+#include <algorithm>
 #include <cstring>
 
 namespace ecpb {
 
+// ─── Trained zstd dictionary ─────────────────────────────────────────
+// Raw dictionary content plus its digested forms, built once and shared by
+// every thread that compresses or restores with it. `id` is the row in the
+// dictionaries table; `zstd_id` is the id written into each frame header.
+class ZstdDict {
+public:
+    ZstdDict(int id, std::vector<uint8_t> content)
+        : id_(id), content_(std::move(content)),
+          zstd_id_(ZSTD_getDictID_fromDict(content_.data(), content_.size())),
+          cdict_(ZSTD_createCDict(content_.data(), content_.size(), ZSTD_LEVEL), &ZSTD_freeCDict),
+          ddict_(ZSTD_createDDict(content_.data(), content_.size()), &ZSTD_freeDDict) {}
+
+    ZstdDict(const ZstdDict&) = delete;
+    ZstdDict& operator=(const ZstdDict&) = delete;
+
+    bool valid() const { return cdict_ && ddict_ && zstd_id_ != 0; }
+    int id() const { return id_; }
+    uint32_t zstd_id() const { return zstd_id_; }
+    const std::vector<uint8_t>& content() const { return content_; }
+    const ZSTD_CDict* cdict() const { return cdict_.get(); }
+    const ZSTD_DDict* ddict() const { return ddict_.get(); }
+
+    // zstd id of raw dictionary content (0 if it is not a zstd dictionary)
+    static uint32_t content_id(const std::vector<uint8_t>& content) {
+        return ZSTD_getDictID_fromDict(content.data(), content.size());
+    }
+
+    static constexpr int ZSTD_LEVEL = 3;
+
+private:
+    int id_;
+    std::vector<uint8_t> content_;
+    uint32_t zstd_id_;
+    std::unique_ptr<ZSTD_CDict, decltype(&ZSTD_freeCDict)> cdict_;
+    std::unique_ptr<ZSTD_DDict, decltype(&ZSTD_freeDDict)> ddict_;
+};
+
 class Compressor {
 public:
     // Compress data using specified algorithm
     static std::vector<uint8_t> compress(const uint8_t* data, size_t len, CompressionType type) {
-        switch (type) {
-            case CompressionType::NONE: return std::vector<uint8_t>(data, data + len);
-            case CompressionType::LZ4:  return compress_lz4(data, len);
-            case CompressionType::ZSTD: return compress_zstd(data, len);
-        }
-        return std::vector<uint8_t>(data, data + len);
+        std::vector<uint8_t> output(bound(len, type));
+        size_t n = compress_raw(data, len, type, nullptr, output.data(), output.size());
+        if (n == FAILED) return {};
+        output.resize(n);
+        return output;
     }
 
     static std::vector<uint8_t> compress(const std::vector<uint8_t>& data, CompressionType type) {
         return compress(data.data(), data.size(), type);
     }
 
+    // ZSTD with a trained dictionary; the frame records the dictionary's
+    // zstd id. Empty on failure.
+    static std::vector<uint8_t> compress(const uint8_t* data, size_t len, const ZstdDict& dict) {
+        std::vector<uint8_t> output(bound(len, CompressionType::ZSTD));
+        size_t n = compress_raw(data, len, CompressionType::ZSTD, &dict, output.data(), output.size());
+        if (n == FAILED) return {};
+        output.resize(n);
+        return output;
+    }
+
     // Decompress data. original_size must be known.
     static std::vector<uint8_t> decompress(const uint8_t* data, size_t len,
                                            size_t original_size, CompressionType type) {
-        switch (type) {
-            case CompressionType::NONE: return std::vector<uint8_t>(data, data + len);
-            case CompressionType::LZ4:  return decompress_lz4(data, len, original_size);
-            case CompressionType::ZSTD: return decompress_zstd(data, len, original_size);
-        }
-        return std::vector<uint8_t>(data, data + len);
+        std::vector<uint8_t> output(original_size);
+        size_t n = decompress_raw(data, len, type, nullptr, output.data(), original_size);
+        if (n == FAILED) return {};
+        output.resize(n);
+        return output;
     }
 
     static std::vector<uint8_t> decompress(const std::vector<uint8_t>& data,
@@ -41,68 +91,222 @@ public:
         return decompress(data.data(), data.size(), original_size, type);
     }
 
-private:
-    static std::vector<uint8_t> compress_lz4(const uint8_t* data, size_t len) {
-        int max_dst = LZ4_compressBound(static_cast<int>(len));
-        std::vector<uint8_t> output(max_dst);
-        int compressed_size = LZ4_compress_default(
-            reinterpret_cast<const char*>(data),
-            reinterpret_cast<char*>(output.data()),
-            static_cast<int>(len),
-            max_dst
-        );
-        if (compressed_size <= 0) {
-            LOG_ERR("LZ4 compression failed");
-            return {};
-        }
-        output.resize(compressed_size);
+    static std::vector<uint8_t> decompress(const uint8_t* data, size_t len, size_t original_size,
+                                           const ZstdDict& dict) {
+        std::vector<uint8_t> output(original_size);
+        size_t n = decompress_raw(data, len, CompressionType::ZSTD, &dict, output.data(), original_size);
+        if (n == FAILED) return {};
+        output.resize(n);
         return output;
     }
 
-    static std::vector<uint8_t> decompress_lz4(const uint8_t* data, size_t len, size_t original_size) {
-        std::vector<uint8_t> output(original_size);
-        int result = LZ4_decompress_safe(
-            reinterpret_cast<const char*>(data),
-            reinterpret_cast<char*>(output.data()),
-            static_cast<int>(len),
-            static_cast<int>(original_size)
-        );
-        if (result < 0) {
-            LOG_ERR("LZ4 decompression failed");
+    // Room compress_into may need for `len` bytes, whichever codec
+    static size_t max_bound(size_t len) {
+        return std::max(bound(len, CompressionType::LZ4), bound(len, CompressionType::ZSTD));
+    }
+
+    // Into-buffer forms for the chunk path: `out` is resized to the result
+    // and keeps its capacity, so a buffer reused across chunks does not
+    // allocate; codec state is per thread. `dict` applies to ZSTD only and
+    // fixes the level; `level` 0 is the codec's default (LZ4HC 9, ZSTD 3).
+    static bool compress_into(const uint8_t* data, size_t len, CompressionType type, ByteBuffer& out,
+                              const ZstdDict* dict = nullptr, int level = 0) {
+        out.resize(bound(len, type));
+        size_t n = compress_raw(data, len, type, dict, out.data(), out.size(), level);
+        out.resize(n == FAILED ? 0 : n);
+        return n != FAILED;
+    }
+
+    static bool decompress_into(const uint8_t* data, size_t len, size_t original_size, CompressionType type,
+                                ByteBuffer& out, const ZstdDict* dict = nullptr) {
+        out.resize(original_size);
+        size_t n = decompress_raw(data, len, type, dict, out.data(), original_size);
+        out.resize(n == FAILED ? 0 : n);
+        return n != FAILED;
+    }
+
+    // Dictionary a ZSTD frame was compressed with (0 = none)
+    static uint32_t frame_dict_id(const uint8_t* data, size_t len) {
+        return ZSTD_getDictID_fromFrame(data, len);
+    }
+
+    // Train a dictionary of at most `capacity` bytes from samples laid end
+    // to end in `samples`. Empty if zstd finds too little to work with.
+    static std::vector<uint8_t> train_dictionary(const std::vector<uint8_t>& samples,
+                                                 const std::vector<size_t>& sizes, size_t capacity) {
+        std::vector<uint8_t> dict(capacity);
+        size_t rc = ZDICT_trainFromBuffer(dict.data(), capacity, samples.data(), sizes.data(),
+                                          static_cast<unsigned>(sizes.size()));
+        if (ZDICT_isError(rc)) {
+            LOG_DEBUG("ZSTD dictionary training failed: %s", ZDICT_getErrorName(rc));
             return {};
         }
-        output.resize(result);
-        return output;
+        dict.resize(rc);
+        return dict;
     }
 
-    static std::vector<uint8_t> compress_zstd(const uint8_t* data, size_t len) {
-        size_t max_dst = ZSTD_compressBound(len);
-        std::vector<uint8_t> output(max_dst);
-        size_t compressed_size = ZSTD_compress(
-            output.data(), max_dst,
-            data, len,
-            3  // compression level
-        );
-        if (ZSTD_isError(compressed_size)) {
-            LOG_ERR("ZSTD compression failed: %s", ZSTD_getErrorName(compressed_size));
-            return {};
+    // Delta against a similar base chunk: a zstd frame with the base as a
+    // raw-content prefix, so spans copied from the base cost a few bytes.
+    // Independent of the chunk's CompressionType. False on failure.
+    static bool delta_encode_into(const uint8_t* base, size_t base_len, const uint8_t* data, size_t len,
+                                  ByteBuffer& out) {
+        ZSTD_CCtx* cctx = thread_cctx();
+        out.resize(ZSTD_compressBound(len));
+        size_t rc = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, ZSTD_LEVEL);
+        if (!ZSTD_isError(rc)) rc = ZSTD_CCtx_refPrefix(cctx, base, base_len);
+        if (!ZSTD_isError(rc)) rc = ZSTD_compress2(cctx, out.data(), out.size(), data, len);
+        if (ZSTD_isError(rc)) {
+            LOG_ERR("ZSTD delta encoding failed: %s", ZSTD_getErrorName(rc));
+            out.clear();
+            return false;
         }
-        output.resize(compressed_size);
-        return output;
+        out.resize(rc);
+        return true;
     }
 
-    static std::vector<uint8_t> decompress_zstd(const uint8_t* data, size_t len, size_t original_size) {
-        std::vector<uint8_t> output(original_size);
-        size_t result = ZSTD_decompress(
-            output.data(), original_size,
-            data, len
-        );
-        if (ZSTD_isError(result)) {
-            LOG_ERR("ZSTD decompression failed: %s", ZSTD_getErrorName(result));
-            return {};
+    static bool delta_decode_into(const uint8_t* base, size_t base_len, const uint8_t* delta, size_t delta_len,
+                                  size_t original_size, ByteBuffer& out) {
+        ZSTD_DCtx* dctx = thread_dctx();
+        out.resize(original_size);
+        // A prefix on a DCtx is digested into a new DDict on every call;
+        // usingDict takes the same raw content by reference, except for a
+        // base that starts like a structured dictionary
+        size_t rc;
+        if (is_dictionary(base, base_len)) {
+            rc = ZSTD_DCtx_refPrefix(dctx, base, base_len);
+            if (!ZSTD_isError(rc)) rc = ZSTD_decompressDCtx(dctx, out.data(), original_size, delta, delta_len);
+        } else {
+            rc = ZSTD_decompress_usingDict(dctx, out.data(), original_size, delta, delta_len, base, base_len);
         }
-        output.resize(result);
-        return output;
+        if (ZSTD_isError(rc)) {
+            LOG_ERR("ZSTD delta decoding failed: %s", ZSTD_getErrorName(rc));
+            out.clear();
+            return false;
+        }
+        out.resize(rc);
+        return true;
+    }
+
+private:
+    static constexpr size_t FAILED = SIZE_MAX;
+    static constexpr int ZSTD_LEVEL = ZstdDict::ZSTD_LEVEL;
+
+    static size_t bound(size_t len, CompressionType type) {
+        switch (type) {
+            case CompressionType::NONE: return len;
+            case CompressionType::LZ4:
+            case CompressionType::LZ4HC: return static_cast<size_t>(LZ4_compressBound(static_cast<int>(len)));
+            case CompressionType::ZSTD: return ZSTD_compressBound(len);
+            case CompressionType::ADAPTIVE: break;
+        }
+        return len;
+    }
+
+    static bool is_dictionary(const uint8_t* p, size_t len) {
+        uint32_t magic = 0;
+        if (len >= 8) std::memcpy(&magic, p, sizeof(magic));
+        return magic == ZSTD_MAGIC_DICTIONARY;
+    }
+
+    // Compressed size written to dst, or FAILED
+    static size_t compress_raw(const uint8_t* data, size_t len, CompressionType type, const ZstdDict* dict,
+                               uint8_t* dst, size_t cap, int level = 0) {
+        switch (type) {
+            case CompressionType::NONE:
+                if (len) std::memcpy(dst, data, len);
+                return len;
+            case CompressionType::LZ4: {
+                int n = LZ4_compress_fast_extState(lz4_state(), reinterpret_cast<const char*>(data),
+                                                   reinterpret_cast<char*>(dst), static_cast<int>(len),
+                                                   static_cast<int>(cap), 1);
+                if (n <= 0) {
+                    LOG_ERR("LZ4 compression failed");
+                    return FAILED;
+                }
+                return static_cast<size_t>(n);
+            }
+            case CompressionType::LZ4HC: {
+                int n = LZ4_compress_HC_extStateHC(lz4hc_state(), reinterpret_cast<const char*>(data),
+                                                   reinterpret_cast<char*>(dst), static_cast<int>(len),
+                                                   static_cast<int>(cap), level ? level : LZ4HC_CLEVEL_DEFAULT);
+                if (n <= 0) {
+                    LOG_ERR("LZ4HC compression failed");
+                    return FAILED;
+                }
+                return static_cast<size_t>(n);
+            }
+            case CompressionType::ZSTD: {
+                size_t n = dict ? ZSTD_compress_usingCDict(thread_cctx(), dst, cap, data, len, dict->cdict())
+                                : ZSTD_compressCCtx(thread_cctx(), dst, cap, data, len, level ? level : ZSTD_LEVEL);
+                if (ZSTD_isError(n)) {
+                    LOG_ERR("ZSTD compression failed: %s", ZSTD_getErrorName(n));
+                    return FAILED;
+                }
+                return n;
+            }
+            case CompressionType::ADAPTIVE:
+                break;
+        }
+        return FAILED;
+    }
+
+    // Decompressed size written to dst (capacity original_size), or FAILED
+    static size_t decompress_raw(const uint8_t* data, size_t len, CompressionType type, const ZstdDict* dict,
+                                 uint8_t* dst, size_t original_size) {
+        switch (type) {
+            case CompressionType::NONE:
+                if (len > original_size) return FAILED;
+                if (len) std::memcpy(dst, data, len);
+                return len;
+            case CompressionType::LZ4:
+            case CompressionType::LZ4HC: {
+                int n = LZ4_decompress_safe(reinterpret_cast<const char*>(data), reinterpret_cast<char*>(dst),
+                                            static_cast<int>(len), static_cast<int>(original_size));
+                if (n < 0) {
+                    LOG_ERR("LZ4 decompression failed");
+                    return FAILED;
+                }
+                return static_cast<size_t>(n);
+            }
+            case CompressionType::ZSTD: {
+                size_t n = dict ? ZSTD_decompress_usingDDict(thread_dctx(), dst, original_size, data, len, dict->ddict())
+                                : ZSTD_decompressDCtx(thread_dctx(), dst, original_size, data, len);
+                if (ZSTD_isError(n)) {
+                    LOG_ERR("ZSTD decompression failed: %s", ZSTD_getErrorName(n));
+                    return FAILED;
+                }
+                return n;
+            }
+            case CompressionType::ADAPTIVE:
+                break;
+        }
+        return FAILED;
+    }
+
+    // One context per thread, reused for every frame. A prefix only applies
+    // to the next frame and a dictionary is passed with each call, so
+    // nothing carries over between chunks.
+    static ZSTD_CCtx* thread_cctx() {
+        thread_local std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> ctx(ZSTD_createCCtx(), &ZSTD_freeCCtx);
+        return ctx.get();
+    }
+
+    static ZSTD_DCtx* thread_dctx() {
+        thread_local std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> ctx(ZSTD_createDCtx(), &ZSTD_freeDCtx);
+        return ctx.get();
+    }
+
+    // LZ4 hash tables, kept off the stack and reused
+    static void* lz4_state() {
+        thread_local std::unique_ptr<uint64_t[]> state(
+            new uint64_t[(static_cast<size_t>(LZ4_sizeofState()) + 7) / 8]);
+        return state.get();
+    }
+
+    static void* lz4hc_state() {
+        thread_local std::unique_ptr<uint64_t[]> state(
+            new uint64_t[(static_cast<size_t>(LZ4_sizeofStateHC()) + 7) / 8]);
+        return state.get();
     }
 };
 
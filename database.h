@@ -2,6 +2,7 @@
 
 #include "common/types.h"
 #include "common/logger.h"
+#include "storage/chunk_list.h"
 #include <sqlite3.h>
 #include <string>
 #include <vector>
@@ -12,27 +13,12 @@
 #include <cstring>
 #include <sstream>
 #include <memory>
+#include <unordered_map>
+#include <atomic>
+#include <unistd.h>
 
 namespace ecpb {
 
-// ─── Global DB Mutex ─────────────────────────────────────────────────
-// All modules share this recursive mutex when performing DB operations
-// to prevent SQLITE_BUSY errors from concurrent access within the same
-// process. Recursive so nested DB calls (e.g. store_file_manifest
-// calling chunk_exists internally) won't deadlock.
-inline std::recursive_mutex& db_global_mutex() {
-    static std::recursive_mutex mtx;
-    return mtx;
-}
-
-// RAII lock guard for database operations
-class DBLock {
-public:
-    DBLock() : lock_(db_global_mutex()) {}
-private:
-    std::lock_guard<std::recursive_mutex> lock_;
-};
-
 // ─── RAII Transaction wrapper ────────────────────────────────────────
 // Uses BEGIN IMMEDIATE to acquire a write lock immediately, preventing
 // SQLITE_BUSY when multiple modules try to write concurrently.
@@ -89,7 +75,10 @@ public:
     ~Statement() { finalize(); }
     Statement(const Statement&) = delete;
     Statement& operator=(const Statement&) = delete;
-    Statement(Statement&& o) noexcept : stmt_(o.stmt_) { o.stmt_ = nullptr; }
+    Statement(Statement&& o) noexcept : stmt_(o.stmt_), in_use_(o.in_use_) {
+        o.stmt_ = nullptr;
+        o.in_use_ = nullptr;
+    }
 
     bool prepare(sqlite3* db, const char* sql) {
         finalize();
@@ -97,8 +86,26 @@ public:
         return rc == SQLITE_OK;
     }
 
+    // Use a statement owned by a StatementCache; finalize() resets it and
+    // hands it back instead of freeing it
+    void borrow(sqlite3_stmt* stmt, bool* in_use) {
+        finalize();
+        stmt_ = stmt;
+        in_use_ = in_use;
+        *in_use_ = true;
+    }
+
     void finalize() {
-        if (stmt_) { sqlite3_finalize(stmt_); stmt_ = nullptr; }
+        if (!stmt_) return;
+        if (in_use_) {
+            sqlite3_reset(stmt_);
+            sqlite3_clear_bindings(stmt_);
+            *in_use_ = false;
+            in_use_ = nullptr;
+        } else {
+            sqlite3_finalize(stmt_);
+        }
+        stmt_ = nullptr;
     }
 
     bool bind_text(int idx, const std::string& val) {
@@ -113,6 +120,9 @@ public:
     bool bind_blob(int idx, const void* data, int len) {
         return sqlite3_bind_blob(stmt_, idx, data, len, SQLITE_TRANSIENT) == SQLITE_OK;
     }
+    bool bind_digest(int idx, const HashDigest& d) {
+        return sqlite3_bind_blob(stmt_, idx, d.data(), static_cast<int>(d.size()), SQLITE_TRANSIENT) == SQLITE_OK;
+    }
 
     // Step with automatic SQLITE_BUSY retry
     int step_retry(int max_retries = SQLITE_MAX_RETRIES) {
@@ -137,14 +147,99 @@ public:
     int64_t column_int64(int col) { return sqlite3_column_int64(stmt_, col); }
     const void* column_blob(int col) { return sqlite3_column_blob(stmt_, col); }
     int column_bytes(int col) { return sqlite3_column_bytes(stmt_, col); }
+    // False (and `out` untouched) unless the column is a 32-byte blob
+    bool column_digest(int col, HashDigest& out) {
+        const void* p = sqlite3_column_blob(stmt_, col);
+        if (!p || sqlite3_column_bytes(stmt_, col) != static_cast<int>(SHA256_BIN_LEN)) return false;
+        std::memcpy(out.data(), p, SHA256_BIN_LEN);
+        return true;
+    }
 
     sqlite3_stmt* raw() { return stmt_; }
 
 private:
     sqlite3_stmt* stmt_;
+    bool* in_use_ = nullptr;   // borrowed from a StatementCache
+};
+
+// ─── Statement Cache ─────────────────────────────────────────────────
+// Prepared statements of one connection, keyed by the address of their
+// SQL literal: prepared once, then reset and rebound on every call. A
+// statement already handed out (a nested call running the same SQL) is
+// prepared again for that call and not cached.
+//
+// Statements belong to the connection, and so to the process that opened
+// it. A forked child opens its own Database, whose cache starts empty; if
+// a child does reach the copy of its parent's cache, the copy is dropped
+// without finalizing (that would act on the parent's connection) and
+// statements are prepared per call.
+class StatementCache {
+public:
+    StatementCache() = default;
+    ~StatementCache() { clear(); }
+    StatementCache(const StatementCache&) = delete;
+    StatementCache& operator=(const StatementCache&) = delete;
+
+    bool acquire(sqlite3* db, const char* sql, Statement& stmt) {
+        stmt.finalize();
+        pid_t pid = getpid();
+        if (owner_ != pid) {
+            if (owner_ && !entries_.empty()) {
+                LOG_WARN("StatementCache: used after fork(); preparing per call");
+                entries_.clear();
+                forked_ = true;
+            }
+            owner_ = pid;
+        }
+        if (forked_) return stmt.prepare(db, sql);
+
+        auto it = entries_.find(sql);
+        if (it == entries_.end()) {
+            sqlite3_stmt* raw = nullptr;
+            if (sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &raw, nullptr) != SQLITE_OK) {
+                if (raw) sqlite3_finalize(raw);
+                return false;
+            }
+            it = entries_.emplace(sql, Entry{raw, false}).first;
+        } else if (it->second.in_use) {
+            return stmt.prepare(db, sql);
+        }
+        stmt.borrow(it->second.stmt, &it->second.in_use);
+        return true;
+    }
+
+    // Finalize every statement; before the connection closes
+    void clear() {
+        if (owner_ == getpid()) {
+            for (auto& e : entries_) sqlite3_finalize(e.second.stmt);
+        }
+        entries_.clear();
+        forked_ = false;
+        owner_ = 0;
+    }
+
+    size_t size() const { return entries_.size(); }
+
+private:
+    struct Entry {
+        sqlite3_stmt* stmt;
+        bool          in_use;
+    };
+    std::unordered_map<const char*, Entry> entries_;
+    pid_t owner_ = 0;       // process that prepared the entries
+    bool  forked_ = false;
 };
 
 // ─── Database ────────────────────────────────────────────────────────
+// One writer connection and a pool of reader connections to the same
+// file. Writes, and reads made by a thread while it holds the writer (so
+// they see its uncommitted rows), go through the writer one at a time.
+// Other reads go through the calling thread's reader: threads are spread
+// over the pool by a per-thread slot, and readers run in parallel with
+// each other and with the writer (WAL mode; each read sees the last
+// commit). Readers are opened on first use. Locks are per Database, so
+// nested calls on one thread do not deadlock and separate Databases do
+// not serialize each other.
 class Database {
 public:
     Database() : db_(nullptr) {}
@@ -153,7 +248,7 @@ public:
     Database& operator=(const Database&) = delete;
 
     bool open(const std::string& path) {
-        DBLock lock;
+        WriteLock lock(*this);
         if (db_) close();
         db_path_ = path;
         int rc = sqlite3_open(path.c_str(), &db_);
@@ -177,8 +272,10 @@ public:
     }
 
     void close() {
-        DBLock lock;
+        WriteLock lock(*this);
+        close_readers();
         if (db_) {
+            stmts_.clear();
             sqlite3_close(db_);
             db_ = nullptr;
             LOG_INFO("Database closed");
@@ -189,9 +286,9 @@ public:
 
     // ─── Job Operations ──────────────────────────────────────────
     int create_job(const BackupJob& job) {
-        DBLock lock;
+        WriteLock lock(*this);
         Statement stmt;
-        if (!stmt.prepare(db_,
+        if (!prepare(stmt,
             "INSERT INTO jobs (source_path, backup_name, status, priority, compression, "
             "encrypt, incremental, parent_job_id, created_at) "
             "VALUES (?,?,?,?,?,?,?,?,?)")) {
@@ -217,8 +314,8 @@ public:
     }
 
     bool update_job_status(int job_id, JobStatus status, const std::string& error = "") {
-        DBLock lock;
-        std::string sql;
+        WriteLock lock(*this);
+        const char* sql;
         if (status == JobStatus::RUNNING) {
             sql = "UPDATE jobs SET status=?, started_at=? WHERE job_id=?";
         } else if (status == JobStatus::COMPLETED || status == JobStatus::FAILED) {
@@ -228,7 +325,7 @@ public:
         }
 
         Statement stmt;
-        if (!stmt.prepare(db_, sql.c_str())) return false;
+        if (!prepare(stmt, sql)) return false;
 
         stmt.bind_int(1, static_cast<int>(status));
         if (status == JobStatus::RUNNING) {
@@ -246,9 +343,9 @@ public:
 
     bool update_job_stats(int job_id, uint64_t total_bytes, uint64_t processed_bytes,
                           uint64_t stored_bytes, uint64_t dedup_savings, int file_count) {
-        DBLock lock;
+        WriteLock lock(*this);
         Statement stmt;
-        if (!stmt.prepare(db_,
+        if (!prepare(stmt,
             "UPDATE jobs SET total_bytes=?, processed_bytes=?, stored_bytes=?, "
             "dedup_savings=?, file_count=? WHERE job_id=?")) return false;
         stmt.bind_int64(1, static_cast<int64_t>(total_bytes));
@@ -260,20 +357,34 @@ public:
         return stmt.step() == SQLITE_DONE;
     }
 
+    bool update_job_compression(int job_id, const CompressStats& cs) {
+        WriteLock lock(*this);
+        Statement stmt;
+        if (!prepare(stmt,
+            "UPDATE jobs SET compress_chunks=?, compress_skipped=?, compress_raw=?, "
+            "compress_saved_ns=? WHERE job_id=?")) return false;
+        stmt.bind_int64(1, static_cast<int64_t>(cs.chunks));
+        stmt.bind_int64(2, static_cast<int64_t>(cs.skipped));
+        stmt.bind_int64(3, static_cast<int64_t>(cs.stored_raw));
+        stmt.bind_int64(4, static_cast<int64_t>(cs.saved_ns()));
+        stmt.bind_int(5, job_id);
+        return stmt.step() == SQLITE_DONE;
+    }
+
     std::optional<BackupJob> get_job(int job_id) {
-        DBLock lock;
+        ReadLock conn(*this);
         Statement stmt;
-        if (!stmt.prepare(db_, "SELECT * FROM jobs WHERE job_id=?")) return std::nullopt;
+        if (!prepare(conn, stmt, "SELECT * FROM jobs WHERE job_id=?")) return std::nullopt;
         stmt.bind_int(1, job_id);
         if (stmt.step() != SQLITE_ROW) return std::nullopt;
         return row_to_job(stmt);
     }
 
     std::vector<BackupJob> get_all_jobs() {
-        DBLock lock;
+        ReadLock conn(*this);
         std::vector<BackupJob> jobs;
         Statement stmt;
-        if (!stmt.prepare(db_, "SELECT * FROM jobs ORDER BY created_at DESC")) return jobs;
+        if (!prepare(conn, stmt, "SELECT * FROM jobs ORDER BY created_at DESC")) return jobs;
         while (stmt.step() == SQLITE_ROW) {
             jobs.push_back(row_to_job(stmt));
         }
@@ -281,10 +392,10 @@ public:
     }
 
     std::vector<BackupJob> get_jobs_by_status(JobStatus status) {
-        DBLock lock;
+        ReadLock conn(*this);
         std::vector<BackupJob> jobs;
         Statement stmt;
-        if (!stmt.prepare(db_, "SELECT * FROM jobs WHERE status=? ORDER BY priority DESC, created_at ASC")) return jobs;
+        if (!prepare(conn, stmt, "SELECT * FROM jobs WHERE status=? ORDER BY priority DESC, created_at ASC")) return jobs;
         stmt.bind_int(1, static_cast<int>(status));
         while (stmt.step() == SQLITE_ROW) {
             jobs.push_back(row_to_job(stmt));
@@ -293,164 +404,473 @@ public:
     }
 
     // ─── Chunk Operations ────────────────────────────────────────
-    bool store_chunk(const std::string& hash_hex, const std::string& storage_path,
-                     uint32_t original_size, uint32_t stored_size,
-                     int compression, bool encrypted, int ref_count = 1) {
-        DBLock lock;
+    struct ChunkMeta {
+        HashDigest hash;
+        ChunkLocation location;
+        uint32_t original_size;
+        uint32_t stored_size;
+        int compression;
+        bool encrypted;
+        int ref_count;
+        std::optional<HashDigest> delta_base;  // stored as a delta against this chunk
+        int delta_depth = 0;
+        int dict_id = 0;                       // zstd dictionary (0 = none)
+        int codec_level = 0;                   // level of `compression` (0 = default)
+    };
+
+    // `delta_base` set: the payload is a delta against that chunk, which
+    // sits `delta_depth` - 1 deltas above a full chunk. `dict_id` names the
+    // zstd dictionary the payload was compressed with (0 = none);
+    // `codec_level` the level `compression` ran at (0 = its default).
+    bool store_chunk(const HashDigest& hash, const ChunkLocation& loc,
+                     uint32_t original_size,
+                     int compression, bool encrypted,
+                     const HashDigest* delta_base = nullptr, int delta_depth = 0,
+                     int dict_id = 0, int codec_level = 0, int ref_count = 1) {
+        ChunkMeta row;
+        row.hash = hash;
+        row.location = loc;
+        row.original_size = original_size;
+        row.stored_size = loc.length;
+        row.compression = compression;
+        row.encrypted = encrypted;
+        row.ref_count = ref_count;
+        if (delta_base) row.delta_base = *delta_base;
+        row.delta_depth = delta_base ? delta_depth : 0;
+        row.dict_id = dict_id;
+        row.codec_level = codec_level;
+
+        WriteLock lock(*this);
         Transaction txn(db_);
         if (!txn.is_active()) return false;
+        return insert_chunk(row) && txn.commit();
+    }
 
+    bool chunk_exists(const HashDigest& hash) {
+        ReadLock conn(*this);
         Statement stmt;
-        if (!stmt.prepare(db_,
-            "INSERT OR IGNORE INTO chunks (hash, storage_path, original_size, "
-            "stored_size, compression, encrypted, ref_count) "
-            "VALUES (?,?,?,?,?,?,?)")) return false;
-        stmt.bind_text(1, hash_hex);
-        stmt.bind_text(2, storage_path);
-        stmt.bind_int(3, static_cast<int>(original_size));
-        stmt.bind_int(4, static_cast<int>(stored_size));
-        stmt.bind_int(5, compression);
-        stmt.bind_int(6, encrypted ? 1 : 0);
-        stmt.bind_int(7, ref_count);
-        int rc = stmt.step();
-        if (rc == SQLITE_DONE) {
-            // If already existed (IGNORE), increment ref_count
-            if (sqlite3_changes(db_) == 0) {
-                if (!increment_chunk_ref(hash_hex)) return false;
-            }
-            return txn.commit();
-        }
-        return false;
+        if (!prepare(conn, stmt, "SELECT 1 FROM chunks WHERE hash=?")) return false;
+        stmt.bind_digest(1, hash);
+        return stmt.step() == SQLITE_ROW;
     }
 
-    bool chunk_exists(const std::string& hash_hex) {
-        DBLock lock;
+    std::optional<ChunkLocation> get_chunk_location(const HashDigest& hash) {
+        ReadLock conn(*this);
         Statement stmt;
-        if (!stmt.prepare(db_, "SELECT 1 FROM chunks WHERE hash=?")) return false;
-        stmt.bind_text(1, hash_hex);
-        return stmt.step() == SQLITE_ROW;
+        if (!prepare(conn, stmt, "SELECT pack_id, pack_offset, stored_size FROM chunks WHERE hash=?"))
+            return std::nullopt;
+        stmt.bind_digest(1, hash);
+        if (stmt.step() != SQLITE_ROW) return std::nullopt;
+        ChunkLocation loc;
+        loc.pack_id = stmt.column_int64(0);
+        loc.offset = static_cast<uint64_t>(stmt.column_int64(1));
+        loc.length = static_cast<uint32_t>(stmt.column_int(2));
+        return loc;
     }
 
-    std::string get_chunk_path(const std::string& hash_hex) {
-        DBLock lock;
+    std::optional<ChunkMeta> get_chunk_meta(const HashDigest& hash) {
+        ReadLock conn(*this);
         Statement stmt;
-        if (!stmt.prepare(db_, "SELECT storage_path FROM chunks WHERE hash=?")) return "";
-        stmt.bind_text(1, hash_hex);
-        if (stmt.step() != SQLITE_ROW) return "";
-        return stmt.column_text(0);
+        if (!prepare(conn, stmt, "SELECT hash, pack_id, pack_offset, original_size, stored_size, "
+                                "compression, encrypted, ref_count, base_hash, delta_depth, dict_id, "
+                                "codec_level FROM chunks WHERE hash=?")) return std::nullopt;
+        stmt.bind_digest(1, hash);
+        if (stmt.step() != SQLITE_ROW) return std::nullopt;
+        ChunkMeta cm;
+        cm.hash = hash;
+        cm.location.pack_id = stmt.column_int64(1);
+        cm.location.offset = static_cast<uint64_t>(stmt.column_int64(2));
+        cm.original_size = static_cast<uint32_t>(stmt.column_int(3));
+        cm.stored_size = static_cast<uint32_t>(stmt.column_int(4));
+        cm.location.length = cm.stored_size;
+        cm.compression = stmt.column_int(5);
+        cm.encrypted = stmt.column_int(6) != 0;
+        cm.ref_count = stmt.column_int(7);
+        HashDigest base;
+        if (stmt.column_digest(8, base)) cm.delta_base = base;
+        cm.delta_depth = stmt.column_int(9);
+        cm.dict_id = stmt.column_int(10);
+        cm.codec_level = stmt.column_int(11);
+        return cm;
     }
 
-    struct ChunkMeta {
-        std::string hash;
-        std::string storage_path;
-        uint32_t original_size;
-        uint32_t stored_size;
-        int compression;
-        bool encrypted;
-        int ref_count;
+    // ─── Resemblance Index ───────────────────────────────────────
+    // Super-features of stored chunks (see Resemblance), newest chunk per
+    // feature. `key_tag` identifies the encryption key (0 = unencrypted)
+    // so a chunk is only delta-encoded against bases it can decrypt.
+    bool add_chunk_features(const HashDigest& hash, int64_t key_tag,
+                            const uint64_t* features, size_t n) {
+        WriteLock lock(*this);
+        for (size_t i = 0; i < n; ++i) {
+            if (!insert_feature({features[i], key_tag, hash})) return false;
+        }
+        return true;
+    }
+
+    // Stored chunk sharing the most super-features with `features`.
+    // `newer[i]`, if given and set, is a chunk with features[i] whose row is
+    // not written yet (see GroupCommit); it takes the place of the table's.
+    std::optional<HashDigest> find_similar_chunk(int64_t key_tag, const uint64_t* features, size_t n,
+                                                 const HashDigest* const* newer = nullptr) {
+        ReadLock conn(*this);
+        Statement stmt;
+        if (!prepare(conn, stmt,
+            "SELECT hash FROM chunk_features WHERE feature=? AND key_tag=?")) return std::nullopt;
+        std::vector<std::pair<HashDigest, int>> hits;
+        for (size_t i = 0; i < n; ++i) {
+            HashDigest h;
+            bool hit = false;
+            if (newer && newer[i]) {
+                h = *newer[i];
+                hit = true;
+            } else {
+                stmt.bind_int64(1, static_cast<int64_t>(features[i]));
+                stmt.bind_int64(2, key_tag);
+                hit = stmt.step() == SQLITE_ROW && stmt.column_digest(0, h);
+                stmt.reset();
+            }
+            if (hit) {
+                auto it = std::find_if(hits.begin(), hits.end(),
+                                       [&](const std::pair<HashDigest, int>& e) { return e.first == h; });
+                if (it != hits.end()) {
+                    ++it->second;
+                } else {
+                    hits.push_back({h, 1});
+                }
+            }
+        }
+        if (hits.empty()) return std::nullopt;
+        return std::max_element(hits.begin(), hits.end(),
+                                [](const std::pair<HashDigest, int>& a, const std::pair<HashDigest, int>& b) {
+                                    return a.second < b.second;
+                                })->first;
+    }
+
+    // ─── Compression Dictionaries ────────────────────────────────
+    // Trained zstd dictionaries, versioned per scope (a source path or a
+    // file extension). Rows are never changed or dropped: every chunk
+    // compressed with one names it in chunks.dict_id.
+    struct StoredDict {
+        int dict_id = 0;
+        std::string scope;
+        int version = 0;
+        uint32_t zstd_id = 0;
+        int job_id = -1;                 // job that trained it
+        int sample_count = 0;
+        uint64_t sample_bytes = 0;
+        std::vector<uint8_t> content;
+        uint64_t created_at = 0;
     };
 
-    std::optional<ChunkMeta> get_chunk_meta(const std::string& hash_hex) {
-        DBLock lock;
+    // Next version of `scope`; returns the new dict_id, or -1
+    int store_dictionary(const std::string& scope, uint32_t zstd_id, int job_id,
+                         int sample_count, uint64_t sample_bytes,
+                         const std::vector<uint8_t>& content) {
+        WriteLock lock(*this);
+        Statement stmt;
+        if (!prepare(stmt,
+            "INSERT INTO dictionaries (scope, version, zstd_id, job_id, sample_count, "
+            "sample_bytes, content, created_at) "
+            "SELECT ?1, COALESCE(MAX(version), 0) + 1, ?2, ?3, ?4, ?5, ?6, ?7 "
+            "FROM dictionaries WHERE scope=?1")) return -1;
+        stmt.bind_text(1, scope);
+        stmt.bind_int64(2, zstd_id);
+        stmt.bind_int(3, job_id);
+        stmt.bind_int(4, sample_count);
+        stmt.bind_int64(5, static_cast<int64_t>(sample_bytes));
+        stmt.bind_blob(6, content.data(), static_cast<int>(content.size()));
+        stmt.bind_int64(7, static_cast<int64_t>(now_epoch_ms()));
+        if (stmt.step() != SQLITE_DONE) {
+            LOG_ERR("DB: store_dictionary failed: %s", sqlite3_errmsg(db_));
+            return -1;
+        }
+        return static_cast<int>(sqlite3_last_insert_rowid(db_));
+    }
+
+    std::optional<StoredDict> get_dictionary(int dict_id) {
+        ReadLock conn(*this);
         Statement stmt;
-        if (!stmt.prepare(db_, "SELECT hash, storage_path, original_size, stored_size, "
-                                "compression, encrypted, ref_count FROM chunks WHERE hash=?")) return std::nullopt;
-        stmt.bind_text(1, hash_hex);
+        if (!prepare(conn, stmt,
+            "SELECT dict_id, scope, version, zstd_id, job_id, sample_count, sample_bytes, "
+            "content, created_at FROM dictionaries WHERE dict_id=?")) return std::nullopt;
+        stmt.bind_int(1, dict_id);
         if (stmt.step() != SQLITE_ROW) return std::nullopt;
-        ChunkMeta cm;
-        cm.hash = stmt.column_text(0);
-        cm.storage_path = stmt.column_text(1);
-        cm.original_size = static_cast<uint32_t>(stmt.column_int(2));
-        cm.stored_size = static_cast<uint32_t>(stmt.column_int(3));
-        cm.compression = stmt.column_int(4);
-        cm.encrypted = stmt.column_int(5) != 0;
-        cm.ref_count = stmt.column_int(6);
-        return cm;
+        return row_to_dict(stmt);
+    }
+
+    // Newest version for a scope
+    std::optional<StoredDict> latest_dictionary(const std::string& scope) {
+        ReadLock conn(*this);
+        Statement stmt;
+        if (!prepare(conn, stmt,
+            "SELECT dict_id, scope, version, zstd_id, job_id, sample_count, sample_bytes, "
+            "content, created_at FROM dictionaries WHERE scope=? ORDER BY version DESC LIMIT 1"))
+            return std::nullopt;
+        stmt.bind_text(1, scope);
+        if (stmt.step() != SQLITE_ROW) return std::nullopt;
+        return row_to_dict(stmt);
+    }
+
+    int64_t chunk_count() {
+        ReadLock conn(*this);
+        Statement stmt;
+        if (!prepare(conn, stmt, "SELECT COUNT(*) FROM chunks")) return -1;
+        if (stmt.step() != SQLITE_ROW) return -1;
+        return stmt.column_int64(0);
+    }
+
+    // Visit chunk rows inserted after `after_rowid` in rowid order.
+    // Returns the highest rowid visited (or after_rowid if none).
+    int64_t for_each_chunk_since(int64_t after_rowid,
+                                 const std::function<void(const HashDigest&, const ChunkLocation&)>& fn) {
+        ReadLock conn(*this);
+        Statement stmt;
+        if (!prepare(conn, stmt,
+            "SELECT rowid, hash, pack_id, pack_offset, stored_size FROM chunks "
+            "WHERE rowid > ? ORDER BY rowid")) return after_rowid;
+        stmt.bind_int64(1, after_rowid);
+        int64_t last = after_rowid;
+        while (stmt.step() == SQLITE_ROW) {
+            last = stmt.column_int64(0);
+            HashDigest hash;
+            if (!stmt.column_digest(1, hash)) continue;
+            ChunkLocation loc;
+            loc.pack_id = stmt.column_int64(2);
+            loc.offset = static_cast<uint64_t>(stmt.column_int64(3));
+            loc.length = static_cast<uint32_t>(stmt.column_int(4));
+            fn(hash, loc);
+        }
+        return last;
+    }
+
+    // ─── Pack Operations ─────────────────────────────────────────
+    // Allocates a unique pack id; safe across forked workers
+    int64_t create_pack() {
+        WriteLock lock(*this);
+        Statement stmt;
+        if (!prepare(stmt, "INSERT INTO packs (created_at) VALUES (?)")) return -1;
+        stmt.bind_int64(1, static_cast<int64_t>(now_epoch_ms()));
+        if (stmt.step() != SQLITE_DONE) {
+            LOG_ERR("DB: create_pack failed: %s", sqlite3_errmsg(db_));
+            return -1;
+        }
+        return sqlite3_last_insert_rowid(db_);
+    }
+
+    bool seal_pack(int64_t pack_id, uint64_t size, int chunk_count) {
+        WriteLock lock(*this);
+        Statement stmt;
+        if (!prepare(stmt,
+            "UPDATE packs SET size=?, chunk_count=?, sealed=1 WHERE pack_id=?")) return false;
+        stmt.bind_int64(1, static_cast<int64_t>(size));
+        stmt.bind_int(2, chunk_count);
+        stmt.bind_int64(3, pack_id);
+        return stmt.step() == SQLITE_DONE;
     }
 
     // ─── File Manifest Operations ────────────────────────────────
     bool store_file_manifest(int job_id, const FileManifest& manifest) {
-        DBLock lock;
+        WriteLock lock(*this);
+        Transaction txn(db_);
+        if (!txn.is_active()) return false;
+        return insert_manifest(job_id, manifest) && txn.commit();
+    }
+
+    // ─── Batched Writes ──────────────────────────────────────────
+    // Rows written together in one transaction (see GroupCommit)
+    struct FeatureRow {
+        uint64_t   feature;
+        int64_t    key_tag;
+        HashDigest hash;
+    };
+
+    struct WriteBatch {
+        std::vector<ChunkMeta>  chunks;     // ref_count: references to add
+        std::vector<FeatureRow> features;
+        std::vector<std::pair<int, FileManifest>> manifests;   // job id, manifest
+
+        bool empty() const { return chunks.empty() && features.empty() && manifests.empty(); }
+        void clear() {
+            chunks.clear();
+            features.clear();
+            manifests.clear();
+        }
+    };
+
+    // All rows in one transaction; nothing is written if any fails. The
+    // failure is logged here, before the rollback and while the write lock
+    // is held, as the connection's error message is lost after either.
+    bool write_batch(const WriteBatch& batch) {
+        WriteLock lock(*this);
         Transaction txn(db_);
         if (!txn.is_active()) return false;
+        auto failed = [this](const char* what) {
+            LOG_ERR("DB: writing %s rows failed: %s", what, sqlite3_errmsg(db_));
+            return false;
+        };
+        for (auto& row : batch.chunks) {
+            if (!insert_chunk(row)) return failed("chunk");
+        }
+        for (auto& row : batch.features) {
+            if (!insert_feature(row)) return failed("feature");
+        }
+        for (auto& m : batch.manifests) {
+            if (!insert_manifest(m.first, m.second)) return failed("manifest");
+        }
+        return txn.commit();
+    }
 
+    // Visit a job's manifests one at a time, each with its chunk list, in
+    // the order they were stored; `fn` returning false stops the walk.
+    // One ordered join over file_manifests and file_chunks, read row by row
+    // (both sides come from indexes in that order, so SQLite does not sort),
+    // so memory stays at one manifest whatever the job's size. A packed
+    // manifest joins no rows and brings its list in chunk_list. The
+    // thread's read connection is held until the walk ends; `fn` may call
+    // back into the Database. Returns the number of manifests visited, or
+    // -1 if the query failed or a packed list is damaged (the walk stops).
+    int64_t for_each_file_manifest(int job_id, const std::function<bool(const FileManifest&)>& fn) {
+        ReadLock conn(*this);
         Statement stmt;
-        if (!stmt.prepare(db_,
-            "INSERT INTO file_manifests (job_id, file_path, file_name, file_size, "
-            "modified_time, file_hash) VALUES (?,?,?,?,?,?)")) return false;
+        if (!prepare(conn, stmt,
+            "SELECT m.manifest_id, m.file_path, m.file_name, m.file_size, m.modified_time, m.file_hash, "
+            "m.digest_mode, m.chunk_list, c.chunk_hash, c.chunk_index, c.offset, c.size, c.deduplicated, "
+            "c.zero_run FROM file_manifests m LEFT JOIN file_chunks c ON c.manifest_id = m.manifest_id "
+            "WHERE m.job_id=? ORDER BY m.manifest_id, c.chunk_index")) return -1;
         stmt.bind_int(1, job_id);
-        stmt.bind_text(2, manifest.file_path);
-        stmt.bind_text(3, manifest.file_name);
-        stmt.bind_int64(4, static_cast<int64_t>(manifest.file_size));
-        stmt.bind_int64(5, static_cast<int64_t>(manifest.modified_time));
-        stmt.bind_text(6, manifest.file_hash.str());
-        if (stmt.step() != SQLITE_DONE) return false;
-        int manifest_id = static_cast<int>(sqlite3_last_insert_rowid(db_));
 
-        // Store chunk references in same transaction
-        Statement chunk_stmt;
-        if (!chunk_stmt.prepare(db_,
-            "INSERT INTO file_chunks (manifest_id, chunk_hash, chunk_index, offset, size, deduplicated) "
-            "VALUES (?,?,?,?,?,?)")) return false;
-        for (auto& chunk : manifest.chunks) {
-            chunk_stmt.bind_int(1, manifest_id);
-            chunk_stmt.bind_text(2, chunk.hash.str());
-            chunk_stmt.bind_int(3, static_cast<int>(chunk.chunk_index));
-            chunk_stmt.bind_int64(4, static_cast<int64_t>(chunk.offset));
-            chunk_stmt.bind_int(5, static_cast<int>(chunk.size));
-            chunk_stmt.bind_int(6, chunk.deduplicated ? 1 : 0);
-            if (chunk_stmt.step() != SQLITE_DONE) return false;
-            chunk_stmt.reset();
+        FileManifest m;
+        int64_t current = -1;
+        int64_t visited = 0;
+        int rc;
+        while ((rc = stmt.step()) == SQLITE_ROW) {
+            int64_t manifest_id = stmt.column_int64(0);
+            if (manifest_id != current) {
+                if (current >= 0) {
+                    ++visited;
+                    if (!fn(m)) return visited;
+                }
+                current = manifest_id;
+                m.file_path = stmt.column_text(1);
+                m.file_name = stmt.column_text(2);
+                m.file_size = static_cast<uint64_t>(stmt.column_int64(3));
+                m.modified_time = static_cast<uint64_t>(stmt.column_int64(4));
+                m.file_hash = HashDigest{};
+                stmt.column_digest(5, m.file_hash);
+                m.digest_mode = static_cast<FileDigestMode>(stmt.column_int(6));
+                m.chunks.clear();
+                if (sqlite3_column_type(stmt.raw(), 7) != SQLITE_NULL &&
+                    !ChunkList::decode(static_cast<const uint8_t*>(stmt.column_blob(7)),
+                                       static_cast<size_t>(stmt.column_bytes(7)), m.chunks)) {
+                    LOG_ERR("DB: chunk list of %s (manifest %lld) is damaged", m.file_path.c_str(),
+                            static_cast<long long>(manifest_id));
+                    return -1;
+                }
+            }
+            if (sqlite3_column_type(stmt.raw(), 8) == SQLITE_NULL) continue;   // packed, or no chunks
+            ChunkInfo ci;
+            stmt.column_digest(8, ci.hash);
+            ci.chunk_index = static_cast<uint32_t>(stmt.column_int(9));
+            ci.offset = static_cast<uint64_t>(stmt.column_int64(10));
+            ci.size = static_cast<uint32_t>(stmt.column_int(11));
+            ci.deduplicated = stmt.column_int(12) != 0;
+            ci.zero_run = stmt.column_int(13) != 0;
+            m.chunks.push_back(ci);
         }
-        return txn.commit();
+        if (rc != SQLITE_DONE) {
+            LOG_ERR("DB: reading manifests of job %d failed: %s", job_id, sqlite3_errmsg(conn.conn()));
+            return -1;
+        }
+        if (current >= 0) {
+            ++visited;
+            fn(m);
+        }
+        return visited;
     }
 
+    // Every manifest of a job at once; prefer for_each_file_manifest
     std::vector<FileManifest> get_file_manifests(int job_id) {
-        DBLock lock;
         std::vector<FileManifest> manifests;
-        Statement stmt;
-        if (!stmt.prepare(db_,
-            "SELECT manifest_id, file_path, file_name, file_size, modified_time, file_hash "
-            "FROM file_manifests WHERE job_id=?")) return manifests;
-        stmt.bind_int(1, job_id);
+        for_each_file_manifest(job_id, [&](const FileManifest& m) {
+            manifests.push_back(m);
+            return true;
+        });
+        return manifests;
+    }
 
-        while (stmt.step() == SQLITE_ROW) {
-            FileManifest m;
-            int manifest_id = stmt.column_int(0);
-            m.file_path = stmt.column_text(1);
-            m.file_name = stmt.column_text(2);
-            m.file_size = static_cast<uint64_t>(stmt.column_int64(3));
-            m.modified_time = static_cast<uint64_t>(stmt.column_int64(4));
-            std::string hash_str = stmt.column_text(5);
-            std::strncpy(m.file_hash.data, hash_str.c_str(), SHA256_HEX_LEN);
-
-            // Load chunks for this manifest
-            Statement cstmt;
-            if (cstmt.prepare(db_,
-                "SELECT chunk_hash, chunk_index, offset, size, deduplicated "
-                "FROM file_chunks WHERE manifest_id=? ORDER BY chunk_index")) {
-                cstmt.bind_int(1, manifest_id);
-                while (cstmt.step() == SQLITE_ROW) {
+    // How manifests written from now on store their chunk list. Both
+    // formats are always read.
+    void set_chunk_list_format(ChunkListFormat f) { chunk_lists_ = f; }
+    ChunkListFormat chunk_list_format() const { return chunk_lists_; }
+
+    // Migration: rewrite manifests stored a row per chunk with a packed
+    // list, `per_txn` manifests per transaction, and drop their rows.
+    // Returns the number converted, or -1 if a transaction failed (the
+    // ones before it stay converted). The file only shrinks after vacuum().
+    int64_t pack_chunk_lists(size_t per_txn = 1000) {
+        WriteLock lock(*this);
+        int64_t converted = 0;
+        std::vector<int64_t> ids;
+        std::vector<ChunkInfo> chunks;
+        for (;;) {
+            Transaction txn(db_);
+            if (!txn.is_active()) return -1;
+            ids.clear();
+            {
+                Statement stmt;
+                if (!prepare(stmt, "SELECT DISTINCT manifest_id FROM file_chunks ORDER BY manifest_id LIMIT ?"))
+                    return -1;
+                stmt.bind_int64(1, static_cast<int64_t>(per_txn ? per_txn : 1));
+                while (stmt.step() == SQLITE_ROW) ids.push_back(stmt.column_int64(0));
+            }
+            if (ids.empty()) break;
+
+            Statement load, store, drop;
+            if (!prepare(load,
+                    "SELECT chunk_hash, chunk_index, offset, size, deduplicated, zero_run "
+                    "FROM file_chunks WHERE manifest_id=? ORDER BY chunk_index") ||
+                !prepare(store, "UPDATE file_manifests SET chunk_list=? WHERE manifest_id=?") ||
+                !prepare(drop, "DELETE FROM file_chunks WHERE manifest_id=?")) return -1;
+            for (int64_t id : ids) {
+                chunks.clear();
+                load.bind_int64(1, id);
+                while (load.step() == SQLITE_ROW) {
                     ChunkInfo ci;
-                    std::string ch = cstmt.column_text(0);
-                    std::strncpy(ci.hash.data, ch.c_str(), SHA256_HEX_LEN);
-                    ci.chunk_index = static_cast<uint32_t>(cstmt.column_int(1));
-                    ci.offset = static_cast<uint64_t>(cstmt.column_int64(2));
-                    ci.size = static_cast<uint32_t>(cstmt.column_int(3));
-                    ci.deduplicated = cstmt.column_int(4) != 0;
-                    m.chunks.push_back(ci);
+                    load.column_digest(0, ci.hash);
+                    ci.chunk_index = static_cast<uint32_t>(load.column_int(1));
+                    ci.offset = static_cast<uint64_t>(load.column_int64(2));
+                    ci.size = static_cast<uint32_t>(load.column_int(3));
+                    ci.deduplicated = load.column_int(4) != 0;
+                    ci.zero_run = load.column_int(5) != 0;
+                    chunks.push_back(ci);
                 }
+                load.reset();
+                ChunkList::encode(chunks, list_buf_);
+                store.bind_blob(1, list_buf_.data(), static_cast<int>(list_buf_.size()));
+                store.bind_int64(2, id);
+                drop.bind_int64(1, id);
+                if (store.step() != SQLITE_DONE || drop.step() != SQLITE_DONE) return -1;
+                store.reset();
+                drop.reset();
             }
-            manifests.push_back(std::move(m));
+            if (!txn.commit()) return -1;
+            converted += static_cast<int64_t>(ids.size());
+            LOG_DEBUG("DB: packed chunk lists of %lld manifests", static_cast<long long>(converted));
         }
-        return manifests;
+        return converted;
+    }
+
+    // Rebuild the file so freed pages are returned to the filesystem
+    bool vacuum() {
+        WriteLock lock(*this);
+        return exec_simple("VACUUM") && exec_simple("PRAGMA wal_checkpoint(TRUNCATE)");
     }
 
     // ─── Encryption Key Storage ──────────────────────────────────
     bool store_encryption_key(int job_id, const std::string& key_hex) {
-        DBLock lock;
+        WriteLock lock(*this);
         Statement stmt;
-        if (!stmt.prepare(db_,
+        if (!prepare(stmt,
             "INSERT OR REPLACE INTO encryption_keys (job_id, key_hex) VALUES (?,?)")) return false;
         stmt.bind_int(1, job_id);
         stmt.bind_text(2, key_hex);
@@ -458,19 +878,29 @@ public:
     }
 
     std::string get_encryption_key(int job_id) {
-        DBLock lock;
+        ReadLock conn(*this);
         Statement stmt;
-        if (!stmt.prepare(db_, "SELECT key_hex FROM encryption_keys WHERE job_id=?")) return "";
+        if (!prepare(conn, stmt, "SELECT key_hex FROM encryption_keys WHERE job_id=?")) return "";
         stmt.bind_int(1, job_id);
         if (stmt.step() != SQLITE_ROW) return "";
         return stmt.column_text(0);
     }
 
+    // Every stored key, for chunks written by other jobs
+    std::vector<std::string> get_encryption_keys() {
+        ReadLock conn(*this);
+        Statement stmt;
+        std::vector<std::string> keys;
+        if (!prepare(conn, stmt, "SELECT DISTINCT key_hex FROM encryption_keys")) return keys;
+        while (stmt.step() == SQLITE_ROW) keys.push_back(stmt.column_text(0));
+        return keys;
+    }
+
     // ─── Dependency Operations ───────────────────────────────────
     bool add_dependency(int job_id, int depends_on) {
-        DBLock lock;
+        WriteLock lock(*this);
         Statement stmt;
-        if (!stmt.prepare(db_,
+        if (!prepare(stmt,
             "INSERT OR IGNORE INTO job_dependencies (job_id, depends_on) VALUES (?,?)")) return false;
         stmt.bind_int(1, job_id);
         stmt.bind_int(2, depends_on);
@@ -478,10 +908,10 @@ public:
     }
 
     std::vector<int> get_dependencies(int job_id) {
-        DBLock lock;
+        ReadLock conn(*this);
         std::vector<int> deps;
         Statement stmt;
-        if (!stmt.prepare(db_, "SELECT depends_on FROM job_dependencies WHERE job_id=?")) return deps;
+        if (!prepare(conn, stmt, "SELECT depends_on FROM job_dependencies WHERE job_id=?")) return deps;
         stmt.bind_int(1, job_id);
         while (stmt.step() == SQLITE_ROW) {
             deps.push_back(stmt.column_int(0));
@@ -491,9 +921,9 @@ public:
 
     // ─── Messaging ───────────────────────────────────────────────
     int create_channel(const std::string& name) {
-        DBLock lock;
+        WriteLock lock(*this);
         Statement stmt;
-        if (!stmt.prepare(db_,
+        if (!prepare(stmt,
             "INSERT OR IGNORE INTO channels (name, created_at) VALUES (?,?)")) return -1;
         stmt.bind_text(1, name);
         stmt.bind_int64(2, static_cast<int64_t>(now_epoch_ms()));
@@ -501,7 +931,7 @@ public:
         if (sqlite3_changes(db_) == 0) {
             // Already exists - look it up
             Statement find;
-            if (!find.prepare(db_, "SELECT channel_id FROM channels WHERE name=?")) return -1;
+            if (!prepare(find, "SELECT channel_id FROM channels WHERE name=?")) return -1;
             find.bind_text(1, name);
             if (find.step() == SQLITE_ROW) return find.column_int(0);
             return -1;
@@ -511,9 +941,9 @@ public:
 
     bool send_message(const std::string& channel, const std::string& sender,
                       const std::string& content, const std::string& msg_type = "text") {
-        DBLock lock;
+        WriteLock lock(*this);
         Statement stmt;
-        if (!stmt.prepare(db_,
+        if (!prepare(stmt,
             "INSERT INTO messages (channel_name, sender, content, msg_type, created_at) "
             "VALUES (?,?,?,?,?)")) return false;
         stmt.bind_text(1, channel);
@@ -534,10 +964,10 @@ public:
     };
 
     std::vector<Message> get_messages(const std::string& channel, int limit = 50) {
-        DBLock lock;
+        ReadLock conn(*this);
         std::vector<Message> msgs;
         Statement stmt;
-        if (!stmt.prepare(db_,
+        if (!prepare(conn, stmt,
             "SELECT msg_id, channel_name, sender, content, msg_type, created_at "
             "FROM messages WHERE channel_name=? ORDER BY created_at DESC LIMIT ?")) return msgs;
         stmt.bind_text(1, channel);
@@ -566,44 +996,230 @@ public:
         uint64_t total_stored_bytes;
         uint64_t total_dedup_savings;
         int total_files;
+        uint64_t total_file_bytes;
+        int dictionaries;
+        int dict_chunks;        // chunks compressed with a dictionary
+        struct CodecUse {
+            CompressionType compression;
+            int             level;
+            int             chunks;
+            uint64_t        stored_bytes;
+        };
+        std::vector<CodecUse> codecs;   // chunks per recorded codec and level
+
+        // "LZ4 120 (1.5 MB), ZSTD-3 40 (310 KB)"
+        std::string codec_summary() const {
+            std::string out;
+            for (auto& c : codecs) {
+                if (!out.empty()) out += ", ";
+                out += codec_str(c.compression, c.level) + " " + std::to_string(c.chunks) +
+                       " (" + format_bytes(c.stored_bytes) + ")";
+            }
+            return out;
+        }
     };
 
+    // O(1): read from catalog_stats and codec_stats, which triggers keep
+    // up to date in the transaction of every insert, update and delete
     DBStats get_stats() {
-        DBLock lock;
+        ReadLock conn(*this);
         DBStats stats{};
         Statement stmt;
 
-        if (stmt.prepare(db_, "SELECT COUNT(*) FROM jobs")) {
-            if (stmt.step() == SQLITE_ROW) stats.total_jobs = stmt.column_int(0);
-        }
-        if (stmt.prepare(db_, "SELECT COUNT(*) FROM jobs WHERE status=?")) {
-            stmt.bind_int(1, static_cast<int>(JobStatus::COMPLETED));
-            if (stmt.step() == SQLITE_ROW) stats.completed_jobs = stmt.column_int(0);
-        }
-        if (stmt.prepare(db_, "SELECT COUNT(*) FROM jobs WHERE status=?")) {
-            stmt.bind_int(1, static_cast<int>(JobStatus::FAILED));
-            if (stmt.step() == SQLITE_ROW) stats.failed_jobs = stmt.column_int(0);
+        if (prepare(conn, stmt,
+                "SELECT jobs, completed_jobs, failed_jobs, chunks, stored_bytes, dedup_savings, files, "
+                "file_bytes, dictionaries, dict_chunks FROM catalog_stats WHERE id=0") &&
+            stmt.step() == SQLITE_ROW) {
+            stats.total_jobs = stmt.column_int(0);
+            stats.completed_jobs = stmt.column_int(1);
+            stats.failed_jobs = stmt.column_int(2);
+            stats.total_chunks = stmt.column_int(3);
+            stats.total_stored_bytes = static_cast<uint64_t>(stmt.column_int64(4));
+            stats.total_dedup_savings = static_cast<uint64_t>(stmt.column_int64(5));
+            stats.total_files = stmt.column_int(6);
+            stats.total_file_bytes = static_cast<uint64_t>(stmt.column_int64(7));
+            stats.dictionaries = stmt.column_int(8);
+            stats.dict_chunks = stmt.column_int(9);
         }
-        if (stmt.prepare(db_, "SELECT COUNT(*), COALESCE(SUM(stored_size),0) FROM chunks")) {
-            if (stmt.step() == SQLITE_ROW) {
-                stats.total_chunks = stmt.column_int(0);
-                stats.total_stored_bytes = static_cast<uint64_t>(stmt.column_int64(1));
+        if (prepare(conn, stmt, "SELECT compression, codec_level, chunks, stored_bytes FROM codec_stats "
+                                "WHERE chunks > 0 ORDER BY compression, codec_level")) {
+            while (stmt.step() == SQLITE_ROW) {
+                stats.codecs.push_back({static_cast<CompressionType>(stmt.column_int(0)), stmt.column_int(1),
+                                        stmt.column_int(2), static_cast<uint64_t>(stmt.column_int64(3))});
             }
         }
-        if (stmt.prepare(db_, "SELECT COALESCE(SUM(dedup_savings),0) FROM jobs")) {
-            if (stmt.step() == SQLITE_ROW) stats.total_dedup_savings = static_cast<uint64_t>(stmt.column_int64(0));
-        }
-        if (stmt.prepare(db_, "SELECT COUNT(*) FROM file_manifests")) {
-            if (stmt.step() == SQLITE_ROW) stats.total_files = stmt.column_int(0);
-        }
         return stats;
     }
 
+    // Per-job breakdown: files and their bytes as recorded so far (kept by
+    // triggers, so a running job counts too), with the job's own totals
+    struct JobUse {
+        int         job_id;
+        std::string name;
+        JobStatus   status;
+        int         files;
+        uint64_t    file_bytes;
+        uint64_t    stored_bytes;
+        uint64_t    dedup_savings;
+    };
+
+    std::vector<JobUse> get_job_stats() {
+        ReadLock conn(*this);
+        std::vector<JobUse> jobs;
+        Statement stmt;
+        if (!prepare(conn, stmt,
+            "SELECT j.job_id, j.backup_name, j.status, COALESCE(s.files,0), COALESCE(s.file_bytes,0), "
+            "j.stored_bytes, j.dedup_savings FROM jobs j LEFT JOIN job_stats s ON s.job_id = j.job_id "
+            "ORDER BY j.job_id")) return jobs;
+        while (stmt.step() == SQLITE_ROW) {
+            jobs.push_back({stmt.column_int(0), stmt.column_text(1), static_cast<JobStatus>(stmt.column_int(2)),
+                            stmt.column_int(3), static_cast<uint64_t>(stmt.column_int64(4)),
+                            static_cast<uint64_t>(stmt.column_int64(5)),
+                            static_cast<uint64_t>(stmt.column_int64(6))});
+        }
+        return jobs;
+    }
+
+    // The writer connection
     sqlite3* raw() { return db_; }
 
+    // Off: every call prepares its statement again (benchmarks)
+    void set_statement_cache(bool on) {
+        WriteLock lock(*this);
+        cache_stmts_ = on;
+        if (on) return;
+        stmts_.clear();
+        for (size_t i = 0; i < reader_count_; ++i) {
+            std::lock_guard<std::recursive_mutex> rl(readers_[i].mtx);
+            readers_[i].stmts.clear();
+        }
+    }
+
+    // Size of the reader pool; 0 sends every read through the writer.
+    // Closes the readers open so far.
+    void set_readers(size_t n) {
+        WriteLock lock(*this);
+        close_readers();
+        readers_.reset(n ? new Reader[n] : nullptr);
+        reader_count_ = n;
+    }
+
+    size_t readers() const { return reader_count_; }
+
 private:
+    struct Reader {
+        std::recursive_mutex mtx;
+        sqlite3*       db = nullptr;
+        std::atomic<bool> failed{false};  // could not be opened; reads use the writer
+        StatementCache stmts;
+    };
+
     sqlite3* db_;
     std::string db_path_;
+    StatementCache stmts_;
+    bool cache_stmts_ = true;
+    ChunkListFormat chunk_lists_ = ChunkListFormat::PACKED;
+    std::vector<uint8_t> list_buf_;     // packed chunk list being written (writer held)
+    std::recursive_mutex write_mtx_;
+    std::atomic<std::thread::id> writer_thread_{};   // thread holding write_mtx_
+    int write_depth_ = 0;
+    std::unique_ptr<Reader[]> readers_{new Reader[DB_READERS]};
+    size_t reader_count_ = DB_READERS;
+
+    // Holds the writer connection; recursive
+    class WriteLock {
+    public:
+        explicit WriteLock(Database& db) : db_(db), lock_(db.write_mtx_) {
+            if (db_.write_depth_++ == 0) db_.writer_thread_ = std::this_thread::get_id();
+        }
+        ~WriteLock() {
+            if (--db_.write_depth_ == 0) db_.writer_thread_ = std::thread::id();
+        }
+        WriteLock(const WriteLock&) = delete;
+        WriteLock& operator=(const WriteLock&) = delete;
+    private:
+        Database& db_;
+        std::lock_guard<std::recursive_mutex> lock_;
+    };
+
+    // Holds a connection for reading: the calling thread's reader, or the
+    // writer if this thread is writing, the pool is off or the reader
+    // cannot be opened
+    class ReadLock {
+    public:
+        explicit ReadLock(Database& db) {
+            Reader* r = db.reader_slot();
+            if (r) {
+                lock_ = std::unique_lock<std::recursive_mutex>(r->mtx);
+                if (r->db || db.open_reader(*r)) {
+                    conn_ = r->db;
+                    stmts_ = &r->stmts;
+                    return;
+                }
+                lock_.unlock();
+            }
+            lock_ = std::unique_lock<std::recursive_mutex>(db.write_mtx_);
+            conn_ = db.db_;
+            stmts_ = &db.stmts_;
+        }
+        sqlite3* conn() const { return conn_; }
+        StatementCache& stmts() const { return *stmts_; }
+    private:
+        std::unique_lock<std::recursive_mutex> lock_;
+        sqlite3* conn_ = nullptr;
+        StatementCache* stmts_ = nullptr;
+    };
+
+    Reader* reader_slot() {
+        if (!reader_count_ || db_path_.empty() || db_path_ == ":memory:") return nullptr;
+        if (writer_thread_.load() == std::this_thread::get_id()) return nullptr;
+        static std::atomic<size_t> next_slot{0};
+        thread_local size_t slot = next_slot++;
+        Reader* r = &readers_[slot % reader_count_];
+        return r->failed.load(std::memory_order_relaxed) ? nullptr : r;
+    }
+
+    // With r.mtx held
+    bool open_reader(Reader& r) {
+        if (r.failed) return false;
+        if (sqlite3_open_v2(db_path_.c_str(), &r.db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX,
+                            nullptr) != SQLITE_OK) {
+            LOG_WARN("Database: reader connection failed (%s); reading through the writer",
+                     r.db ? sqlite3_errmsg(r.db) : "out of memory");
+            sqlite3_close(r.db);
+            r.db = nullptr;
+            r.failed = true;
+            return false;
+        }
+        sqlite3_busy_timeout(r.db, SQLITE_BUSY_TIMEOUT_MS);
+        sqlite3_exec(r.db, "PRAGMA query_only=1", nullptr, nullptr, nullptr);
+        sqlite3_exec(r.db, "PRAGMA cache_size=-8000", nullptr, nullptr, nullptr);
+        return true;
+    }
+
+    // With the writer held
+    void close_readers() {
+        for (size_t i = 0; i < reader_count_; ++i) {
+            Reader& r = readers_[i];
+            std::lock_guard<std::recursive_mutex> rl(r.mtx);
+            r.stmts.clear();
+            if (r.db) sqlite3_close(r.db);
+            r.db = nullptr;
+            r.failed = false;
+        }
+    }
+
+    // `sql` must be a literal (or otherwise outlive the connection): the
+    // cache is keyed by its address
+    bool prepare(Statement& stmt, const char* sql) {
+        if (!cache_stmts_) return stmt.prepare(db_, sql);
+        return stmts_.acquire(db_, sql, stmt);
+    }
+
+    bool prepare(const ReadLock& conn, Statement& stmt, const char* sql) {
+        if (!cache_stmts_) return stmt.prepare(conn.conn(), sql);
+        return conn.stmts().acquire(conn.conn(), sql, stmt);
+    }
 
     bool exec_simple(const char* sql) {
         char* errmsg = nullptr;
@@ -637,17 +1253,54 @@ private:
             "  stored_bytes INTEGER DEFAULT 0,"
             "  dedup_savings INTEGER DEFAULT 0,"
             "  file_count INTEGER DEFAULT 0,"
-            "  error_message TEXT DEFAULT ''"
+            "  error_message TEXT DEFAULT '',"
+            "  compress_chunks INTEGER DEFAULT 0,"
+            "  compress_skipped INTEGER DEFAULT 0,"
+            "  compress_raw INTEGER DEFAULT 0,"
+            "  compress_saved_ns INTEGER DEFAULT 0"
             ")",
 
             "CREATE TABLE IF NOT EXISTS chunks ("
-            "  hash TEXT PRIMARY KEY,"
-            "  storage_path TEXT NOT NULL,"
+            "  hash BLOB PRIMARY KEY,"
+            "  pack_id INTEGER DEFAULT -1,"
+            "  pack_offset INTEGER DEFAULT 0,"
             "  original_size INTEGER,"
             "  stored_size INTEGER,"
             "  compression INTEGER DEFAULT 0,"
             "  encrypted INTEGER DEFAULT 0,"
-            "  ref_count INTEGER DEFAULT 1"
+            "  ref_count INTEGER DEFAULT 1,"
+            "  base_hash BLOB DEFAULT NULL,"
+            "  delta_depth INTEGER DEFAULT 0,"
+            "  dict_id INTEGER DEFAULT 0,"
+            "  codec_level INTEGER DEFAULT 0"
+            ")",
+
+            "CREATE TABLE IF NOT EXISTS chunk_features ("
+            "  feature INTEGER NOT NULL,"
+            "  key_tag INTEGER NOT NULL,"
+            "  hash BLOB NOT NULL,"
+            "  PRIMARY KEY (feature, key_tag)"
+            ") WITHOUT ROWID",
+
+            "CREATE TABLE IF NOT EXISTS dictionaries ("
+            "  dict_id INTEGER PRIMARY KEY AUTOINCREMENT,"
+            "  scope TEXT NOT NULL,"
+            "  version INTEGER NOT NULL,"
+            "  zstd_id INTEGER NOT NULL,"
+            "  job_id INTEGER DEFAULT -1,"
+            "  sample_count INTEGER DEFAULT 0,"
+            "  sample_bytes INTEGER DEFAULT 0,"
+            "  content BLOB NOT NULL,"
+            "  created_at INTEGER,"
+            "  UNIQUE (scope, version)"
+            ")",
+
+            "CREATE TABLE IF NOT EXISTS packs ("
+            "  pack_id INTEGER PRIMARY KEY AUTOINCREMENT,"
+            "  created_at INTEGER,"
+            "  size INTEGER DEFAULT 0,"
+            "  chunk_count INTEGER DEFAULT 0,"
+            "  sealed INTEGER DEFAULT 0"
             ")",
 
             "CREATE TABLE IF NOT EXISTS file_manifests ("
@@ -657,18 +1310,21 @@ private:
             "  file_name TEXT NOT NULL,"
             "  file_size INTEGER,"
             "  modified_time INTEGER,"
-            "  file_hash TEXT,"
+            "  file_hash BLOB,"
+            "  digest_mode INTEGER DEFAULT 0,"
+            "  chunk_list BLOB DEFAULT NULL,"
             "  FOREIGN KEY (job_id) REFERENCES jobs(job_id)"
             ")",
 
             "CREATE TABLE IF NOT EXISTS file_chunks ("
             "  id INTEGER PRIMARY KEY AUTOINCREMENT,"
             "  manifest_id INTEGER NOT NULL,"
-            "  chunk_hash TEXT NOT NULL,"
+            "  chunk_hash BLOB NOT NULL,"
             "  chunk_index INTEGER,"
             "  offset INTEGER,"
             "  size INTEGER,"
             "  deduplicated INTEGER DEFAULT 0,"
+            "  zero_run INTEGER DEFAULT 0,"
             "  FOREIGN KEY (manifest_id) REFERENCES file_manifests(manifest_id)"
             ")",
 
@@ -701,10 +1357,40 @@ private:
             "  created_at INTEGER"
             ")",
 
+            // ─── Catalog statistics ───
+            // Totals kept by the triggers below, in the transaction of the
+            // change; filled from the tables once by migrate_schema (v2)
+            "CREATE TABLE IF NOT EXISTS catalog_stats ("
+            "  id INTEGER PRIMARY KEY CHECK (id = 0),"
+            "  jobs INTEGER NOT NULL DEFAULT 0,"
+            "  completed_jobs INTEGER NOT NULL DEFAULT 0,"
+            "  failed_jobs INTEGER NOT NULL DEFAULT 0,"
+            "  dedup_savings INTEGER NOT NULL DEFAULT 0,"
+            "  chunks INTEGER NOT NULL DEFAULT 0,"
+            "  stored_bytes INTEGER NOT NULL DEFAULT 0,"
+            "  dict_chunks INTEGER NOT NULL DEFAULT 0,"
+            "  files INTEGER NOT NULL DEFAULT 0,"
+            "  file_bytes INTEGER NOT NULL DEFAULT 0,"
+            "  dictionaries INTEGER NOT NULL DEFAULT 0"
+            ")",
+
+            "CREATE TABLE IF NOT EXISTS codec_stats ("
+            "  compression INTEGER NOT NULL,"
+            "  codec_level INTEGER NOT NULL,"
+            "  chunks INTEGER NOT NULL DEFAULT 0,"
+            "  stored_bytes INTEGER NOT NULL DEFAULT 0,"
+            "  PRIMARY KEY (compression, codec_level)"
+            ") WITHOUT ROWID",
+
+            "CREATE TABLE IF NOT EXISTS job_stats ("
+            "  job_id INTEGER PRIMARY KEY,"
+            "  files INTEGER NOT NULL DEFAULT 0,"
+            "  file_bytes INTEGER NOT NULL DEFAULT 0"
+            ")",
+
             "CREATE INDEX IF NOT EXISTS idx_jobs_status ON jobs(status)",
-            "CREATE INDEX IF NOT EXISTS idx_chunks_hash ON chunks(hash)",
             "CREATE INDEX IF NOT EXISTS idx_file_manifests_job ON file_manifests(job_id)",
-            "CREATE INDEX IF NOT EXISTS idx_file_chunks_manifest ON file_chunks(manifest_id)",
+            "CREATE INDEX IF NOT EXISTS idx_file_chunks_order ON file_chunks(manifest_id, chunk_index)",
             "CREATE INDEX IF NOT EXISTS idx_messages_channel ON messages(channel_name, created_at)",
         };
 
@@ -714,18 +1400,318 @@ private:
                 return false;
             }
         }
+        if (!migrate_schema()) {
+            exec_simple("ROLLBACK");
+            return false;
+        }
         exec_simple("COMMIT");
         LOG_INFO("Database tables initialized");
         return true;
     }
 
-    bool increment_chunk_ref(const std::string& hash_hex) {
+    bool has_column(const char* table, const char* column) {
+        Statement stmt;
+        std::string sql = std::string("PRAGMA table_info(") + table + ")";
+        if (!stmt.prepare(db_, sql.c_str())) return false;
+        while (stmt.step() == SQLITE_ROW) {
+            if (std::strcmp(stmt.column_text(1), column) == 0) return true;
+        }
+        return false;
+    }
+
+    bool ensure_column(const char* table, const char* column, const char* decl) {
+        if (has_column(table, column)) return true;
+        std::string sql = std::string("ALTER TABLE ") + table + " ADD COLUMN " + column + " " + decl;
+        return exec_simple(sql.c_str());
+    }
+
+    // Bring databases created by older builds up to the current schema.
+    // Runs inside create_tables' transaction.
+    bool migrate_schema() {
+        // Loose chunk files -> pack files: old rows keep pack_id = -1 and are
+        // still read from storage/chunks/ab/cd/<hash>, which is derivable
+        // from the hash, so storage_path can go.
+        if (has_column("chunks", "storage_path")) {
+            if (!ensure_column("chunks", "pack_id", "INTEGER DEFAULT -1") ||
+                !ensure_column("chunks", "pack_offset", "INTEGER DEFAULT 0") ||
+                !exec_simple("ALTER TABLE chunks DROP COLUMN storage_path")) return false;
+            LOG_INFO("Database: migrated chunks table to pack locations");
+        }
+
+        // Manifests written before tree digests existed are all STREAM
+        if (!ensure_column("file_manifests", "digest_mode", "INTEGER DEFAULT 0")) return false;
+
+        // Chunk lists are read in order straight from the index; it covers
+        // the old manifest_id-only one
+        if (!exec_simple("DROP INDEX IF EXISTS idx_file_chunks_manifest")) return false;
+
+        // Packed chunk lists: older manifests keep their file_chunks rows
+        // (pack_chunk_lists converts them)
+        if (!ensure_column("file_manifests", "chunk_list", "BLOB DEFAULT NULL")) return false;
+
+        // Zero runs (sparse ingest): rows with no chunk behind them
+        if (!ensure_column("file_chunks", "zero_run", "INTEGER DEFAULT 0")) return false;
+
+        // Compression pre-check counters (appended, so row_to_job's column
+        // positions hold for old and new tables alike)
+        if (!ensure_column("jobs", "compress_chunks", "INTEGER DEFAULT 0") ||
+            !ensure_column("jobs", "compress_skipped", "INTEGER DEFAULT 0") ||
+            !ensure_column("jobs", "compress_raw", "INTEGER DEFAULT 0") ||
+            !ensure_column("jobs", "compress_saved_ns", "INTEGER DEFAULT 0")) return false;
+
+        // Delta chunks: every older chunk is stored whole
+        if (!ensure_column("chunks", "base_hash", "BLOB DEFAULT NULL") ||
+            !ensure_column("chunks", "delta_depth", "INTEGER DEFAULT 0")) return false;
+
+        // Dictionary compression: older chunks used none
+        if (!ensure_column("chunks", "dict_id", "INTEGER DEFAULT 0")) return false;
+
+        // Per-chunk codec level: older chunks ran at the default
+        if (!ensure_column("chunks", "codec_level", "INTEGER DEFAULT 0")) return false;
+
+        // v1: hashes stored as 32-byte blobs instead of 64-char hex text.
+        // Old tables keep their TEXT declarations; TEXT affinity leaves blob
+        // values alone, so converting the values in place is enough. The
+        // extra index on the chunks primary key only duplicated it.
+        if (user_version() < 1) {
+            if (sqlite3_create_function(db_, "ecpb_unhex", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+                                        nullptr, &sql_unhex, nullptr, nullptr) != SQLITE_OK ||
+                !exec_simple("UPDATE chunks SET hash = ecpb_unhex(hash) WHERE typeof(hash)='text'") ||
+                !exec_simple("UPDATE file_chunks SET chunk_hash = ecpb_unhex(chunk_hash) "
+                             "WHERE typeof(chunk_hash)='text'") ||
+                !exec_simple("UPDATE file_manifests SET file_hash = ecpb_unhex(file_hash) "
+                             "WHERE typeof(file_hash)='text'") ||
+                !exec_simple("DROP INDEX IF EXISTS idx_chunks_hash") ||
+                !exec_simple("PRAGMA user_version=1")) return false;
+            sqlite3_create_function(db_, "ecpb_unhex", 1, SQLITE_UTF8, nullptr, nullptr, nullptr, nullptr);
+            LOG_INFO("Database: schema at version 1 (binary digests)");
+        }
+
+        // v2: catalog statistics kept by triggers. Filled from the tables
+        // once, here; new databases start from an empty row.
+        if (user_version() < 2) {
+            if (!fill_stats() || !exec_simple("PRAGMA user_version=2")) return false;
+            LOG_INFO("Database: schema at version 2 (catalog statistics)");
+        }
+
+        // The triggers come last: they name columns added above, and an
+        // old table's DROP COLUMN fails while a trigger on it names a
+        // column it does not have yet
+        return create_stats_triggers();
+    }
+
+    bool create_stats_triggers() {
+        const char* triggers[] = {
+            // Job status 2 = COMPLETED, 3 = FAILED
+            "CREATE TRIGGER IF NOT EXISTS stats_jobs_insert AFTER INSERT ON jobs BEGIN "
+            "  UPDATE catalog_stats SET jobs = jobs + 1,"
+            "    completed_jobs = completed_jobs + (NEW.status = 2), failed_jobs = failed_jobs + (NEW.status = 3),"
+            "    dedup_savings = dedup_savings + NEW.dedup_savings WHERE id = 0; "
+            "END",
+            "CREATE TRIGGER IF NOT EXISTS stats_jobs_update AFTER UPDATE OF status, dedup_savings ON jobs BEGIN "
+            "  UPDATE catalog_stats SET"
+            "    completed_jobs = completed_jobs + (NEW.status = 2) - (OLD.status = 2),"
+            "    failed_jobs = failed_jobs + (NEW.status = 3) - (OLD.status = 3),"
+            "    dedup_savings = dedup_savings + NEW.dedup_savings - OLD.dedup_savings WHERE id = 0; "
+            "END",
+            "CREATE TRIGGER IF NOT EXISTS stats_jobs_delete AFTER DELETE ON jobs BEGIN "
+            "  UPDATE catalog_stats SET jobs = jobs - 1,"
+            "    completed_jobs = completed_jobs - (OLD.status = 2), failed_jobs = failed_jobs - (OLD.status = 3),"
+            "    dedup_savings = dedup_savings - OLD.dedup_savings WHERE id = 0; "
+            "  DELETE FROM job_stats WHERE job_id = OLD.job_id; "
+            "END",
+
+            // INSERT OR IGNORE of a known chunk inserts nothing and fires
+            // nothing; ref_count updates are not watched
+            "CREATE TRIGGER IF NOT EXISTS stats_chunks_insert AFTER INSERT ON chunks BEGIN "
+            "  UPDATE catalog_stats SET chunks = chunks + 1, stored_bytes = stored_bytes + NEW.stored_size,"
+            "    dict_chunks = dict_chunks + (NEW.dict_id != 0) WHERE id = 0; "
+            "  INSERT INTO codec_stats (compression, codec_level, chunks, stored_bytes)"
+            "    VALUES (NEW.compression, NEW.codec_level, 1, NEW.stored_size)"
+            "    ON CONFLICT (compression, codec_level) DO UPDATE SET chunks = chunks + 1,"
+            "    stored_bytes = stored_bytes + excluded.stored_bytes; "
+            "END",
+            "CREATE TRIGGER IF NOT EXISTS stats_chunks_update "
+            "AFTER UPDATE OF stored_size, compression, codec_level, dict_id ON chunks BEGIN "
+            "  UPDATE catalog_stats SET stored_bytes = stored_bytes + NEW.stored_size - OLD.stored_size,"
+            "    dict_chunks = dict_chunks + (NEW.dict_id != 0) - (OLD.dict_id != 0) WHERE id = 0; "
+            "  UPDATE codec_stats SET chunks = chunks - 1, stored_bytes = stored_bytes - OLD.stored_size"
+            "    WHERE compression = OLD.compression AND codec_level = OLD.codec_level; "
+            "  INSERT INTO codec_stats (compression, codec_level, chunks, stored_bytes)"
+            "    VALUES (NEW.compression, NEW.codec_level, 1, NEW.stored_size)"
+            "    ON CONFLICT (compression, codec_level) DO UPDATE SET chunks = chunks + 1,"
+            "    stored_bytes = stored_bytes + excluded.stored_bytes; "
+            "END",
+            "CREATE TRIGGER IF NOT EXISTS stats_chunks_delete AFTER DELETE ON chunks BEGIN "
+            "  UPDATE catalog_stats SET chunks = chunks - 1, stored_bytes = stored_bytes - OLD.stored_size,"
+            "    dict_chunks = dict_chunks - (OLD.dict_id != 0) WHERE id = 0; "
+            "  UPDATE codec_stats SET chunks = chunks - 1, stored_bytes = stored_bytes - OLD.stored_size"
+            "    WHERE compression = OLD.compression AND codec_level = OLD.codec_level; "
+            "END",
+
+            "CREATE TRIGGER IF NOT EXISTS stats_manifests_insert AFTER INSERT ON file_manifests BEGIN "
+            "  UPDATE catalog_stats SET files = files + 1, file_bytes = file_bytes + NEW.file_size WHERE id = 0; "
+            "  INSERT INTO job_stats (job_id, files, file_bytes) VALUES (NEW.job_id, 1, NEW.file_size)"
+            "    ON CONFLICT (job_id) DO UPDATE SET files = files + 1,"
+            "    file_bytes = file_bytes + excluded.file_bytes; "
+            "END",
+            "CREATE TRIGGER IF NOT EXISTS stats_manifests_delete AFTER DELETE ON file_manifests BEGIN "
+            "  UPDATE catalog_stats SET files = files - 1, file_bytes = file_bytes - OLD.file_size WHERE id = 0; "
+            "  UPDATE job_stats SET files = files - 1, file_bytes = file_bytes - OLD.file_size"
+            "    WHERE job_id = OLD.job_id; "
+            "END",
+
+            "CREATE TRIGGER IF NOT EXISTS stats_dictionaries_insert AFTER INSERT ON dictionaries BEGIN "
+            "  UPDATE catalog_stats SET dictionaries = dictionaries + 1 WHERE id = 0; "
+            "END",
+            "CREATE TRIGGER IF NOT EXISTS stats_dictionaries_delete AFTER DELETE ON dictionaries BEGIN "
+            "  UPDATE catalog_stats SET dictionaries = dictionaries - 1 WHERE id = 0; "
+            "END",
+        };
+        for (auto& sql : triggers) {
+            if (!exec_simple(sql)) return false;
+        }
+        return true;
+    }
+
+    // Recompute the statistics tables with full scans (inside a transaction)
+    bool fill_stats() {
+        static_assert(static_cast<int>(JobStatus::COMPLETED) == 2 && static_cast<int>(JobStatus::FAILED) == 3,
+                      "the catalog_stats triggers count these status values");
+        return exec_simple("DELETE FROM catalog_stats") &&
+               exec_simple("DELETE FROM codec_stats") &&
+               exec_simple("DELETE FROM job_stats") &&
+               exec_simple(
+                   "INSERT INTO catalog_stats (id, jobs, completed_jobs, failed_jobs, dedup_savings, chunks, "
+                   "stored_bytes, dict_chunks, files, file_bytes, dictionaries) SELECT 0, "
+                   "(SELECT COUNT(*) FROM jobs), (SELECT COUNT(*) FROM jobs WHERE status = 2), "
+                   "(SELECT COUNT(*) FROM jobs WHERE status = 3), (SELECT COALESCE(SUM(dedup_savings),0) FROM jobs), "
+                   "(SELECT COUNT(*) FROM chunks), (SELECT COALESCE(SUM(stored_size),0) FROM chunks), "
+                   "(SELECT COUNT(*) FROM chunks WHERE dict_id != 0), (SELECT COUNT(*) FROM file_manifests), "
+                   "(SELECT COALESCE(SUM(file_size),0) FROM file_manifests), (SELECT COUNT(*) FROM dictionaries)") &&
+               exec_simple(
+                   "INSERT INTO codec_stats (compression, codec_level, chunks, stored_bytes) "
+                   "SELECT compression, codec_level, COUNT(*), COALESCE(SUM(stored_size),0) FROM chunks "
+                   "GROUP BY compression, codec_level") &&
+               exec_simple(
+                   "INSERT INTO job_stats (job_id, files, file_bytes) "
+                   "SELECT job_id, COUNT(*), COALESCE(SUM(file_size),0) FROM file_manifests GROUP BY job_id");
+    }
+
+    int user_version() {
+        Statement stmt;
+        if (!prepare(stmt, "PRAGMA user_version") || stmt.step() != SQLITE_ROW) return 0;
+        return stmt.column_int(0);
+    }
+
+    // ecpb_unhex(text): 64 hex digits -> 32-byte blob; anything else unchanged
+    static void sql_unhex(sqlite3_context* ctx, int, sqlite3_value** argv) {
+        const char* text = reinterpret_cast<const char*>(sqlite3_value_text(argv[0]));
+        HashDigest d;
+        if (text && hex_decode(text, static_cast<size_t>(sqlite3_value_bytes(argv[0])), d)) {
+            sqlite3_result_blob(ctx, d.data(), static_cast<int>(d.size()), SQLITE_TRANSIENT);
+        } else {
+            sqlite3_result_value(ctx, argv[0]);
+        }
+    }
+
+    bool add_chunk_refs(const HashDigest& hash, int refs) {
+        Statement stmt;
+        if (!prepare(stmt, "UPDATE chunks SET ref_count = ref_count + ? WHERE hash=?")) return false;
+        stmt.bind_int(1, refs);
+        stmt.bind_digest(2, hash);
+        return stmt.step() == SQLITE_DONE;
+    }
+
+    // Insert a chunk row, or add its ref_count to the row already there
+    bool insert_chunk(const ChunkMeta& row) {
+        Statement stmt;
+        if (!prepare(stmt,
+            "INSERT OR IGNORE INTO chunks (hash, pack_id, pack_offset, original_size, "
+            "stored_size, compression, encrypted, ref_count, base_hash, delta_depth, dict_id, codec_level) "
+            "VALUES (?,?,?,?,?,?,?,?,?,?,?,?)")) return false;
+        stmt.bind_digest(1, row.hash);
+        stmt.bind_int64(2, row.location.pack_id);
+        stmt.bind_int64(3, static_cast<int64_t>(row.location.offset));
+        stmt.bind_int(4, static_cast<int>(row.original_size));
+        stmt.bind_int(5, static_cast<int>(row.location.length));
+        stmt.bind_int(6, row.compression);
+        stmt.bind_int(7, row.encrypted ? 1 : 0);
+        stmt.bind_int(8, row.ref_count);
+        if (row.delta_base) stmt.bind_digest(9, *row.delta_base);  // else NULL
+        stmt.bind_int(10, row.delta_depth);
+        stmt.bind_int(11, row.dict_id);
+        stmt.bind_int(12, row.codec_level);
+        if (stmt.step() != SQLITE_DONE) return false;
+        // Already there (IGNORE): count the new references
+        return sqlite3_changes(db_) != 0 || add_chunk_refs(row.hash, row.ref_count);
+    }
+
+    bool insert_feature(const FeatureRow& row) {
         Statement stmt;
-        if (!stmt.prepare(db_, "UPDATE chunks SET ref_count = ref_count + 1 WHERE hash=?")) return false;
-        stmt.bind_text(1, hash_hex);
+        if (!prepare(stmt,
+            "INSERT OR REPLACE INTO chunk_features (feature, key_tag, hash) VALUES (?,?,?)")) return false;
+        stmt.bind_int64(1, static_cast<int64_t>(row.feature));
+        stmt.bind_int64(2, row.key_tag);
+        stmt.bind_digest(3, row.hash);
         return stmt.step() == SQLITE_DONE;
     }
 
+    bool insert_manifest(int job_id, const FileManifest& manifest) {
+        Statement stmt;
+        if (!prepare(stmt,
+            "INSERT INTO file_manifests (job_id, file_path, file_name, file_size, "
+            "modified_time, file_hash, digest_mode, chunk_list) VALUES (?,?,?,?,?,?,?,?)")) return false;
+        stmt.bind_int(1, job_id);
+        stmt.bind_text(2, manifest.file_path);
+        stmt.bind_text(3, manifest.file_name);
+        stmt.bind_int64(4, static_cast<int64_t>(manifest.file_size));
+        stmt.bind_int64(5, static_cast<int64_t>(manifest.modified_time));
+        stmt.bind_digest(6, manifest.file_hash);
+        stmt.bind_int(7, static_cast<int>(manifest.digest_mode));
+        bool packed = chunk_lists_ == ChunkListFormat::PACKED;
+        if (packed) {
+            ChunkList::encode(manifest.chunks, list_buf_);
+            stmt.bind_blob(8, list_buf_.data(), static_cast<int>(list_buf_.size()));
+        }   // else NULL
+        if (stmt.step() != SQLITE_DONE) return false;
+        if (packed) return true;
+        int manifest_id = static_cast<int>(sqlite3_last_insert_rowid(db_));
+
+        // Store chunk references in same transaction
+        Statement chunk_stmt;
+        if (!prepare(chunk_stmt,
+            "INSERT INTO file_chunks (manifest_id, chunk_hash, chunk_index, offset, size, deduplicated, "
+            "zero_run) VALUES (?,?,?,?,?,?,?)")) return false;
+        for (auto& chunk : manifest.chunks) {
+            chunk_stmt.bind_int(1, manifest_id);
+            chunk_stmt.bind_digest(2, chunk.hash);
+            chunk_stmt.bind_int(3, static_cast<int>(chunk.chunk_index));
+            chunk_stmt.bind_int64(4, static_cast<int64_t>(chunk.offset));
+            chunk_stmt.bind_int(5, static_cast<int>(chunk.size));
+            chunk_stmt.bind_int(6, chunk.deduplicated ? 1 : 0);
+            chunk_stmt.bind_int(7, chunk.zero_run ? 1 : 0);
+            if (chunk_stmt.step() != SQLITE_DONE) return false;
+            chunk_stmt.reset();
+        }
+        return true;
+    }
+
+    StoredDict row_to_dict(Statement& stmt) {
+        StoredDict d;
+        d.dict_id      = stmt.column_int(0);
+        d.scope        = stmt.column_text(1);
+        d.version      = stmt.column_int(2);
+        d.zstd_id      = static_cast<uint32_t>(stmt.column_int64(3));
+        d.job_id       = stmt.column_int(4);
+        d.sample_count = stmt.column_int(5);
+        d.sample_bytes = static_cast<uint64_t>(stmt.column_int64(6));
+        auto* p = static_cast<const uint8_t*>(stmt.column_blob(7));
+        d.content.assign(p, p + stmt.column_bytes(7));
+        d.created_at   = static_cast<uint64_t>(stmt.column_int64(8));
+        return d;
+    }
+
     BackupJob row_to_job(Statement& stmt) {
         BackupJob j;
         j.job_id          = stmt.column_int(0);
@@ -746,6 +1732,10 @@ private:
         j.dedup_savings   = static_cast<uint64_t>(stmt.column_int64(15));
         j.file_count      = stmt.column_int(16);
         j.error_message   = stmt.column_text(17);
+        j.compress_chunks   = static_cast<uint64_t>(stmt.column_int64(18));
+        j.compress_skipped  = static_cast<uint64_t>(stmt.column_int64(19));
+        j.compress_raw      = static_cast<uint64_t>(stmt.column_int64(20));
+        j.compress_saved_ns = static_cast<uint64_t>(stmt.column_int64(21));
         return j;
     }
 };
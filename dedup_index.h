@@ -0,0 +1,293 @@
+#pragma once
+
+#include "common/types.h"
+#include "common/logger.h"
+#include "storage/database.h"
+#include "datastructures/hash_map.h"
+#include "storage/bloom_filter.h"
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <algorithm>
+#include <mutex>
+#include <shared_mutex>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+
+namespace ecpb {
+
+// ─── Dedup Index ─────────────────────────────────────────────────────
+// In-memory digest -> pack location map mirroring the `chunks` table, so
+// "already stored?" is answered without a SQLite round trip.
+//
+// Persisted as <storage>/dedup.idx:
+//   "ECPBDIDX" u32 version | u64 count | i64 last_rowid | count x entry
+//   entry = 32-byte digest | i64 pack_id | u64 offset | u32 length
+//
+// last_rowid is the highest chunks.rowid folded in; on startup only newer
+// rows are scanned. Chunks are never deleted, so a hit is always valid;
+// a miss may just mean another process stored it, and falls back to the DB.
+//
+// A Bloom filter over every stored digest sits in front of that fallback.
+// It is a shared mapping of a file next to ecpb.db that every process adds
+// to, so a filter miss is "definitely new" even for chunks written by
+// concurrent workers, and only likely hits reach SQLite. When a process
+// rebuilds the file, the others notice at their next lookup or insert,
+// map the new file and add every digest they know, so chunks they added
+// to the old file after the rebuild read its keys are not lost.
+class DedupIndex {
+public:
+    struct FilterStats {
+        bool     enabled           = false;
+        uint64_t capacity          = 0;
+        uint64_t memory_bytes      = 0;
+        double   bytes_per_million = 0.0;  // at design capacity
+        double   estimated_fp_rate = 0.0;  // from current fill
+        uint64_t lookups           = 0;
+        uint64_t negatives         = 0;
+        uint64_t false_positives   = 0;
+
+        // Share of genuinely new chunks the filter failed to rule out
+        double observed_fp_rate() const {
+            uint64_t fresh = negatives + false_positives;
+            return fresh ? static_cast<double>(false_positives) / static_cast<double>(fresh) : 0.0;
+        }
+    };
+
+    static constexpr char     MAGIC[8] = {'E','C','P','B','D','I','D','X'};
+    static constexpr uint32_t VERSION  = 1;
+    static constexpr size_t   ENTRY_LEN = SHA256_BIN_LEN + 8 + 8 + 4;
+
+    DedupIndex() = default;
+    DedupIndex(const DedupIndex&) = delete;
+    DedupIndex& operator=(const DedupIndex&) = delete;
+
+    std::optional<ChunkLocation> find(const HashDigest& digest) const { return map_.find(digest); }
+    bool contains(const HashDigest& digest) const { return map_.contains(digest); }
+    size_t size() const { return map_.size(); }
+    // Room for `n` chunks, so inserts up to there never rehash
+    void reserve(size_t n) { map_.reserve(n); }
+
+    void insert(const HashDigest& digest, const ChunkLocation& loc) {
+        std::unique_lock<std::shared_mutex> lock(filter_mtx_);
+        map_.insert(digest, loc);
+        if (filter_.replaced()) remap_filter();
+        if (filter_.is_open()) filter_.add(filter_key(digest, 8), filter_key(digest, 16));
+    }
+
+    // False only if no process has ever stored `digest`
+    bool maybe_stored(const HashDigest& digest) {
+        std::shared_lock<std::shared_mutex> lock(filter_mtx_);
+        if (filter_.replaced()) {
+            lock.unlock();
+            {
+                std::unique_lock<std::shared_mutex> remap(filter_mtx_);
+                if (filter_.replaced()) remap_filter();
+            }
+            lock.lock();
+        }
+        if (!filter_.is_open()) return true;
+        filter_.count(BloomFilter::LOOKUPS);
+        if (filter_.maybe_contains(filter_key(digest, 8), filter_key(digest, 16))) return true;
+        filter_.count(BloomFilter::NEGATIVES);
+        return false;
+    }
+
+    // maybe_stored() said yes but the database had no such chunk
+    void note_false_positive() {
+        std::shared_lock<std::shared_mutex> lock(filter_mtx_);
+        if (filter_.is_open()) filter_.count(BloomFilter::FALSE_POSITIVES);
+    }
+
+    FilterStats filter_stats() const {
+        std::shared_lock<std::shared_mutex> lock(filter_mtx_);
+        FilterStats st;
+        if (!filter_.is_open()) return st;
+        st.enabled = true;
+        st.capacity = filter_.capacity();
+        st.memory_bytes = filter_.memory_bytes();
+        st.bytes_per_million = static_cast<double>(filter_.bit_count() / 8) * 1e6 /
+                               static_cast<double>(filter_.capacity());
+        st.estimated_fp_rate = filter_.estimated_fp_rate();
+        st.lookups = filter_.counter(BloomFilter::LOOKUPS);
+        st.negatives = filter_.counter(BloomFilter::NEGATIVES);
+        st.false_positives = filter_.counter(BloomFilter::FALSE_POSITIVES);
+        return st;
+    }
+
+    // Load the snapshot (if any), fold in newer chunk rows, and rebuild from
+    // scratch if the result disagrees with the table's row count. With a
+    // `filter_path` the Bloom filter is mapped too, and rebuilt when missing,
+    // out of date or over capacity.
+    void open(const std::string& path, Database& db, const std::string& filter_path = "") {
+        path_ = path;
+        filter_path_ = filter_path;
+        if (!filter_path.empty()) filter_.open(filter_path);
+        bool loaded = load();
+        catch_up(db);
+        bool rebuilt = false;
+
+        int64_t rows = db.chunk_count();
+        if (rows >= 0 && static_cast<size_t>(rows) != map_.size()) {
+            if (loaded) {
+                LOG_WARN("DedupIndex: %zu entries vs %lld chunk rows, rebuilding",
+                         map_.size(), static_cast<long long>(rows));
+            }
+            map_.clear();
+            last_rowid_ = 0;
+            map_.reserve(static_cast<size_t>(rows));
+            catch_up(db);
+            rebuilt = true;
+        }
+        LOG_DEBUG("DedupIndex: %zu entries (rowid %lld)",
+                  map_.size(), static_cast<long long>(last_rowid_));
+
+        if (!filter_path.empty() &&
+            (rebuilt || !filter_.is_open() || map_.size() > filter_.capacity())) {
+            build_filter(filter_path);
+        }
+    }
+
+    // Catch up with the table and write the snapshot atomically (tmp + rename)
+    bool save(Database& db) {
+        if (path_.empty()) return false;
+        catch_up(db);
+
+        std::vector<uint8_t> buf;
+        buf.reserve(sizeof(MAGIC) + 20 + map_.size() * ENTRY_LEN);
+        buf.insert(buf.end(), MAGIC, MAGIC + sizeof(MAGIC));
+        uint64_t count = map_.size();
+        append_raw(buf, &VERSION, sizeof(VERSION));
+        append_raw(buf, &count, sizeof(count));
+        append_raw(buf, &last_rowid_, sizeof(last_rowid_));
+        map_.for_each([&](const HashDigest& d, const ChunkLocation& loc) {
+            buf.insert(buf.end(), d.begin(), d.end());
+            append_raw(buf, &loc.pack_id, sizeof(loc.pack_id));
+            append_raw(buf, &loc.offset, sizeof(loc.offset));
+            append_raw(buf, &loc.length, sizeof(loc.length));
+        });
+
+        std::string tmp = path_ + ".tmp";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            LOG_WARN("DedupIndex: cannot write %s: %s", tmp.c_str(), strerror(errno));
+            return false;
+        }
+        size_t done = 0;
+        while (done < buf.size()) {
+            ssize_t n = ::write(fd, buf.data() + done, buf.size() - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += static_cast<size_t>(n);
+        }
+        bool ok = (done == buf.size()) && fsync(fd) == 0;
+        ::close(fd);
+        if (!ok || rename(tmp.c_str(), path_.c_str()) != 0) {
+            LOG_WARN("DedupIndex: failed to save %s", path_.c_str());
+            unlink(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    HashMap<HashDigest, ChunkLocation, DigestHash> map_;
+    BloomFilter filter_;
+    std::string filter_path_;
+    mutable std::shared_mutex filter_mtx_;   // filter_ remaps, and map_ writes against them
+    std::string path_;
+    int64_t last_rowid_ = 0;
+
+    // DigestHash uses bytes 0..7; the filter takes two other words
+    static uint64_t filter_key(const HashDigest& d, size_t at) {
+        uint64_t v;
+        std::memcpy(&v, d.data() + at, sizeof(v));
+        return v;
+    }
+
+    // Size for twice the current entries so the file is not rebuilt often
+    void build_filter(const std::string& filter_path) {
+        uint64_t capacity = std::max<uint64_t>(BLOOM_MIN_CAPACITY, 2 * map_.size());
+        bool ok = filter_.create(filter_path, capacity, BLOOM_FP_RATE, [this](BloomFilter& f) {
+            map_.for_each([&](const HashDigest& d, const ChunkLocation&) {
+                f.add(filter_key(d, 8), filter_key(d, 16));
+            });
+        });
+        if (ok) {
+            LOG_DEBUG("DedupIndex: built filter for %llu chunks (%s)",
+                      static_cast<unsigned long long>(capacity),
+                      format_bytes(filter_.memory_bytes()).c_str());
+        }
+    }
+
+    // Another process rebuilt the filter file: map the new one and add
+    // every digest known here. Called with filter_mtx_ held exclusively.
+    void remap_filter() {
+        if (!filter_.open(filter_path_)) {
+            LOG_WARN("DedupIndex: cannot map rebuilt filter %s", filter_path_.c_str());
+            return;
+        }
+        map_.for_each([&](const HashDigest& d, const ChunkLocation&) {
+            filter_.add(filter_key(d, 8), filter_key(d, 16));
+        });
+        LOG_DEBUG("DedupIndex: filter rebuilt elsewhere, remapped with %zu entries", map_.size());
+    }
+
+    void catch_up(Database& db) {
+        last_rowid_ = db.for_each_chunk_since(last_rowid_,
+            [this](const HashDigest& digest, const ChunkLocation& loc) { insert(digest, loc); });
+    }
+
+    bool load() {
+        int fd = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+
+        std::vector<uint8_t> buf;
+        uint8_t tmp[65536];
+        ssize_t n;
+        while ((n = ::read(fd, tmp, sizeof(tmp))) > 0 || (n < 0 && errno == EINTR)) {
+            if (n > 0) buf.insert(buf.end(), tmp, tmp + n);
+        }
+        ::close(fd);
+
+        const size_t header_len = sizeof(MAGIC) + sizeof(uint32_t) + sizeof(uint64_t) + sizeof(int64_t);
+        if (buf.size() < header_len || std::memcmp(buf.data(), MAGIC, sizeof(MAGIC)) != 0) {
+            LOG_WARN("DedupIndex: ignoring malformed %s", path_.c_str());
+            return false;
+        }
+        uint32_t version;
+        uint64_t count;
+        int64_t last_rowid;
+        const uint8_t* p = buf.data() + sizeof(MAGIC);
+        std::memcpy(&version, p, sizeof(version)); p += sizeof(version);
+        std::memcpy(&count, p, sizeof(count)); p += sizeof(count);
+        std::memcpy(&last_rowid, p, sizeof(last_rowid)); p += sizeof(last_rowid);
+        if (version != VERSION || buf.size() != header_len + count * ENTRY_LEN) {
+            LOG_WARN("DedupIndex: ignoring stale or truncated %s", path_.c_str());
+            return false;
+        }
+
+        map_.reserve(static_cast<size_t>(count));
+        for (uint64_t i = 0; i < count; ++i) {
+            HashDigest d;
+            ChunkLocation loc;
+            std::memcpy(d.data(), p, SHA256_BIN_LEN); p += SHA256_BIN_LEN;
+            std::memcpy(&loc.pack_id, p, sizeof(loc.pack_id)); p += sizeof(loc.pack_id);
+            std::memcpy(&loc.offset, p, sizeof(loc.offset)); p += sizeof(loc.offset);
+            std::memcpy(&loc.length, p, sizeof(loc.length)); p += sizeof(loc.length);
+            map_.insert(d, loc);
+        }
+        last_rowid_ = last_rowid;
+        return true;
+    }
+
+    static void append_raw(std::vector<uint8_t>& buf, const void* p, size_t n) {
+        auto* b = static_cast<const uint8_t*>(p);
+        buf.insert(buf.end(), b, b + n);
+    }
+};
+
+} // namespace ecpb
@@ -0,0 +1,186 @@
+#pragma once
+
+#include "common/types.h"
+#include "common/logger.h"
+#include "compression/compressor.h"
+#include "storage/database.h"
+
+#include <cctype>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ecpb {
+
+// ─── Dictionary Store ────────────────────────────────────────────────
+// Trained zstd dictionaries for ZSTD jobs (see DictMode). A scope (a source
+// path or a file extension) collects samples from the new chunks of a job
+// until it has DICT_TRAIN_BYTES, then trains a dictionary that compresses
+// the rest of the job and later jobs. Scopes that never get that far are
+// trained at the end of the job if they have DICT_MIN_SAMPLES. A scope
+// whose newest dictionary is DICT_RETRAIN_JOBS jobs old is sampled again
+// and gets the next version. Chunks name the dictionary they were
+// compressed with, so restore loads whichever version that was.
+//
+// Holds one job at a time (begin_job .. finish_job); thread-safe within it.
+class DictStore {
+public:
+    explicit DictStore(Database& db) : db_(db) {}
+
+    DictStore(const DictStore&) = delete;
+    DictStore& operator=(const DictStore&) = delete;
+
+    void set_mode(DictMode mode) { mode_ = mode; }
+    DictMode mode() const { return mode_; }
+
+    // What a file of the current job compresses with and samples into
+    struct Use {
+        std::shared_ptr<const ZstdDict> dict;   // null: no dictionary yet
+        std::string scope;                      // empty: not sampling
+    };
+
+    void begin_job(int job_id, const std::string& source_path) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        job_id_ = job_id;
+        source_ = source_path;
+        scopes_.clear();
+    }
+
+    Use for_file(const std::string& relative_path) {
+        Use use;
+        if (mode_ == DictMode::OFF) return use;
+        std::string scope = scope_of(relative_path);
+        std::lock_guard<std::mutex> lock(mtx_);
+        Scope& sc = scope_state(scope);
+        use.dict = sc.dict;
+        if (sc.sampling) use.scope = std::move(scope);
+        return use;
+    }
+
+    // Keep the start of a new chunk as a training sample; trains the scope
+    // once it has DICT_TRAIN_BYTES
+    void add_sample(const std::string& scope, const uint8_t* data, size_t len) {
+        Samples ready;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            auto it = scopes_.find(scope);
+            if (it == scopes_.end() || !it->second.sampling) return;
+            Samples& s = it->second.samples;
+            size_t n = std::min(len, DICT_SAMPLE_MAX);
+            s.bytes.insert(s.bytes.end(), data, data + n);
+            s.sizes.push_back(n);
+            if (s.bytes.size() < DICT_TRAIN_BYTES) return;
+            it->second.sampling = false;
+            ready = std::move(s);
+            s = Samples{};
+        }
+        train(scope, ready);
+    }
+
+    // Train the scopes still sampling that have enough to go on, and drop
+    // the job's samples. Returns the number of dictionaries trained.
+    size_t finish_job() {
+        std::vector<std::pair<std::string, Samples>> pending;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            for (auto& [scope, sc] : scopes_) {
+                if (sc.sampling && sc.samples.sizes.size() >= DICT_MIN_SAMPLES) {
+                    pending.emplace_back(scope, std::move(sc.samples));
+                }
+                sc.sampling = false;
+                sc.samples = Samples{};
+            }
+        }
+        size_t trained = 0;
+        for (auto& [scope, samples] : pending) trained += train(scope, samples) ? 1 : 0;
+
+        std::lock_guard<std::mutex> lock(mtx_);
+        scopes_.clear();
+        return trained;
+    }
+
+    // Dictionary by id, for restore; loaded once and kept
+    std::shared_ptr<const ZstdDict> get(int dict_id) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto it = by_id_.find(dict_id);
+        if (it != by_id_.end()) return it->second;
+        auto row = db_.get_dictionary(dict_id);
+        if (!row) return nullptr;
+        return cache(*row);
+    }
+
+private:
+    struct Samples {
+        std::vector<uint8_t> bytes;   // samples end to end
+        std::vector<size_t>  sizes;
+    };
+
+    struct Scope {
+        std::shared_ptr<const ZstdDict> dict;
+        bool    sampling = false;
+        Samples samples;
+    };
+
+    Database& db_;
+    DictMode mode_ = DictMode::OFF;
+    std::mutex mtx_;
+    int job_id_ = -1;
+    std::string source_;
+    std::map<std::string, Scope> scopes_;                          // this job
+    std::map<int, std::shared_ptr<const ZstdDict>> by_id_;         // every one loaded
+
+    std::string scope_of(const std::string& relative_path) const {
+        if (mode_ == DictMode::SOURCE) return "source:" + source_;
+        std::string name = relative_path.substr(relative_path.find_last_of('/') + 1);
+        size_t dot = name.find_last_of('.');
+        std::string ext = dot == std::string::npos || dot == 0 ? "" : name.substr(dot + 1);
+        for (auto& c : ext) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        return "ext:" + ext;
+    }
+
+    // Caller holds mtx_
+    Scope& scope_state(const std::string& scope) {
+        auto it = scopes_.find(scope);
+        if (it != scopes_.end()) return it->second;
+        Scope& sc = scopes_[scope];
+        auto row = db_.latest_dictionary(scope);
+        if (row) sc.dict = cache(*row);
+        sc.sampling = !sc.dict || job_id_ - row->job_id >= DICT_RETRAIN_JOBS;
+        return sc;
+    }
+
+    // Caller holds mtx_
+    std::shared_ptr<const ZstdDict> cache(const Database::StoredDict& row) {
+        auto dict = std::make_shared<const ZstdDict>(row.dict_id, row.content);
+        if (!dict->valid() || dict->zstd_id() != row.zstd_id) {
+            LOG_ERR("Dictionaries: %s v%d (id %d) is corrupt", row.scope.c_str(), row.version, row.dict_id);
+            return nullptr;
+        }
+        by_id_[row.dict_id] = dict;
+        return dict;
+    }
+
+    bool train(const std::string& scope, const Samples& samples) {
+        auto content = Compressor::train_dictionary(samples.bytes, samples.sizes, DICT_MAX_SIZE);
+        if (content.empty()) return false;
+        int id = db_.store_dictionary(scope, ZstdDict::content_id(content), job_id_,
+                                      static_cast<int>(samples.sizes.size()), samples.bytes.size(), content);
+        if (id < 0) return false;
+        auto row = db_.get_dictionary(id);
+        if (!row) return false;
+
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto dict = cache(*row);
+        if (!dict) return false;
+        auto it = scopes_.find(scope);
+        if (it != scopes_.end()) it->second.dict = dict;
+        LOG_INFO("Dictionaries: trained %s v%d (%s from %zu samples, %s)", scope.c_str(), row->version,
+                 format_bytes(content.size()).c_str(), samples.sizes.size(),
+                 format_bytes(samples.bytes.size()).c_str());
+        return true;
+    }
+};
+
+} // namespace ecpb
@@ -0,0 +1,189 @@
+#pragma once
+
+#include "common/types.h"
+#include "common/logger.h"
+#include "storage/database.h"
+#include "datastructures/hash_map.h"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+
+namespace ecpb {
+
+// ─── Group Commit ────────────────────────────────────────────────────
+// Chunk rows, their resemblance features and file manifests of a
+// ChunkStore, written in one transaction per group instead of one per
+// chunk and per file. A group is written once it holds max_rows rows
+// (a manifest counts one per chunk entry), once its oldest row has waited
+// max_latency_ms when the next row arrives, and on flush().
+//
+// Before each transaction `make_durable` syncs the pack data the rows
+// point at, so no process ever sees a chunk row whose data a crash could
+// lose. Until then the rows are visible to this process only: the dedup
+// index already holds the chunks, and find_chunk()/find_similar() stand in
+// for the chunks and chunk_features tables. A failed group stays pending
+// and is tried again with the next one; the add or flush that failed
+// returns false, and ChunkStore fails the job on it.
+//
+// Thread-safe; adds block while a group is being written.
+class GroupCommit {
+public:
+    struct Stats {
+        uint64_t commits = 0;        // transactions written
+        uint64_t rows = 0;           // rows in them
+        uint64_t chunks = 0;         // of which chunk rows
+        uint64_t manifests = 0;      // files
+        uint64_t sync_ns = 0;        // making pack data durable
+        uint64_t commit_ns = 0;      // writing the transactions
+        uint64_t elapsed_ns = 0;     // since the first row
+
+        double commits_per_sec() const { return elapsed_ns ? commits * 1e9 / elapsed_ns : 0.0; }
+        double rows_per_commit() const { return commits ? static_cast<double>(rows) / commits : 0.0; }
+    };
+
+    GroupCommit(Database& db, std::function<bool()> make_durable)
+        : db_(db), make_durable_(std::move(make_durable)) {}
+
+    ~GroupCommit() { flush(); }
+
+    GroupCommit(const GroupCommit&) = delete;
+    GroupCommit& operator=(const GroupCommit&) = delete;
+
+    // max_rows 1: every row is its own transaction, as before group commit
+    void set_limits(size_t max_rows, uint64_t max_latency_ms) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        max_rows_ = max_rows ? max_rows : 1;
+        max_latency_ns_ = max_latency_ms * 1000000ull;
+    }
+
+    // A newly stored chunk and, for delta bases, its super-features
+    bool add_chunk(const Database::ChunkMeta& row, int64_t key_tag = 0,
+                   const uint64_t* features = nullptr, size_t n = 0) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        note_first_row();
+        auto at = chunk_at_.find(row.hash);
+        if (at) {
+            batch_.chunks[*at].ref_count += row.ref_count;
+        } else {
+            chunk_at_.insert(row.hash, batch_.chunks.size());
+            batch_.chunks.push_back(row);
+        }
+        for (size_t i = 0; i < n; ++i) {
+            feature_at_.insert(features[i], batch_.features.size());
+            batch_.features.push_back({features[i], key_tag, row.hash});
+        }
+        rows_ += 1 + n;
+        return maybe_write();
+    }
+
+    bool add_manifest(int job_id, const FileManifest& manifest) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        note_first_row();
+        batch_.manifests.emplace_back(job_id, manifest);
+        rows_ += 1 + manifest.chunks.size();
+        return maybe_write();
+    }
+
+    // Pending chunk row for `hash`, else the table's
+    std::optional<Database::ChunkMeta> find_chunk(const HashDigest& hash) {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            auto at = chunk_at_.find(hash);
+            if (at) return batch_.chunks[*at];
+        }
+        return db_.get_chunk_meta(hash);
+    }
+
+    // Database::find_similar_chunk with the pending features in front
+    std::optional<HashDigest> find_similar(int64_t key_tag, const uint64_t* features, size_t n) {
+        HashDigest pending[DELTA_SUPER_FEATURES];
+        const HashDigest* newer[DELTA_SUPER_FEATURES] = {};
+        if (n > DELTA_SUPER_FEATURES) n = DELTA_SUPER_FEATURES;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            for (size_t i = 0; i < n; ++i) {
+                auto at = feature_at_.find(features[i]);
+                if (!at || batch_.features[*at].key_tag != key_tag) continue;
+                pending[i] = batch_.features[*at].hash;
+                newer[i] = &pending[i];
+            }
+        }
+        return db_.find_similar_chunk(key_tag, features, n, newer);
+    }
+
+    // Write whatever is pending
+    bool flush() {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return write_locked();
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(mtx_);
+        Stats s = stats_;
+        if (started_ns_) s.elapsed_ns = now_ns() - started_ns_;
+        return s;
+    }
+
+private:
+    Database& db_;
+    std::function<bool()> make_durable_;
+    mutable std::mutex mtx_;
+    size_t   max_rows_ = GROUP_COMMIT_ROWS;
+    uint64_t max_latency_ns_ = GROUP_COMMIT_MS * 1000000ull;
+
+    Database::WriteBatch batch_;
+    HashMap<HashDigest, size_t, DigestHash> chunk_at_;   // digest -> batch_.chunks index
+    HashMap<uint64_t, size_t> feature_at_;               // feature -> newest batch_.features index
+    size_t   rows_ = 0;
+    uint64_t oldest_ns_ = 0;     // when the first pending row arrived
+    uint64_t started_ns_ = 0;
+    Stats    stats_;
+
+    void note_first_row() {
+        uint64_t now = now_ns();
+        if (batch_.empty()) oldest_ns_ = now;
+        if (!started_ns_) started_ns_ = now;
+    }
+
+    bool maybe_write() {
+        if (rows_ < max_rows_ && now_ns() - oldest_ns_ < max_latency_ns_) return true;
+        return write_locked();
+    }
+
+    bool write_locked() {
+        if (batch_.empty()) return true;
+        uint64_t t0 = now_ns();
+        if (!make_durable_()) {
+            LOG_ERR("GroupCommit: pack data not durable, %zu rows kept pending", rows_);
+            return false;
+        }
+        uint64_t t1 = now_ns();
+        if (!db_.write_batch(batch_)) {
+            // write_batch logged why
+            LOG_ERR("GroupCommit: transaction of %zu rows failed, kept pending", rows_);
+            return false;
+        }
+        uint64_t t2 = now_ns();
+        stats_.commits++;
+        stats_.rows += rows_;
+        stats_.chunks += batch_.chunks.size();
+        stats_.manifests += batch_.manifests.size();
+        stats_.sync_ns += t1 - t0;
+        stats_.commit_ns += t2 - t1;
+        batch_.clear();
+        chunk_at_.clear();
+        feature_at_.clear();
+        rows_ = 0;
+        return true;
+    }
+
+    static uint64_t now_ns() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+};
+
+} // namespace ecpb
@@ -10,7 +10,7 @@
 
 namespace ecpb {
 
-template<typename K, typename V>
+template<typename K, typename V, typename Hash = std::hash<K>>
 class HashMap {
 public:
     explicit HashMap(size_t initial_cap = 256)
@@ -47,6 +47,12 @@ public:
         return true;
     }
 
+    // Grow ahead of a bulk load so inserts never rehash
+    void reserve(size_t n) {
+        size_t want = next_pow2(static_cast<size_t>(n / 0.7) + 1);
+        if (want > capacity_) rehash(want);
+    }
+
     size_t size() const { return size_; }
     bool   empty() const { return size_ == 0; }
     void   clear() {
@@ -81,7 +87,7 @@ private:
     }
 
     size_t hash_key(const K& key) const {
-        return std::hash<K>{}(key) & (capacity_ - 1);
+        return Hash{}(key) & (capacity_ - 1);
     }
 
     size_t probe(const K& key) const {
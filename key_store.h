@@ -0,0 +1,112 @@
+#pragma once
+
+#include "common/types.h"
+#include "common/logger.h"
+#include "crypto/aes256.h"
+#include "crypto/sha256.h"
+
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ecpb {
+
+// ─── Key Store ───────────────────────────────────────────────────────
+// Two-level key hierarchy. The master key lives in a file next to the
+// database (hex, mode 0600) and never in the database itself; it is made
+// once and kept across runs. Every chunk is encrypted under its own data
+// key, HMAC-SHA256(master, label | chunk digest): the same chunk gets the
+// same key in every job and process, so a chunk stored once is shared
+// without being encrypted again, and nothing has to be stored per chunk.
+// Being keyed by the master, the derivation does not let anyone without
+// it guess keys from known content.
+class KeyStore {
+public:
+    // The master key in `path`, made if the file does not exist. Several
+    // processes starting at once agree on one key: the file is written
+    // under a temporary name and linked into place, and the loser of the
+    // race reads the winner's.
+    static std::optional<AES256::Key> load_master(const std::string& path) {
+        if (auto key = read_key(path)) return key;
+        if (errno != ENOENT) return std::nullopt;
+
+        AES256::Key key = AES256::generate_key();
+        std::string tmp = path + ".tmp." + std::to_string(getpid());
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            LOG_ERR("KeyStore: cannot create %s: %s", tmp.c_str(), strerror(errno));
+            return std::nullopt;
+        }
+        std::string hex = AES256::key_to_hex(key) + "\n";
+        bool ok = ::write(fd, hex.data(), hex.size()) == static_cast<ssize_t>(hex.size()) && ::fsync(fd) == 0;
+        ::close(fd);
+        if (ok && ::link(tmp.c_str(), path.c_str()) != 0) {
+            ok = false;
+            if (errno == EEXIST) {
+                ::unlink(tmp.c_str());
+                return read_key(path);
+            }
+        }
+        ::unlink(tmp.c_str());
+        if (!ok) {
+            LOG_ERR("KeyStore: cannot write %s: %s", path.c_str(), strerror(errno));
+            return std::nullopt;
+        }
+        LOG_INFO("KeyStore: created master key %s", path.c_str());
+        return key;
+    }
+
+    // Data key of the chunk with this digest. Two SHA-256 calls over
+    // stack buffers: no allocation on the chunk path.
+    static AES256::Key chunk_key(const AES256::Key& master, const HashDigest& digest) {
+        static const char label[] = "ecpb-chunk-key";
+        constexpr size_t BLOCK = 64;
+        uint8_t inner[BLOCK + sizeof(label) + SHA256_BIN_LEN];
+        uint8_t outer[BLOCK + SHA256_BIN_LEN];
+        std::memset(inner, 0x36, BLOCK);
+        std::memset(outer, 0x5c, BLOCK);
+        for (size_t i = 0; i < AES_KEY_LEN; ++i) {
+            inner[i] ^= master[i];
+            outer[i] ^= master[i];
+        }
+        std::memcpy(inner + BLOCK, label, sizeof(label));
+        std::memcpy(inner + BLOCK + sizeof(label), digest.data(), SHA256_BIN_LEN);
+        HashDigest h = SHA256::hash(inner, sizeof(inner));
+        std::memcpy(outer + BLOCK, h.data(), SHA256_BIN_LEN);
+        h = SHA256::hash(outer, sizeof(outer));
+
+        AES256::Key key;
+        std::memcpy(key.data(), h.data(), AES_KEY_LEN);
+        return key;
+    }
+
+private:
+    // The key in `path`; errno is ENOENT if there is no such file
+    static std::optional<AES256::Key> read_key(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            if (errno != ENOENT) LOG_ERR("KeyStore: cannot open %s: %s", path.c_str(), strerror(errno));
+            return std::nullopt;
+        }
+        char buf[AES_KEY_LEN * 2 + 2];
+        ssize_t n = ::read(fd, buf, sizeof(buf));
+        ::close(fd);
+        size_t len = n > 0 ? static_cast<size_t>(n) : 0;
+        while (len && std::isspace(static_cast<unsigned char>(buf[len - 1]))) --len;
+        bool valid = len == AES_KEY_LEN * 2;
+        for (size_t i = 0; valid && i < len; ++i) valid = std::isxdigit(static_cast<unsigned char>(buf[i]));
+        if (!valid) {
+            LOG_ERR("KeyStore: %s is not a master key", path.c_str());
+            errno = EINVAL;
+            return std::nullopt;
+        }
+        return AES256::key_from_hex(std::string(buf, len));
+    }
+};
+
+} // namespace ecpb
@@ -18,6 +18,7 @@ public:
 
     void set_level(LogLevel lvl) { level_ = lvl; }
     LogLevel get_level() const { return level_; }
+    bool enabled(LogLevel lvl) const { return lvl >= level_; }
 
     void log(LogLevel lvl, const char* fmt, ...) {
         if (lvl < level_) return;
@@ -48,9 +49,15 @@ private:
     std::mutex mtx_;
 };
 
-#define LOG_DEBUG(fmt, ...) ecpb::Logger::instance().log(ecpb::LogLevel::DEBUG, fmt, ##__VA_ARGS__)
-#define LOG_INFO(fmt, ...)  ecpb::Logger::instance().log(ecpb::LogLevel::INFO,  fmt, ##__VA_ARGS__)
-#define LOG_WARN(fmt, ...)  ecpb::Logger::instance().log(ecpb::LogLevel::WARN,  fmt, ##__VA_ARGS__)
-#define LOG_ERR(fmt, ...)   ecpb::Logger::instance().log(ecpb::LogLevel::ERR,   fmt, ##__VA_ARGS__)
+// Arguments are only evaluated when the level is enabled, so a filtered
+// message costs no formatting (SHA256::to_hex and the like)
+#define ECPB_LOG(lvl, fmt, ...) \
+    do { \
+        if (ecpb::Logger::instance().enabled(lvl)) ecpb::Logger::instance().log(lvl, fmt, ##__VA_ARGS__); \
+    } while (0)
+#define LOG_DEBUG(fmt, ...) ECPB_LOG(ecpb::LogLevel::DEBUG, fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...)  ECPB_LOG(ecpb::LogLevel::INFO,  fmt, ##__VA_ARGS__)
+#define LOG_WARN(fmt, ...)  ECPB_LOG(ecpb::LogLevel::WARN,  fmt, ##__VA_ARGS__)
+#define LOG_ERR(fmt, ...)   ECPB_LOG(ecpb::LogLevel::ERR,   fmt, ##__VA_ARGS__)
 
 } // namespace ecpb
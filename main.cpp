@@ -15,6 +15,7 @@
 #include <string>
 #include <filesystem>
 #include <cstring>
+#include <iomanip>
 
 namespace fs = std::filesystem;
 
@@ -23,23 +24,46 @@ static void print_usage(const char* prog) {
               << "Options:\n"
               << "  --data-dir <path>   Data directory (default: ./ecpb_data)\n"
               << "  --log-level <N>     0=DEBUG, 1=INFO, 2=WARN, 3=ERROR (default: 1)\n"
+              << "  --chunking <mode>   fixed | cdc (default: cdc)\n"
+              << "  --chunk-avg <KB>    Average CDC chunk size (default: 64)\n"
+              << "  --chunk-threads <N> Chunk pipeline threads per file, 1 = off (default: auto)\n"
+              << "  --file-threads <N>  Files backed up concurrently per job (default: auto)\n"
+              << "  --file-digest <m>   stream | tree (default: stream)\n"
+              << "  --chunk-list <f>    packed | rows: how new manifests store chunk lists (default: packed)\n"
+              << "  --delta             Delta-encode chunks against similar stored chunks\n"
+              << "  --compression <c>   none | lz4 | lz4hc | zstd | adaptive (default: lz4)\n"
+              << "  --codec-target <N>  adaptive: codec MB/s to hold, 0 = use idle CPU (default: 0)\n"
+              << "  --zstd-dict <m>     off | source | ext: trained dictionaries (zstd only)\n"
+              << "  --paranoid          Re-hash restored chunks even when GCM authenticates them\n"
               << "  --help              Show this help\n"
               << "\nNon-interactive mode:\n"
               << "  --backup <source> --name <name>   Run a backup\n"
               << "  --restore <job_id> --dest <path>  Restore a backup\n"
               << "  --list                            List all jobs\n"
               << "  --verify <job_id>                 Verify backup integrity\n"
-              << "  --stats                           Show system stats\n";
+              << "  --stats                           Show system stats\n"
+              << "  --pack-manifests                  Convert row-per-chunk manifests to packed lists\n";
 }
 
 int main(int argc, char* argv[]) {
     std::string data_dir = "./ecpb_data";
     int log_level = 1;
+    ecpb::Chunker::Params chunk_params;
+    std::string chunking = "cdc";
+    int chunk_threads = 0;
+    int file_threads = 0;
+    std::string file_digest = "stream";
+    std::string chunk_list = "packed";
+    bool delta = false;
+    bool paranoid = false;
+    std::string compression = "lz4";
+    std::string zstd_dict = "off";
+    double codec_target = 0;
 
     // Non-interactive mode flags
     std::string backup_source, backup_name, restore_dest;
     int restore_id = -1, verify_id = -1;
-    bool do_list = false, do_stats = false, non_interactive = false;
+    bool do_list = false, do_stats = false, do_pack = false, non_interactive = false;
 
     // Parse args
     for (int i = 1; i < argc; ++i) {
@@ -49,6 +73,28 @@ int main(int argc, char* argv[]) {
             data_dir = argv[++i];
         } else if (std::strcmp(argv[i], "--log-level") == 0 && i + 1 < argc) {
             log_level = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--chunking") == 0 && i + 1 < argc) {
+            chunking = argv[++i];
+        } else if (std::strcmp(argv[i], "--chunk-avg") == 0 && i + 1 < argc) {
+            chunk_params = ecpb::Chunker::Params::cdc(static_cast<size_t>(std::atoi(argv[++i])) * 1024);
+        } else if (std::strcmp(argv[i], "--chunk-threads") == 0 && i + 1 < argc) {
+            chunk_threads = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--file-threads") == 0 && i + 1 < argc) {
+            file_threads = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--file-digest") == 0 && i + 1 < argc) {
+            file_digest = argv[++i];
+        } else if (std::strcmp(argv[i], "--chunk-list") == 0 && i + 1 < argc) {
+            chunk_list = argv[++i];
+        } else if (std::strcmp(argv[i], "--delta") == 0) {
+            delta = true;
+        } else if (std::strcmp(argv[i], "--paranoid") == 0) {
+            paranoid = true;
+        } else if (std::strcmp(argv[i], "--compression") == 0 && i + 1 < argc) {
+            compression = argv[++i];
+        } else if (std::strcmp(argv[i], "--codec-target") == 0 && i + 1 < argc) {
+            codec_target = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--zstd-dict") == 0 && i + 1 < argc) {
+            zstd_dict = argv[++i];
         } else if (std::strcmp(argv[i], "--backup") == 0 && i + 1 < argc) {
             backup_source = argv[++i]; non_interactive = true;
         } else if (std::strcmp(argv[i], "--name") == 0 && i + 1 < argc) {
@@ -63,6 +109,8 @@ int main(int argc, char* argv[]) {
             do_list = true; non_interactive = true;
         } else if (std::strcmp(argv[i], "--stats") == 0) {
             do_stats = true; non_interactive = true;
+        } else if (std::strcmp(argv[i], "--pack-manifests") == 0) {
+            do_pack = true; non_interactive = true;
         } else {
             std::cerr << "Unknown option: " << argv[i] << "\n";
             print_usage(argv[0]); return 1;
@@ -73,6 +121,55 @@ int main(int argc, char* argv[]) {
     if (log_level < 0 || log_level > 3) log_level = 1;
     ecpb::Logger::instance().set_level(static_cast<ecpb::LogLevel>(log_level));
 
+    if (chunking == "fixed") {
+        chunk_params = ecpb::Chunker::Params::fixed();
+    } else if (chunking != "cdc" || chunk_params.avg_size == 0) {
+        std::cerr << "Invalid chunking options\n";
+        print_usage(argv[0]); return 1;
+    }
+    if (chunk_threads < 0 || file_threads < 0) {
+        std::cerr << "Invalid thread count\n";
+        print_usage(argv[0]); return 1;
+    }
+    if (file_digest != "stream" && file_digest != "tree") {
+        std::cerr << "Invalid file digest mode\n";
+        print_usage(argv[0]); return 1;
+    }
+    if (chunk_list != "packed" && chunk_list != "rows") {
+        std::cerr << "Invalid chunk list format\n";
+        print_usage(argv[0]); return 1;
+    }
+    ecpb::CompressionType comp = ecpb::CompressionType::LZ4;
+    if (compression == "none") {
+        comp = ecpb::CompressionType::NONE;
+    } else if (compression == "zstd") {
+        comp = ecpb::CompressionType::ZSTD;
+    } else if (compression == "lz4hc") {
+        comp = ecpb::CompressionType::LZ4HC;
+    } else if (compression == "adaptive") {
+        comp = ecpb::CompressionType::ADAPTIVE;
+    } else if (compression != "lz4") {
+        std::cerr << "Invalid compression\n";
+        print_usage(argv[0]); return 1;
+    }
+    ecpb::DictMode dict_mode = ecpb::DictMode::OFF;
+    if (zstd_dict == "source") {
+        dict_mode = ecpb::DictMode::SOURCE;
+    } else if (zstd_dict == "ext") {
+        dict_mode = ecpb::DictMode::EXTENSION;
+    } else if (zstd_dict != "off") {
+        std::cerr << "Invalid dictionary mode\n";
+        print_usage(argv[0]); return 1;
+    }
+    if (codec_target < 0) {
+        std::cerr << "Invalid codec target\n";
+        print_usage(argv[0]); return 1;
+    }
+    if (dict_mode != ecpb::DictMode::OFF && comp != ecpb::CompressionType::ZSTD) {
+        std::cerr << "--zstd-dict needs --compression zstd\n";
+        print_usage(argv[0]); return 1;
+    }
+
     // Create data directory structure
     std::string db_path = data_dir + "/ecpb.db";
     std::string store_path = data_dir + "/store";
@@ -93,9 +190,19 @@ int main(int argc, char* argv[]) {
         std::cerr << "Failed to open database: " << db_path << "\n";
         return 1;
     }
+    db.set_chunk_list_format(chunk_list == "rows" ? ecpb::ChunkListFormat::ROWS : ecpb::ChunkListFormat::PACKED);
 
     // Orchestrator creates its own ChunkStore internally at data_dir + "/storage"
     ecpb::BackupOrchestrator orchestrator(db, data_dir);
+    orchestrator.chunk_store().set_chunker_params(chunk_params);
+    orchestrator.chunk_store().set_pipeline_threads(static_cast<size_t>(chunk_threads));
+    orchestrator.set_file_threads(static_cast<size_t>(file_threads));
+    orchestrator.chunk_store().set_file_digest_mode(
+        file_digest == "tree" ? ecpb::FileDigestMode::TREE : ecpb::FileDigestMode::STREAM);
+    orchestrator.chunk_store().set_delta_mode(delta);
+    orchestrator.chunk_store().set_dict_mode(dict_mode);
+    orchestrator.chunk_store().set_codec_target(codec_target);
+    orchestrator.chunk_store().set_paranoid(paranoid);
     ecpb::RestoreEngine restore_engine(db, orchestrator.chunk_store());
     ecpb::MessagingService messaging(db);
 
@@ -109,7 +216,7 @@ int main(int argc, char* argv[]) {
             int job_id = orchestrator.submit_job(
                 backup_source, backup_name,
                 ecpb::JobPriority::NORMAL,
-                ecpb::CompressionType::LZ4,
+                comp,
                 true
             );
             if (job_id < 0) {
@@ -122,6 +229,9 @@ int main(int argc, char* argv[]) {
                 std::cout << "Backup completed. Files: " << job->file_count
                           << ", Size: " << ecpb::format_bytes(job->total_bytes)
                           << ", Stored: " << ecpb::format_bytes(job->stored_bytes) << "\n";
+                if (job->compress_chunks) {
+                    std::cout << "Compression pre-check: " << ecpb::compress_summary(*job) << "\n";
+                }
                 return 0;
             } else {
                 std::cerr << "Backup failed.\n"; return 1;
@@ -161,14 +271,56 @@ int main(int argc, char* argv[]) {
             return 0;
         }
 
+        if (do_pack) {
+            auto size_of = [&] {
+                uint64_t n = 0;
+                for (const char* suffix : {"", "-wal"}) {
+                    std::error_code ec;
+                    auto len = fs::file_size(db_path + suffix, ec);
+                    if (!ec) n += len;
+                }
+                return n;
+            };
+            uint64_t before = size_of();
+            int64_t converted = db.pack_chunk_lists();
+            if (converted < 0 || !db.vacuum()) {
+                std::cerr << "Packing chunk lists failed\n"; return 1;
+            }
+            std::cout << "Packed chunk lists of " << converted << " manifests, database "
+                      << ecpb::format_bytes(before) << " -> " << ecpb::format_bytes(size_of()) << "\n";
+            return 0;
+        }
+
         if (do_stats) {
             auto stats = db.get_stats();
             std::cout << "Jobs: " << stats.total_jobs
                       << " (completed: " << stats.completed_jobs
                       << ", failed: " << stats.failed_jobs << ")\n"
+                      << "Files: " << stats.total_files << " (" << ecpb::format_bytes(stats.total_file_bytes) << ")\n"
                       << "Chunks: " << stats.total_chunks << "\n"
                       << "Stored: " << ecpb::format_bytes(stats.total_stored_bytes) << "\n"
                       << "Dedup savings: " << ecpb::format_bytes(stats.total_dedup_savings) << "\n";
+            if (stats.dictionaries) {
+                std::cout << "Dictionaries: " << stats.dictionaries << " ("
+                          << stats.dict_chunks << " chunks compressed with one)\n";
+            }
+            if (!stats.codecs.empty()) std::cout << "Codecs: " << stats.codec_summary() << "\n";
+            for (auto& j : db.get_job_stats()) {
+                std::cout << "  Job #" << j.job_id << " " << j.name << " [" << ecpb::job_status_str(j.status)
+                          << "]: " << j.files << " files (" << ecpb::format_bytes(j.file_bytes) << "), stored "
+                          << ecpb::format_bytes(j.stored_bytes) << ", dedup "
+                          << ecpb::format_bytes(j.dedup_savings) << "\n";
+            }
+            auto fs = orchestrator.chunk_store().dedup_filter_stats();
+            if (fs.enabled) {
+                std::cout << std::fixed << std::setprecision(3)
+                          << "Dedup filter: " << ecpb::format_bytes(fs.memory_bytes)
+                          << " (" << ecpb::format_bytes(static_cast<uint64_t>(fs.bytes_per_million))
+                          << " per million chunks), " << fs.lookups << " lookups, "
+                          << fs.negatives << " definitely new, FP rate "
+                          << fs.observed_fp_rate() * 100.0 << "% observed / "
+                          << fs.estimated_fp_rate * 100.0 << "% expected\n";
+            }
             return 0;
         }
     }
@@ -3,6 +3,7 @@
 #include "common/types.h"
 #include "common/logger.h"
 #include "crypto/aes256.h"
+#include "crypto/key_store.h"
 #include "ipc/ipc.h"
 #include "storage/database.h"
 #include "storage/chunk_store.h"
@@ -28,7 +29,18 @@ public:
           chunk_store_(db, data_dir + "/storage"),
           snap_mgr_(db, data_dir + "/snapshots"),
           scheduler_(db),
-          running_(false), aes_key_(AES256::generate_key()) {
+          running_(false) {
+        // Chunks are encrypted under keys derived from the master key, so
+        // every run must use the same one. Without a key file, fall back to
+        // a key for this run only, recorded with each job that uses it.
+        if (auto master = KeyStore::load_master(data_dir + "/master.key")) {
+            aes_key_ = *master;
+        } else {
+            LOG_WARN("BackupOrchestrator: no master key, using a key for this run only");
+            aes_key_ = AES256::generate_key();
+            session_key_ = true;
+        }
+        chunk_store_.add_key(aes_key_);
         LOG_INFO("BackupOrchestrator initialized with AES-256 key");
     }
 
@@ -147,7 +159,13 @@ public:
     Database& database() { return db_; }
     ChunkStore& chunk_store() { return chunk_store_; }
     const AES256::Key& aes_key() const { return aes_key_; }
-    void set_aes_key(const AES256::Key& key) { aes_key_ = key; }
+    void set_aes_key(const AES256::Key& key) {
+        aes_key_ = key;
+        chunk_store_.add_key(key);
+    }
+
+    // Files processed concurrently inside each backup job (0 = automatic)
+    void set_file_threads(size_t n) { file_threads_ = n; }
 
     int active_worker_count() const { return static_cast<int>(active_workers_.size()); }
 
@@ -164,6 +182,8 @@ private:
 
     std::atomic<bool> running_;
     AES256::Key aes_key_;
+    bool session_key_ = false;   // aes_key_ is not the master key
+    size_t file_threads_ = 0;
 
     struct WorkerInfo {
         int job_id;
@@ -174,12 +194,20 @@ private:
 
     void execute_job_direct(BackupJob& job) {
         BackupWorker worker(db_, chunk_store_, snap_mgr_);
+        worker.set_threads(file_threads_);
+        record_session_key(db_, job);
         auto result = worker.execute(job, aes_key_, nullptr);
         if (!result.success) {
             LOG_ERR("Job %d failed: %s", job.job_id, result.error.c_str());
         }
     }
 
+    // A run-only key is kept with the job, for its restore; the master key
+    // never goes into the database
+    void record_session_key(Database& db, const BackupJob& job) {
+        if (session_key_ && job.encrypt) db.store_encryption_key(job.job_id, AES256::key_to_hex(aes_key_));
+    }
+
     void fork_worker(BackupJob& job) {
         db_.update_job_status(job.job_id, JobStatus::RUNNING);
 
@@ -197,11 +225,22 @@ private:
             if (!child_db.open(data_dir_ + "/ecpb.db")) {
                 _exit(1);
             }
-            ChunkStore child_store(child_db, data_dir_ + "/storage");
+            child_db.set_chunk_list_format(db_.chunk_list_format());
+            ChunkStore child_store(child_db, data_dir_ + "/storage", chunk_store_.dedup_index());
+            child_store.set_chunker_params(chunk_store_.chunker_params());
+            child_store.set_pipeline_threads(chunk_store_.pipeline_threads());
+            child_store.set_file_digest_mode(chunk_store_.file_digest_mode());
+            child_store.set_delta_mode(chunk_store_.delta_mode());
+            child_store.set_dict_mode(chunk_store_.dict_mode());
+            child_store.set_codec_target(chunk_store_.codec_target());
+            child_store.set_paranoid(chunk_store_.paranoid());
             SnapshotManager child_snap(child_db, data_dir_ + "/snapshots");
             BackupWorker worker(child_db, child_store, child_snap);
+            worker.set_threads(file_threads_);
+            record_session_key(child_db, job);
 
             auto result = worker.execute(job, aes_key_, &msg_queue_);
+            child_store.flush();
             child_db.close();
             _exit(result.success ? 0 : 1);
         }
@@ -0,0 +1,373 @@
+#pragma once
+
+#include "common/types.h"
+#include "common/logger.h"
+#include "storage/database.h"
+#include "datastructures/buffer_pool.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <optional>
+#include <mutex>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+
+namespace ecpb {
+
+// ─── Pack Files ──────────────────────────────────────────────────────
+// Chunks are appended to large pack files instead of one file per chunk:
+//
+//   pack-<id>.dat  "ECPBPACK" u32 version, then records:
+//                  u32 magic | 32-byte digest | u32 length | payload
+//                  "ECHV": the payload is a ChunkEnvelope and the stored
+//                  bytes. Older records have no envelope and the magic gives
+//                  the payload kind: "ECHK" compressed with the chunk's
+//                  codec, "ECHR" stored raw, "ECHD" delta vs a base
+//   pack-<id>.idx  "ECPBPIDX" u32 count, then {digest, u64 offset, u32 length}
+//                  written when the pack is sealed (recovery / listing aid)
+//
+// Pack ids come from the `packs` table, so forked workers each append to
+// their own pack and never share a writer. Within a process the store is
+// shared by all backup threads: appends are serialized by one mutex, and
+// reads pread through a per-pack descriptor without taking it, so delta
+// base and restore loads do not queue behind appends.
+class PackStore {
+public:
+    static constexpr char     PACK_MAGIC[8]  = {'E','C','P','B','P','A','C','K'};
+    static constexpr char     INDEX_MAGIC[8] = {'E','C','P','B','P','I','D','X'};
+    static constexpr uint32_t PACK_VERSION   = 1;
+    static constexpr uint32_t RECORD_MAGIC   = 0x4B484345;  // "ECHK"
+    static constexpr uint32_t RAW_MAGIC      = 0x52484345;  // "ECHR"
+    static constexpr uint32_t DELTA_MAGIC    = 0x44484345;  // "ECHD"
+    static constexpr uint32_t ENVELOPE_MAGIC = 0x56484345;  // "ECHV"
+    static constexpr size_t   PACK_HEADER_LEN   = sizeof(PACK_MAGIC) + sizeof(uint32_t);
+    static constexpr size_t   RECORD_HEADER_LEN = sizeof(uint32_t) + SHA256_BIN_LEN + sizeof(uint32_t);
+    static constexpr size_t   MAX_OPEN_READERS  = 16;
+
+    enum class RecordKind { CHUNK, RAW, DELTA, ENVELOPE };
+
+    PackStore(Database& db, const std::string& pack_dir)
+        : db_(db), dir_(pack_dir) {
+        mkdir_p(dir_);
+    }
+
+    ~PackStore() {
+        seal_locked();
+    }
+
+    PackStore(const PackStore&) = delete;
+    PackStore& operator=(const PackStore&) = delete;
+
+    // Append a chunk record to the current pack, opening a new one as needed.
+    // `head` (if any) is written in front of `data` as part of the payload.
+    std::optional<ChunkLocation> append(const HashDigest& digest,
+                                        const uint8_t* data, size_t len,
+                                        RecordKind kind = RecordKind::CHUNK,
+                                        const uint8_t* head = nullptr, size_t head_len = 0) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (write_fd_ < 0 || write_size_ >= PACK_TARGET_SIZE) {
+            seal_locked();
+            if (!open_new_pack()) return std::nullopt;
+        }
+
+        uint8_t header[RECORD_HEADER_LEN];
+        uint32_t length = static_cast<uint32_t>(head_len + len);
+        uint32_t magic = kind == RecordKind::RAW ? RAW_MAGIC :
+                         kind == RecordKind::DELTA ? DELTA_MAGIC :
+                         kind == RecordKind::ENVELOPE ? ENVELOPE_MAGIC : RECORD_MAGIC;
+        std::memcpy(header, &magic, sizeof(uint32_t));
+        std::memcpy(header + sizeof(uint32_t), digest.data(), SHA256_BIN_LEN);
+        std::memcpy(header + sizeof(uint32_t) + SHA256_BIN_LEN, &length, sizeof(uint32_t));
+
+        struct iovec iov[3];
+        iov[0].iov_base = header;
+        iov[0].iov_len = sizeof(header);
+        iov[1].iov_base = const_cast<uint8_t*>(head);
+        iov[1].iov_len = head_len;
+        iov[2].iov_base = const_cast<uint8_t*>(data);
+        iov[2].iov_len = len;
+        if (!write_all(iov, 3)) {
+            LOG_ERR("PackStore: write to pack %lld failed: %s",
+                    static_cast<long long>(write_pack_id_), strerror(errno));
+            return std::nullopt;
+        }
+
+        ChunkLocation loc;
+        loc.pack_id = write_pack_id_;
+        loc.offset = write_size_;
+        loc.length = length;
+        write_size_ += sizeof(header) + length;
+        index_.push_back({digest, loc.offset, loc.length});
+        return loc;
+    }
+
+    // Read a chunk payload; checks the record header against the digest.
+    // `kind` (if given) receives the record kind.
+    bool read(const ChunkLocation& loc, const HashDigest& digest, ByteBuffer& out,
+              RecordKind* kind = nullptr) {
+        std::shared_ptr<ReadFd> pack = reader(loc.pack_id);
+        if (!pack) return false;
+        int fd = pack->fd;
+
+        uint8_t header[RECORD_HEADER_LEN];
+        if (!pread_all(fd, header, sizeof(header), loc.offset)) {
+            LOG_ERR("PackStore: short read at pack %lld offset %llu",
+                    static_cast<long long>(loc.pack_id), static_cast<unsigned long long>(loc.offset));
+            return false;
+        }
+        uint32_t magic = 0, length = 0;
+        std::memcpy(&magic, header, sizeof(uint32_t));
+        std::memcpy(&length, header + sizeof(uint32_t) + SHA256_BIN_LEN, sizeof(uint32_t));
+        bool known = magic == RECORD_MAGIC || magic == RAW_MAGIC || magic == DELTA_MAGIC ||
+                     magic == ENVELOPE_MAGIC;
+        if (!known || length != loc.length ||
+            std::memcmp(header + sizeof(uint32_t), digest.data(), SHA256_BIN_LEN) != 0) {
+            LOG_ERR("PackStore: record mismatch at pack %lld offset %llu",
+                    static_cast<long long>(loc.pack_id), static_cast<unsigned long long>(loc.offset));
+            return false;
+        }
+        if (kind) {
+            *kind = magic == RAW_MAGIC ? RecordKind::RAW :
+                    magic == DELTA_MAGIC ? RecordKind::DELTA :
+                    magic == ENVELOPE_MAGIC ? RecordKind::ENVELOPE : RecordKind::CHUNK;
+        }
+
+        out.resize(length);
+        return pread_all(fd, out.data(), length, loc.offset + sizeof(header));
+    }
+
+    // Finish the current pack: write its index and record the final size.
+    // False if it could not be recorded, or this or any earlier pack
+    // failed to sync (see sync()).
+    bool seal() {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return seal_locked() && !sync_failed_;
+    }
+
+    // Make every record appended so far durable, the current pack's
+    // directory entry included; the pack stays open. Sealed packs were
+    // synced when they were sealed. Once a sync has failed this stays
+    // false: the kernel may have dropped the pages it could not write, so
+    // a later sync succeeding proves nothing about them.
+    bool sync() {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (sync_failed_) return false;
+        if (write_fd_ < 0 || write_synced_ == write_size_) return true;
+        if (fdatasync(write_fd_) != 0 || !sync_dir_once()) {
+            LOG_ERR("PackStore: cannot sync pack %lld: %s",
+                    static_cast<long long>(write_pack_id_), strerror(errno));
+            sync_failed_ = true;
+            return false;
+        }
+        write_synced_ = write_size_;
+        return true;
+    }
+
+    std::string pack_path(int64_t pack_id) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/pack-%08lld.dat", static_cast<long long>(pack_id));
+        return dir_ + name;
+    }
+
+    std::string index_path(int64_t pack_id) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/pack-%08lld.idx", static_cast<long long>(pack_id));
+        return dir_ + name;
+    }
+
+private:
+    struct IndexEntry {
+        HashDigest digest;
+        uint64_t   offset;
+        uint32_t   length;
+    };
+
+    Database& db_;
+    std::string dir_;
+    std::mutex mtx_;
+
+    int      write_fd_      = -1;
+    int64_t  write_pack_id_ = -1;
+    uint64_t write_size_    = 0;
+    uint64_t write_synced_  = 0;       // bytes of the current pack known durable
+    bool     dir_synced_    = false;   // the current pack's directory entry is durable
+    bool     sync_failed_   = false;   // a pack failed to sync; see sync()
+    std::vector<IndexEntry> index_;
+
+    // A pack open for reading; closed once evicted and no read is using it
+    struct ReadFd {
+        int fd;
+        explicit ReadFd(int f) : fd(f) {}
+        ~ReadFd() { ::close(fd); }
+        ReadFd(const ReadFd&) = delete;
+        ReadFd& operator=(const ReadFd&) = delete;
+    };
+    std::mutex readers_mtx_;   // readers_ only; not held across reads
+    std::map<int64_t, std::shared_ptr<ReadFd>> readers_;
+
+    bool seal_locked() {
+        if (write_fd_ < 0) return true;
+        if (fsync(write_fd_) != 0 || !sync_dir_once()) {
+            LOG_ERR("PackStore: cannot sync pack %lld: %s",
+                    static_cast<long long>(write_pack_id_), strerror(errno));
+            sync_failed_ = true;
+        }
+        ::close(write_fd_);
+        write_fd_ = -1;
+        write_index();
+        bool recorded = db_.seal_pack(write_pack_id_, write_size_, static_cast<int>(index_.size()));
+        LOG_DEBUG("PackStore: sealed pack %lld (%s, %zu chunks)",
+                  static_cast<long long>(write_pack_id_),
+                  format_bytes(write_size_).c_str(), index_.size());
+        index_.clear();
+        write_pack_id_ = -1;
+        write_size_ = 0;
+        return recorded;
+    }
+
+    bool open_new_pack() {
+        int64_t id = db_.create_pack();
+        if (id < 0) {
+            LOG_ERR("PackStore: cannot allocate pack id");
+            return false;
+        }
+        std::string path = pack_path(id);
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            LOG_ERR("PackStore: cannot create %s: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+        write_fd_ = fd;
+        write_pack_id_ = id;
+        write_size_ = 0;
+        write_synced_ = 0;
+        dir_synced_ = false;
+
+        uint8_t header[PACK_HEADER_LEN];
+        std::memcpy(header, PACK_MAGIC, sizeof(PACK_MAGIC));
+        std::memcpy(header + sizeof(PACK_MAGIC), &PACK_VERSION, sizeof(uint32_t));
+        struct iovec iov{header, sizeof(header)};
+        if (!write_all(&iov, 1)) {
+            LOG_ERR("PackStore: cannot write header to %s", path.c_str());
+            ::close(write_fd_);
+            write_fd_ = -1;
+            return false;
+        }
+        write_size_ = sizeof(header);
+        LOG_DEBUG("PackStore: opened pack %lld", static_cast<long long>(id));
+        return true;
+    }
+
+    bool sync_dir_once() {
+        if (dir_synced_) return true;
+        int fd = ::open(dir_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) return false;
+        bool ok = fsync(fd) == 0;
+        ::close(fd);
+        dir_synced_ = ok;
+        return ok;
+    }
+
+    void write_index() {
+        std::vector<uint8_t> buf;
+        uint32_t count = static_cast<uint32_t>(index_.size());
+        buf.reserve(sizeof(INDEX_MAGIC) + sizeof(count) + index_.size() * (SHA256_BIN_LEN + 12));
+        buf.insert(buf.end(), INDEX_MAGIC, INDEX_MAGIC + sizeof(INDEX_MAGIC));
+        append_raw(buf, &count, sizeof(count));
+        for (auto& e : index_) {
+            buf.insert(buf.end(), e.digest.begin(), e.digest.end());
+            append_raw(buf, &e.offset, sizeof(e.offset));
+            append_raw(buf, &e.length, sizeof(e.length));
+        }
+
+        std::string path = index_path(write_pack_id_);
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            LOG_WARN("PackStore: cannot write index %s: %s", path.c_str(), strerror(errno));
+            return;
+        }
+        size_t done = 0;
+        while (done < buf.size()) {
+            ssize_t n = ::write(fd, buf.data() + done, buf.size() - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += static_cast<size_t>(n);
+        }
+        ::close(fd);
+    }
+
+    std::shared_ptr<ReadFd> reader(int64_t pack_id) {
+        std::lock_guard<std::mutex> lock(readers_mtx_);
+        auto it = readers_.find(pack_id);
+        if (it != readers_.end()) return it->second;
+
+        // The pack being written is readable too: a record is whole before
+        // append() hands out its location
+        if (readers_.size() >= MAX_OPEN_READERS) readers_.erase(readers_.begin());
+        std::string path = pack_path(pack_id);
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            LOG_ERR("PackStore: cannot open %s: %s", path.c_str(), strerror(errno));
+            return nullptr;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        auto pack = std::make_shared<ReadFd>(fd);
+        readers_[pack_id] = pack;
+        return pack;
+    }
+
+    bool write_all(struct iovec* iov, int cnt) {
+        while (cnt > 0) {
+            ssize_t n = ::writev(write_fd_, iov, cnt);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            size_t left = static_cast<size_t>(n);
+            while (cnt > 0 && left >= iov->iov_len) {
+                left -= iov->iov_len;
+                ++iov;
+                --cnt;
+            }
+            if (cnt > 0) {
+                iov->iov_base = static_cast<uint8_t*>(iov->iov_base) + left;
+                iov->iov_len -= left;
+            }
+        }
+        return true;
+    }
+
+    static bool pread_all(int fd, uint8_t* buf, size_t len, uint64_t offset) {
+        size_t done = 0;
+        while (done < len) {
+            ssize_t n = ::pread(fd, buf + done, len - done, static_cast<off_t>(offset + done));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            done += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    static void mkdir_p(const std::string& path) {
+        std::string tmp;
+        for (size_t i = 0; i < path.size(); ++i) {
+            tmp += path[i];
+            if (path[i] == '/' || i == path.size() - 1) {
+                mkdir(tmp.c_str(), 0755);
+            }
+        }
+    }
+
+    static void append_raw(std::vector<uint8_t>& buf, const void* p, size_t n) {
+        auto* b = static_cast<const uint8_t*>(p);
+        buf.insert(buf.end(), b, b + n);
+    }
+};
+
+} // namespace ecpb
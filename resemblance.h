@@ -0,0 +1,90 @@
+#pragma once
+
+#include "common/types.h"
+#include "storage/rolling_checksum.h"
+#include <array>
+#include <optional>
+#include <cstdint>
+#include <cstddef>
+
+namespace ecpb {
+
+// ─── Resemblance Sketches ────────────────────────────────────────────
+// Super-features for finding a stored chunk that is similar, not equal,
+// to a new one (Shilane et al., "WAN Optimized Replication of Backup
+// Datasets Using Stream-Informed Delta Compression").
+//
+// A gear fingerprint is rolled over the chunk. At content-defined sample
+// points (about one byte in 32) each of DELTA_FEATURES linear transforms
+// of the fingerprint keeps its maximum, so an edit only moves the features
+// whose maximum sat near it. The features are hashed in groups into
+// DELTA_SUPER_FEATURES super-features; two chunks sharing any one of them
+// are very likely near-duplicates.
+struct SuperFeatures {
+    std::array<uint64_t, DELTA_SUPER_FEATURES> sf{};
+};
+
+class Resemblance {
+public:
+    static constexpr int    SAMPLE_BITS = 5;   // sample where the top bits are zero
+    static constexpr size_t MIN_SAMPLES = 8;
+
+    // Nullopt for chunks too small or too uniform to say anything about
+    static std::optional<SuperFeatures> sketch(const uint8_t* data, size_t len) {
+        if (len < DELTA_MIN_CHUNK) return std::nullopt;
+        const auto& tf = transforms();
+
+        std::array<uint64_t, DELTA_FEATURES> feature{};
+        GearHash gear;
+        size_t samples = 0;
+        for (size_t i = 0; i < len; ++i) {
+            gear.roll(data[i]);
+            uint64_t fp = gear.digest();
+            if ((fp >> (64 - SAMPLE_BITS)) != 0) continue;
+            ++samples;
+            for (size_t f = 0; f < DELTA_FEATURES; ++f) {
+                feature[f] = std::max(feature[f], tf[f].mul * fp + tf[f].add);
+            }
+        }
+        if (samples < MIN_SAMPLES) return std::nullopt;
+
+        constexpr size_t per = DELTA_FEATURES / DELTA_SUPER_FEATURES;
+        SuperFeatures out;
+        for (size_t s = 0; s < DELTA_SUPER_FEATURES; ++s) {
+            uint64_t h = mix(s + 1);
+            for (size_t f = s * per; f < (s + 1) * per; ++f) h = mix(h ^ feature[f]);
+            out.sf[s] = h;
+        }
+        return out;
+    }
+
+private:
+    struct Transform {
+        uint64_t mul;   // odd, so the transform is a permutation
+        uint64_t add;
+    };
+
+    // splitmix64 finalizer
+    static constexpr uint64_t mix(uint64_t z) {
+        z += 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    // Fixed across builds: stored super-features must stay comparable
+    static const std::array<Transform, DELTA_FEATURES>& transforms() {
+        static constexpr std::array<Transform, DELTA_FEATURES> tbl = [] {
+            std::array<Transform, DELTA_FEATURES> t{};
+            uint64_t state = 0x5EED5EED5EED5EEDULL;
+            for (auto& x : t) {
+                x.mul = mix(state++) | 1;
+                x.add = mix(state++);
+            }
+            return t;
+        }();
+        return tbl;
+    }
+};
+
+} // namespace ecpb
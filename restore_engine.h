@@ -6,6 +6,7 @@
 #include "storage/chunk_store.h"
 #include "crypto/aes256.h"
 
+#include <set>
 #include <string>
 #include <vector>
 #include <sys/stat.h>
@@ -18,11 +19,13 @@ public:
         : db_(db), store_(store) {}
 
     struct RestoreResult {
+        static constexpr size_t LISTED_FILES = 100;
+
         bool success = false;
         int files_restored = 0;
         uint64_t bytes_restored = 0;
         std::string error;
-        std::vector<std::string> restored_files;
+        std::vector<std::string> restored_files;   // the first LISTED_FILES
     };
 
     // Restore all files from a backup job
@@ -43,44 +46,34 @@ public:
             return result;
         }
 
-        // Get AES key if encrypted
+        // Chunks name their key; the store knows the master key. Jobs from
+        // before the master key have their own key on record, which older
+        // chunks without a key id are read with.
         AES256::Key aes_key{};
         if (job->encrypt) {
             std::string key_hex = db_.get_encryption_key(job_id);
-            if (key_hex.empty()) {
-                result.error = "Encryption key not found for job " + std::to_string(job_id);
-                LOG_ERR("Restore: %s", result.error.c_str());
-                return result;
-            }
-            aes_key = AES256::key_from_hex(key_hex);
+            if (!key_hex.empty()) aes_key = AES256::key_from_hex(key_hex);
         }
 
-        // Get all file manifests for this job
-        auto manifests = db_.get_file_manifests(job_id);
-        if (manifests.empty()) {
-            result.error = "No files found in backup job " + std::to_string(job_id);
-            LOG_WARN("Restore: %s", result.error.c_str());
-            result.success = true;  // technically success, just no files
-            return result;
-        }
-
-        LOG_INFO("Restore: restoring %zu files from job %d to %s",
-                 manifests.size(), job_id, dest_path.c_str());
-
-        mkdir_p(dest_path);
+        LOG_INFO("Restore: restoring %d files from job %d to %s",
+                 job->file_count, job_id, dest_path.c_str());
 
-        for (auto& manifest : manifests) {
+        // Manifests are streamed one at a time, so memory does not grow
+        // with the number of files
+        std::string last_dir;
+        int64_t manifests = db_.for_each_file_manifest(job_id, [&](const FileManifest& manifest) {
             // file_path is stored as relative path (e.g., "subdir/nested.txt")
             std::string target = dest_path + "/" + manifest.file_path;
 
-            // Ensure parent directory exists
+            // Ensure parent directory exists (files of a directory are
+            // stored together, so this mostly runs once per directory)
             auto slash_pos = target.rfind('/');
-            if (slash_pos != std::string::npos) {
-                mkdir_p(target.substr(0, slash_pos));
+            if (slash_pos != std::string::npos && target.compare(0, slash_pos, last_dir) != 0) {
+                last_dir = target.substr(0, slash_pos);
+                mkdir_p(last_dir);
             }
 
-            bool ok = store_.restore_file(manifest, target,
-                                          job->compression, job->encrypt, aes_key);
+            bool ok = store_.restore_file(manifest, target, aes_key);
             if (!ok) {
                 LOG_ERR("Restore: failed to restore %s", manifest.file_path.c_str());
                 result.error = "Failed to restore: " + manifest.file_name;
@@ -88,8 +81,20 @@ public:
             } else {
                 result.files_restored++;
                 result.bytes_restored += manifest.file_size;
-                result.restored_files.push_back(target);
+                if (result.restored_files.size() < RestoreResult::LISTED_FILES) result.restored_files.push_back(target);
             }
+            return true;
+        });
+        if (manifests < 0) {
+            result.error = "Cannot read the file list of job " + std::to_string(job_id);
+            LOG_ERR("Restore: %s", result.error.c_str());
+            return result;
+        }
+        if (manifests == 0) {
+            result.error = "No files found in backup job " + std::to_string(job_id);
+            LOG_WARN("Restore: %s", result.error.c_str());
+            result.success = true;  // technically success, just no files
+            return result;
         }
 
         result.success = (result.files_restored > 0);
@@ -115,21 +120,32 @@ public:
         auto job = db_.get_job(job_id);
         if (!job || job->status != JobStatus::COMPLETED) return false;
 
-        auto manifests = db_.get_file_manifests(job_id);
-        for (auto& manifest : manifests) {
+        // Each chunk is read back once and checked against its envelope.
+        // Manifests are streamed; only the digests checked so far are kept.
+        std::set<HashDigest> checked;
+        bool ok = true;
+        int64_t manifests = db_.for_each_file_manifest(job_id, [&](const FileManifest& manifest) {
             for (auto& chunk : manifest.chunks) {
-                auto meta = db_.get_chunk_meta(chunk.hash.str());
-                if (!meta) {
-                    LOG_ERR("Verify: chunk %s not found in database", chunk.hash.c_str());
-                    return false;
-                }
-                // Check chunk file exists
-                struct stat st;
-                if (stat(meta->storage_path.c_str(), &st) != 0) {
-                    LOG_ERR("Verify: chunk file missing: %s", meta->storage_path.c_str());
-                    return false;
+                if (chunk.zero_run || !checked.insert(chunk.hash).second) continue;
+                if (!store_.check_chunk(chunk.hash)) {
+                    LOG_ERR("Verify: chunk %s of %s is missing or damaged",
+                            SHA256::to_hex(chunk.hash).c_str(), manifest.file_path.c_str());
+                    return ok = false;
                 }
             }
+            // A tree digest can be checked from the chunk list alone
+            if (manifest.digest_mode == FileDigestMode::TREE &&
+                SHA256::tree_root(manifest.chunks, manifest.file_size) != manifest.file_hash) {
+                LOG_ERR("Verify: chunk list does not match file digest for %s",
+                        manifest.file_path.c_str());
+                return ok = false;
+            }
+            return true;
+        });
+        if (!ok) return false;
+        if (manifests < 0) {
+            LOG_ERR("Verify: cannot read the file list of job %d", job_id);
+            return false;
         }
         LOG_INFO("Verify: backup job %d integrity OK", job_id);
         return true;
@@ -3,6 +3,7 @@
 #include "common/types.h"
 #include <cstdint>
 #include <cstddef>
+#include <array>
 
 namespace ecpb {
 
@@ -59,4 +60,41 @@ private:
     size_t count_;
 };
 
+// 256 pseudo-random 64-bit constants for GearHash, generated with
+// splitmix64 so the table is fixed across builds (chunk boundaries must be
+// reproducible).
+constexpr std::array<uint64_t, 256> make_gear_table() {
+    std::array<uint64_t, 256> t{};
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = 0; i < t.size(); ++i) {
+        state += 0x9E3779B97F4A7C15ULL;
+        uint64_t z = state;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        t[i] = z ^ (z >> 31);
+    }
+    return t;
+}
+
+// Gear rolling hash (FastCDC). Each byte shifts the fingerprint left by one,
+// so bit k depends only on the last k+1 bytes: the top bits act as an
+// implicit 64-byte sliding window with no explicit "remove old byte" step.
+// The table is a compile-time constant, so roll() inlines to a shift, a
+// load and an add.
+class GearHash {
+public:
+    GearHash() : fp_(0) {}
+
+    void reset() { fp_ = 0; }
+
+    void roll(uint8_t byte) { fp_ = (fp_ << 1) + TABLE[byte]; }
+
+    uint64_t digest() const { return fp_; }
+
+private:
+    static constexpr std::array<uint64_t, 256> TABLE = make_gear_table();
+
+    uint64_t fp_;
+};
+
 } // namespace ecpb
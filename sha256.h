@@ -2,7 +2,10 @@
 
 #include "common/types.h"
 #include "common/logger.h"
+#include "crypto/sha256_kernels.h"
 #include <openssl/evp.h>
+#include <atomic>
+#include <memory>
 #include <cstdio>
 #include <cstring>
 #include <string>
@@ -13,10 +16,77 @@ namespace ecpb {
 
 class SHA256 {
 public:
+    // Block-function implementation behind hash() and hash_many(). Picked
+    // once per process: SHA-NI when the CPU has it, otherwise OpenSSL
+    // (which brings its own AVX2/SSSE3 code). PORTABLE is the plain C++
+    // reference, kept for checking and for benchmarks.
+    enum class Impl : int { EVP = 0, PORTABLE = 1, SHANI = 2 };
+
+    static Impl impl() { return static_cast<Impl>(active_impl().load(std::memory_order_relaxed)); }
+
+    // Force an implementation (benchmarks); false if the CPU lacks it
+    static bool set_impl(Impl im) {
+        if (im == Impl::SHANI && !sha256_kernel::cpu_has_shani()) return false;
+        active_impl().store(static_cast<int>(im), std::memory_order_relaxed);
+        return true;
+    }
+
+    static const char* impl_name(Impl im) {
+        switch (im) {
+            case Impl::EVP:      return "evp";
+            case Impl::PORTABLE: return "portable";
+            case Impl::SHANI:    return "sha-ni";
+        }
+        return "unknown";
+    }
+
     // Hash a byte buffer
     static HashDigest hash(const uint8_t* data, size_t len) {
         HashDigest digest{};
-        EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+        switch (impl()) {
+            case Impl::SHANI:
+#ifdef ECPB_SHA256_X86
+                sha256_kernel::digest(data, len, digest.data(), sha256_kernel::compress_shani_1);
+                return digest;
+#else
+                break;
+#endif
+            case Impl::PORTABLE:
+                sha256_kernel::digest(data, len, digest.data(), sha256_kernel::compress_portable);
+                return digest;
+            case Impl::EVP:
+                break;
+        }
+        return hash_evp(data, len);
+    }
+
+    struct Buffer {
+        const uint8_t* data;
+        size_t         len;
+    };
+
+    // Hash `n` independent buffers into out[0..n). With SHA-NI they share
+    // the two-lane kernel (see digest_many_shani); other implementations
+    // hash them one by one.
+    static void hash_many(const Buffer* bufs, size_t n, HashDigest* out) {
+#ifdef ECPB_SHA256_X86
+        if (impl() == Impl::SHANI && n > 1) {
+            sha256_kernel::digest_many_shani(n,
+                [bufs](size_t i) { return bufs[i].data; },
+                [bufs](size_t i) { return bufs[i].len; },
+                [out](size_t i) { return out[i].data(); });
+            return;
+        }
+#endif
+        for (size_t i = 0; i < n; ++i) out[i] = hash(bufs[i].data, bufs[i].len);
+    }
+
+    // OpenSSL one-shot; a context per thread, reused across calls
+    static HashDigest hash_evp(const uint8_t* data, size_t len) {
+        HashDigest digest{};
+        thread_local std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)>
+            tl_ctx(EVP_MD_CTX_new(), &EVP_MD_CTX_free);
+        EVP_MD_CTX* ctx = tl_ctx.get();
         if (!ctx) {
             LOG_ERR("SHA256: failed to create EVP context");
             return digest;
@@ -27,7 +97,6 @@ public:
             EVP_DigestFinal_ex(ctx, digest.data(), &digest_len) != 1) {
             LOG_ERR("SHA256: digest computation failed");
         }
-        EVP_MD_CTX_free(ctx);
         return digest;
     }
 
@@ -74,6 +143,89 @@ public:
         bool valid_;
     };
 
+    // Merkle root over a file's chunk digests, fed in file order. Only the
+    // chunk digests are hashed again, so the root costs one small hash per
+    // chunk on top of hashing the chunks, which can happen in parallel.
+    //   leaf = H(0x00 | chunk digest)   node = H(0x01 | left | right)
+    //   zero-run leaf = H(0x03 | u64 length)
+    //   root = H(0x02 | u64 file size | top node, or 32 zero bytes if empty)
+    // u64s are little-endian whatever the host, so roots compare across hosts.
+    // Keeps one pending node per tree level; complete subtrees are merged as
+    // soon as they form, and finalize() folds the rest from the right.
+    class Tree {
+    public:
+        void add(const HashDigest& chunk_digest) {
+            uint8_t buf[1 + SHA256_BIN_LEN];
+            buf[0] = 0x00;
+            std::memcpy(buf + 1, chunk_digest.data(), SHA256_BIN_LEN);
+            push(hash(buf, sizeof(buf)));
+        }
+
+        // A run of zeros that has no chunk (see ChunkInfo::zero_run)
+        void add_zero_run(uint64_t len) {
+            uint8_t buf[1 + sizeof(uint64_t)];
+            buf[0] = 0x03;
+            put_le64(buf + 1, len);
+            push(hash(buf, sizeof(buf)));
+        }
+
+        HashDigest finalize(uint64_t file_size) {
+            HashDigest top{};
+            if (!stack_.empty()) {
+                top = stack_.back().digest;
+                for (size_t i = stack_.size() - 1; i-- > 0;) top = parent(stack_[i].digest, top);
+            }
+            stack_.clear();
+            uint8_t buf[1 + sizeof(uint64_t) + SHA256_BIN_LEN];
+            buf[0] = 0x02;
+            put_le64(buf + 1, file_size);
+            std::memcpy(buf + 1 + sizeof(file_size), top.data(), SHA256_BIN_LEN);
+            return hash(buf, sizeof(buf));
+        }
+
+    private:
+        struct Pending {
+            HashDigest digest;
+            uint32_t   level;
+        };
+        std::vector<Pending> stack_;
+
+        static void put_le64(uint8_t* p, uint64_t v) {
+            for (int i = 0; i < 8; ++i) p[i] = static_cast<uint8_t>(v >> (8 * i));
+        }
+
+        void push(HashDigest node) {
+            uint32_t level = 0;
+            while (!stack_.empty() && stack_.back().level == level) {
+                node = parent(stack_.back().digest, node);
+                stack_.pop_back();
+                ++level;
+            }
+            stack_.push_back({node, level});
+        }
+
+        static HashDigest parent(const HashDigest& left, const HashDigest& right) {
+            uint8_t buf[1 + 2 * SHA256_BIN_LEN];
+            buf[0] = 0x01;
+            std::memcpy(buf + 1, left.data(), SHA256_BIN_LEN);
+            std::memcpy(buf + 1 + SHA256_BIN_LEN, right.data(), SHA256_BIN_LEN);
+            return hash(buf, sizeof(buf));
+        }
+    };
+
+    // Tree root for a complete manifest (no file data needed)
+    static HashDigest tree_root(const std::vector<ChunkInfo>& chunks, uint64_t file_size) {
+        Tree tree;
+        for (auto& c : chunks) {
+            if (c.zero_run) {
+                tree.add_zero_run(c.size);
+            } else {
+                tree.add(c.hash);
+            }
+        }
+        return tree.finalize(file_size);
+    }
+
     // Hash a file
     static HashDigest hash_file(const std::string& path) {
         std::ifstream file(path, std::ios::binary);
@@ -91,22 +243,12 @@ public:
     }
 
     // Convert digest to hex string
-    static HashHex to_hex(const HashDigest& digest) {
-        HashHex hex;
-        for (size_t i = 0; i < SHA256_BIN_LEN; ++i) {
-            std::snprintf(hex.data + i * 2, 3, "%02x", digest[i]);
-        }
-        return hex;
-    }
+    static HashHex to_hex(const HashDigest& digest) { return hex_encode(digest); }
 
-    // Convert hex back to digest
+    // Convert hex back to digest (all zeros if malformed)
     static HashDigest from_hex(const HashHex& hex) {
         HashDigest digest{};
-        for (size_t i = 0; i < SHA256_BIN_LEN; ++i) {
-            unsigned int byte;
-            std::sscanf(hex.data + i * 2, "%02x", &byte);
-            digest[i] = static_cast<uint8_t>(byte);
-        }
+        if (!hex_decode(hex.data, SHA256_HEX_LEN, digest)) digest.fill(0);
         return digest;
     }
 
@@ -118,6 +260,13 @@ public:
     static HashHex hash_hex(const std::string& data) {
         return to_hex(hash(data));
     }
+
+private:
+    static std::atomic<int>& active_impl() {
+        static std::atomic<int> im{static_cast<int>(
+            sha256_kernel::cpu_has_shani() ? Impl::SHANI : Impl::EVP)};
+        return im;
+    }
 };
 
 } // namespace ecpb
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ECPB_SHA256_X86 1
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+namespace ecpb {
+namespace sha256_kernel {
+
+// ─── SHA-256 block functions ─────────────────────────────────────────
+// Raw compression functions behind SHA256::hash / hash_many. Each one
+// folds whole 64-byte blocks into an 8-word state; finish() applies the
+// padding, so a kernel only ever sees complete blocks.
+
+alignas(16) inline constexpr uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+inline constexpr uint32_t H0[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+inline uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+inline uint32_t load_be32(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+// Plain C++; the reference every other kernel is checked against
+inline void compress_portable(uint32_t* state, const uint8_t* data, size_t blocks) {
+    uint32_t w[64];
+    for (; blocks > 0; --blocks, data += 64) {
+        for (int i = 0; i < 16; ++i) w[i] = load_be32(data + i * 4);
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+}
+
+#ifdef ECPB_SHA256_X86
+// SHA-NI over L independent messages of the same block count. The lanes'
+// round instructions are interleaved, which hides sha256rnds2 latency, so
+// two messages cost little more than one.
+template<size_t L>
+__attribute__((target("sha,sse4.1,ssse3")))
+void compress_shani(uint32_t* const* states, const uint8_t* const* data, size_t blocks) {
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i abef[L], cdgh[L];
+    for (size_t l = 0; l < L; ++l) {
+        __m128i t = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(states[l])), 0xB1);
+        cdgh[l] = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(states[l] + 4)), 0x1B);
+        abef[l] = _mm_alignr_epi8(t, cdgh[l], 8);
+        cdgh[l] = _mm_blend_epi16(cdgh[l], t, 0xF0);
+    }
+
+    for (size_t b = 0; b < blocks; ++b) {
+        __m128i save_abef[L], save_cdgh[L], w[L][4];
+        for (size_t l = 0; l < L; ++l) {
+            save_abef[l] = abef[l];
+            save_cdgh[l] = cdgh[l];
+        }
+#pragma GCC unroll 16
+        for (int q = 0; q < 16; ++q) {
+            const __m128i k = _mm_load_si128(reinterpret_cast<const __m128i*>(K + q * 4));
+#pragma GCC unroll 4
+            for (size_t l = 0; l < L; ++l) {
+                __m128i& wq = w[l][q & 3];
+                if (q < 4) {
+                    wq = _mm_shuffle_epi8(_mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(data[l] + b * 64 + q * 16)), MASK);
+                } else {
+                    // W[t] = s1(W[t-2]) + W[t-7] + s0(W[t-15]) + W[t-16], four at a time
+                    __m128i x = _mm_sha256msg1_epu32(wq, w[l][(q + 1) & 3]);
+                    x = _mm_add_epi32(x, _mm_alignr_epi8(w[l][(q + 3) & 3], w[l][(q + 2) & 3], 4));
+                    wq = _mm_sha256msg2_epu32(x, w[l][(q + 3) & 3]);
+                }
+                __m128i m = _mm_add_epi32(wq, k);
+                cdgh[l] = _mm_sha256rnds2_epu32(cdgh[l], abef[l], m);
+                abef[l] = _mm_sha256rnds2_epu32(abef[l], cdgh[l], _mm_shuffle_epi32(m, 0x0E));
+            }
+        }
+        for (size_t l = 0; l < L; ++l) {
+            abef[l] = _mm_add_epi32(abef[l], save_abef[l]);
+            cdgh[l] = _mm_add_epi32(cdgh[l], save_cdgh[l]);
+        }
+    }
+
+    for (size_t l = 0; l < L; ++l) {
+        __m128i t = _mm_shuffle_epi32(abef[l], 0x1B);
+        cdgh[l] = _mm_shuffle_epi32(cdgh[l], 0xB1);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(states[l]), _mm_blend_epi16(t, cdgh[l], 0xF0));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(states[l] + 4), _mm_alignr_epi8(cdgh[l], t, 8));
+    }
+}
+
+inline void compress_shani_1(uint32_t* state, const uint8_t* data, size_t blocks) {
+    compress_shani<1>(&state, &data, blocks);
+}
+
+// SHA extensions plus the SSE4.1/SSSE3 shuffles the kernel needs
+inline bool cpu_has_shani() {
+    unsigned a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d)) return false;
+    bool sse = (c & bit_SSE4_1) && (c & bit_SSSE3);
+    if (!__get_cpuid_count(7, 0, &a, &b, &c, &d)) return false;
+    return sse && (b & (1u << 29));
+}
+#else
+inline bool cpu_has_shani() { return false; }
+#endif
+
+// Pad the trailing partial block (tail_len < 64) and fold it in
+template<typename Compress>
+inline void finish(uint32_t* state, const uint8_t* tail, size_t tail_len,
+                   uint64_t total_len, Compress compress) {
+    uint8_t block[128] = {};
+    std::memcpy(block, tail, tail_len);
+    block[tail_len] = 0x80;
+    size_t n = tail_len + 1 + 8 <= 64 ? 64 : 128;
+    uint64_t bits = total_len * 8;
+    for (int i = 0; i < 8; ++i) block[n - 1 - i] = static_cast<uint8_t>(bits >> (8 * i));
+    compress(state, block, n / 64);
+}
+
+inline void store_be(const uint32_t* state, uint8_t* out) {
+    for (int i = 0; i < 8; ++i) {
+        out[i * 4]     = static_cast<uint8_t>(state[i] >> 24);
+        out[i * 4 + 1] = static_cast<uint8_t>(state[i] >> 16);
+        out[i * 4 + 2] = static_cast<uint8_t>(state[i] >> 8);
+        out[i * 4 + 3] = static_cast<uint8_t>(state[i]);
+    }
+}
+
+template<typename Compress>
+inline void digest(const uint8_t* data, size_t len, uint8_t* out, Compress compress) {
+    uint32_t state[8];
+    std::memcpy(state, H0, sizeof(state));
+    size_t full = len / 64;
+    if (full) compress(state, data, full);
+    finish(state, data + full * 64, len % 64, len, compress);
+    store_be(state, out);
+}
+
+#ifdef ECPB_SHA256_X86
+// Multi-buffer driver over the two-lane kernel. Each lane holds one
+// message; both run together until one runs out of full blocks, then that
+// message is padded and finished alone and the lane takes the next one.
+// Only the last message's tail runs single-lane. `data(i)`, `len(i)` and
+// `out(i)` describe message i.
+template<typename Data, typename Len, typename Out>
+void digest_many_shani(size_t n, Data data, Len len, Out out) {
+    struct Lane {
+        size_t         idx;
+        const uint8_t* p;
+        size_t         left;   // full blocks not yet compressed
+        uint32_t       state[8];
+    };
+    Lane lanes[2];
+    size_t next = 0;
+    auto load = [&](Lane& l) {
+        if (next >= n) return false;
+        l.idx = next++;
+        l.p = data(l.idx);
+        l.left = len(l.idx) / 64;
+        std::memcpy(l.state, H0, sizeof(l.state));
+        return true;
+    };
+    auto complete = [&](Lane& l) {
+        size_t total = len(l.idx);
+        finish(l.state, data(l.idx) + total / 64 * 64, total % 64, total, compress_shani_1);
+        store_be(l.state, out(l.idx));
+    };
+
+    bool live[2] = {load(lanes[0]), load(lanes[1])};
+    while (live[0] && live[1]) {
+        size_t common = std::min(lanes[0].left, lanes[1].left);
+        if (common) {
+            uint32_t* states[2] = {lanes[0].state, lanes[1].state};
+            const uint8_t* ptrs[2] = {lanes[0].p, lanes[1].p};
+            compress_shani<2>(states, ptrs, common);
+        }
+        for (int i = 0; i < 2; ++i) {
+            lanes[i].p += common * 64;
+            lanes[i].left -= common;
+            if (lanes[i].left == 0) {
+                complete(lanes[i]);
+                live[i] = load(lanes[i]);
+            }
+        }
+    }
+    for (int i = 0; i < 2; ++i) {
+        if (!live[i]) continue;
+        if (lanes[i].left) compress_shani_1(lanes[i].state, lanes[i].p, lanes[i].left);
+        complete(lanes[i]);
+    }
+}
+#endif
+
+} // namespace sha256_kernel
+} // namespace ecpb
@@ -64,11 +64,13 @@ public:
         return remove_recursive(info.snapshot_path);
     }
 
-    // List all files in a snapshot
-    std::vector<std::string> list_files(const SnapshotInfo& info) {
+    // List all files in a snapshot; `total_bytes` (if given) receives the
+    // sum of their sizes, taken from the walk's own lstat
+    std::vector<std::string> list_files(const SnapshotInfo& info, uint64_t* total_bytes = nullptr) {
         std::vector<std::string> files;
-        if (info.snapshot_path.empty()) return files;
-        list_files_recursive(info.snapshot_path, files);
+        uint64_t bytes = 0;
+        if (!info.snapshot_path.empty()) list_files_recursive(info.snapshot_path, files, bytes);
+        if (total_bytes) *total_bytes = bytes;
         return files;
     }
 
@@ -136,7 +138,8 @@ private:
         return unlink(path.c_str()) == 0;
     }
 
-    static void list_files_recursive(const std::string& path, std::vector<std::string>& files) {
+    static void list_files_recursive(const std::string& path, std::vector<std::string>& files,
+                                     uint64_t& bytes) {
         DIR* dir = opendir(path.c_str());
         if (!dir) return;
         struct dirent* entry;
@@ -147,9 +150,10 @@ private:
             struct stat st;
             if (lstat(full.c_str(), &st) != 0) continue;
             if (S_ISDIR(st.st_mode)) {
-                list_files_recursive(full, files);
+                list_files_recursive(full, files, bytes);
             } else if (S_ISREG(st.st_mode)) {
                 files.push_back(full);
+                bytes += static_cast<uint64_t>(st.st_size);
             }
         }
         closedir(dir);
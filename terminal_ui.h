@@ -76,9 +76,9 @@ private:
         int pri = read_int_default(1);
         if (pri < 0 || pri > 3) pri = 1;
 
-        std::cout << "Compression (0=NONE, 1=LZ4, 2=ZSTD) [1]: ";
+        std::cout << "Compression (0=NONE, 1=LZ4, 2=ZSTD, 3=LZ4HC, 4=ADAPTIVE) [1]: ";
         int comp = read_int_default(1);
-        if (comp < 0 || comp > 2) comp = 1;
+        if (comp < 0 || comp > 4) comp = 1;
 
         std::cout << "Encrypt? (1=yes, 0=no) [1]: ";
         int enc = read_int_default(1);
@@ -150,6 +150,9 @@ private:
             for (auto& f : result.restored_files) {
                 std::cout << "    - " << f << "\n";
             }
+            if (result.files_restored > static_cast<int>(result.restored_files.size())) {
+                std::cout << "    ... and " << result.files_restored - result.restored_files.size() << " more\n";
+            }
         } else {
             std::cout << "Restore failed: " << result.error << "\n";
         }
@@ -204,9 +207,29 @@ private:
                   << "  Total Chunks:     " << stats.total_chunks << "\n"
                   << "  Stored Data:      " << format_bytes(stats.total_stored_bytes) << "\n"
                   << "  Dedup Savings:    " << format_bytes(stats.total_dedup_savings) << "\n"
-                  << "  Backed Up Files:  " << stats.total_files << "\n"
-                  << "  Dedup Index:      " << orch_.chunk_store().dedup_index_size() << " entries\n"
-                  << "  Chunk Index:      " << orch_.chunk_store().chunk_index_size() << " entries\n";
+                  << "  Backed Up Files:  " << stats.total_files << " (" << format_bytes(stats.total_file_bytes)
+                  << ")\n"
+                  << "  Dictionaries:     " << stats.dictionaries << " (" << stats.dict_chunks
+                  << " chunks use one)\n"
+                  << "  Codecs:           " << stats.codec_summary() << "\n"
+                  << "  Dedup Index:      " << orch_.chunk_store().dedup_index_size() << " entries\n";
+        for (auto& j : orch_.database().get_job_stats()) {
+            std::cout << "  Job #" << j.job_id << " " << j.name << ": " << j.files << " files ("
+                      << format_bytes(j.file_bytes) << "), stored " << format_bytes(j.stored_bytes)
+                      << ", dedup " << format_bytes(j.dedup_savings) << "\n";
+        }
+
+        auto fs = orch_.chunk_store().dedup_filter_stats();
+        if (fs.enabled) {
+            std::cout << std::fixed << std::setprecision(3)
+                      << "  Dedup Filter:     " << format_bytes(fs.memory_bytes) << " for "
+                      << fs.capacity << " chunks ("
+                      << format_bytes(static_cast<uint64_t>(fs.bytes_per_million)) << " per million)\n"
+                      << "  Filter FP Rate:   " << fs.observed_fp_rate() * 100.0 << "% observed, "
+                      << fs.estimated_fp_rate * 100.0 << "% expected\n"
+                      << "  Filter Lookups:   " << fs.lookups << " (" << fs.negatives
+                      << " answered in memory)\n";
+        }
     }
 
     void do_messaging() {
@@ -274,6 +297,7 @@ private:
                   << "  Stored:      " << format_bytes(j.stored_bytes) << "\n"
                   << "  Dedup:       " << format_bytes(j.dedup_savings) << "\n"
                   << "  Compression: " << compression_str(j.compression) << "\n"
+                  << "  Pre-check:   " << compress_summary(j) << "\n"
                   << "  Encrypted:   " << (j.encrypt ? "Yes" : "No") << "\n"
                   << "  Duration:    ";
         if (j.started_at > 0 && j.completed_at > 0) {
@@ -19,24 +19,71 @@ namespace ecpb {
 
 // ─── Constants ───────────────────────────────────────────────────────
 constexpr size_t CHUNK_SIZE            = 64 * 1024;          // 64 KB
+constexpr size_t CDC_MIN_SIZE          = 16 * 1024;          // 16 KB
+constexpr size_t CDC_AVG_SIZE          = 64 * 1024;          // 64 KB
+constexpr size_t CDC_MAX_SIZE          = 256 * 1024;         // 256 KB
+constexpr size_t INGEST_BUFFER_SIZE    = 4 * 1024 * 1024;    // 4 MB read window
+constexpr uint64_t PIPELINE_MIN_FILE_SIZE = 1024 * 1024;     // smaller files ingest inline
+constexpr size_t PIPELINE_MAX_THREADS  = 8;                  // auto thread count cap
+constexpr size_t PIPELINE_QUEUE_DEPTH  = 4;                  // queued batches per worker
+constexpr size_t PIPELINE_SPARE_BATCHES = 32;                // batches kept for reuse between files
+constexpr size_t ZERO_BLOCK_SIZE       = 4096;               // zero-run detection granularity
+constexpr size_t ZERO_RUN_MIN          = 64 * 1024;          // shortest zero run / skipped hole
+constexpr uint64_t ZERO_RUN_MAX        = 1024 * 1024 * 1024; // longest single manifest entry
+constexpr size_t PIPELINE_BATCH_BYTES  = 256 * 1024;         // chunks hashed together (SHA256::hash_many)
+constexpr size_t DELTA_FEATURES        = 12;                 // resemblance features per chunk
+constexpr size_t DELTA_SUPER_FEATURES  = 3;                  // super-features (feature groups) per chunk
+constexpr size_t DELTA_MIN_CHUNK       = 4 * 1024;           // smaller chunks are never delta-encoded
+constexpr int    DELTA_MAX_DEPTH       = 4;                  // longest delta chain behind a chunk
+constexpr size_t COMPRESS_SAMPLE_BYTES = 4096;               // bytes sampled by the entropy pre-check
+constexpr double COMPRESS_ENTROPY_MAX  = 7.5;                // bits/byte above which compression is skipped
+constexpr size_t ADAPT_WINDOW_BYTES    = 4 * 1024 * 1024;    // codec input between ladder decisions
+constexpr double ADAPT_TARGET_HEADROOM = 1.1;                // next rung must beat the target by this
+constexpr double ADAPT_BUSY_HIGH       = 0.9;                // no target: CPU share above which the ladder steps down
+constexpr uint64_t ADAPT_MEMORY_WINDOWS = 32;                // windows a rung's measured cost is trusted
+constexpr size_t DICT_MAX_SIZE         = 64 * 1024;          // trained zstd dictionary size cap
+constexpr size_t DICT_TRAIN_BYTES      = 2 * 1024 * 1024;    // samples per scope that trigger training
+constexpr size_t DICT_SAMPLE_MAX       = 16 * 1024;          // bytes sampled from one chunk
+constexpr size_t DICT_MIN_SAMPLES      = 16;                 // fewer samples are not trained on
+constexpr int    DICT_RETRAIN_JOBS     = 8;                  // jobs before a scope's dictionary is retrained
 constexpr size_t MAX_FILE_SIZE         = 4ULL * 1024 * 1024 * 1024; // 4 GB
 constexpr size_t SHA256_HEX_LEN       = 64;
 constexpr size_t SHA256_BIN_LEN       = 32;
 constexpr size_t AES_KEY_LEN          = 32;                  // AES-256
 constexpr size_t AES_IV_LEN           = 16;
 constexpr size_t AES_BLOCK_SIZE       = 16;
+constexpr size_t AES_GCM_NONCE_LEN    = 12;
+constexpr size_t AES_GCM_TAG_LEN      = 16;
 constexpr size_t ROLLING_WINDOW       = 48;
 constexpr int    SQLITE_BUSY_TIMEOUT_MS = 5000;
 constexpr int    SQLITE_MAX_RETRIES   = 10;
+constexpr size_t DB_READERS           = 8;                   // reader connections per Database
 constexpr size_t SHM_SEGMENT_SIZE     = 4 * 1024 * 1024;    // 4 MB
 constexpr int    MSG_QUEUE_MAX_MSG    = 8192;
 constexpr size_t CIRCULAR_BUF_CAP     = 1024;
 constexpr int    MAX_WORKER_PROCESSES = 4;
+constexpr size_t MAX_FILE_THREADS     = 8;                   // auto file-level threads cap
 constexpr int    BPLUS_TREE_ORDER     = 64;
+constexpr uint64_t PACK_TARGET_SIZE    = 64ULL * 1024 * 1024; // seal packs at 64 MB
+constexpr uint64_t BLOOM_MIN_CAPACITY  = 1000000;            // chunks per filter, at least
+constexpr double   BLOOM_FP_RATE       = 0.01;               // ~1.2 MB per million chunks
+constexpr size_t   GROUP_COMMIT_ROWS   = 4096;               // rows per metadata transaction, at most
+constexpr uint64_t GROUP_COMMIT_MS     = 250;                // oldest pending row waits this long, at most
 
 // ─── SHA-256 Hash ────────────────────────────────────────────────────
 using HashDigest = std::array<uint8_t, SHA256_BIN_LEN>;
 
+// SHA-256 output is uniformly distributed, so any 8 bytes are a good hash
+struct DigestHash {
+    size_t operator()(const HashDigest& d) const {
+        uint64_t h;
+        std::memcpy(&h, d.data(), sizeof(h));
+        return static_cast<size_t>(h);
+    }
+};
+
+// Hex form of a digest, for logs, paths and the UI only; everything else
+// (indexes, schema, manifests) keys on the raw HashDigest
 struct HashHex {
     char data[SHA256_HEX_LEN + 1] = {};
     const char* c_str() const { return data; }
@@ -46,13 +93,61 @@ struct HashHex {
     bool operator<(const HashHex& o)  const { return std::memcmp(data, o.data, SHA256_HEX_LEN) < 0; }
 };
 
+inline HashHex hex_encode(const HashDigest& digest) {
+    static const char digits[] = "0123456789abcdef";
+    HashHex hex;
+    for (size_t i = 0; i < SHA256_BIN_LEN; ++i) {
+        hex.data[i * 2]     = digits[digest[i] >> 4];
+        hex.data[i * 2 + 1] = digits[digest[i] & 0x0f];
+    }
+    return hex;
+}
+
+// Parses exactly SHA256_HEX_LEN hex digits (either case)
+inline bool hex_decode(const char* hex, size_t len, HashDigest& out) {
+    if (len != SHA256_HEX_LEN) return false;
+    auto nibble = [](char c) -> int {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+    for (size_t i = 0; i < SHA256_BIN_LEN; ++i) {
+        int hi = nibble(hex[i * 2]), lo = nibble(hex[i * 2 + 1]);
+        if (hi < 0 || lo < 0) return false;
+        out[i] = static_cast<uint8_t>((hi << 4) | lo);
+    }
+    return true;
+}
+
 // ─── Chunk Descriptor ────────────────────────────────────────────────
 struct ChunkInfo {
-    HashHex    hash;
+    HashDigest hash{};
     uint64_t   offset       = 0;
     uint32_t   size         = 0;
     uint32_t   chunk_index  = 0;
     bool       deduplicated = false;
+    bool       zero_run     = false;   // `size` zero bytes, no chunk (hash unset)
+};
+
+// ─── Chunk Location (pack file record) ───────────────────────────────
+// pack_id < 0 marks a legacy loose chunk file (storage/chunks/ab/cd/<hash>)
+struct ChunkLocation {
+    int64_t  pack_id = -1;
+    uint64_t offset  = 0;   // record start within the pack
+    uint32_t length  = 0;   // stored (compressed/encrypted) payload bytes
+};
+
+// How FileManifest::file_hash is computed
+enum class FileDigestMode : int {
+    STREAM = 0,  // SHA-256 of the file bytes
+    TREE   = 1   // Merkle root over the chunk digests (SHA256::Tree)
+};
+
+// How a manifest's chunk list is stored
+enum class ChunkListFormat : int {
+    ROWS   = 0,  // a file_chunks row per chunk
+    PACKED = 1   // one file_manifests.chunk_list blob (ChunkList)
 };
 
 // ─── File Manifest ───────────────────────────────────────────────────
@@ -61,7 +156,8 @@ struct FileManifest {
     std::string              file_name;
     uint64_t                 file_size      = 0;
     uint64_t                 modified_time  = 0;
-    HashHex                  file_hash;
+    HashDigest               file_hash{};
+    FileDigestMode           digest_mode    = FileDigestMode::STREAM;
     std::vector<ChunkInfo>   chunks;
 };
 
@@ -82,9 +178,23 @@ enum class JobPriority : int {
 };
 
 enum class CompressionType : int {
-    NONE = 0,
-    LZ4  = 1,
-    ZSTD = 2
+    NONE     = 0,
+    LZ4      = 1,
+    ZSTD     = 2,
+    LZ4HC    = 3,   // LZ4 format, slower high-compression encoder
+    ADAPTIVE = 4    // jobs only: CodecLadder picks per chunk
+};
+
+// What a trained zstd dictionary is shared by (ZSTD jobs only)
+enum class DictMode : int {
+    OFF       = 0,
+    SOURCE    = 1,   // one per backup source path
+    EXTENSION = 2    // one per file extension, across sources
+};
+
+enum class ChunkingMode : int {
+    FIXED = 0,   // CHUNK_SIZE blocks
+    CDC   = 1    // content-defined (FastCDC)
 };
 
 inline const char* job_status_str(JobStatus s) {
@@ -113,10 +223,76 @@ inline const char* compression_str(CompressionType c) {
         case CompressionType::NONE: return "NONE";
         case CompressionType::LZ4:  return "LZ4";
         case CompressionType::ZSTD: return "ZSTD";
+        case CompressionType::LZ4HC: return "LZ4HC";
+        case CompressionType::ADAPTIVE: return "ADAPTIVE";
+    }
+    return "UNKNOWN";
+}
+
+// Codec as recorded per chunk, e.g. "ZSTD-3" (level 0: the default)
+inline std::string codec_str(CompressionType c, int level) {
+    std::string s = compression_str(c);
+    if (level > 0) s += "-" + std::to_string(level);
+    return s;
+}
+
+inline const char* chunking_str(ChunkingMode m) {
+    switch (m) {
+        case ChunkingMode::FIXED: return "FIXED";
+        case ChunkingMode::CDC:   return "CDC";
     }
     return "UNKNOWN";
 }
 
+inline const char* digest_mode_str(FileDigestMode m) {
+    switch (m) {
+        case FileDigestMode::STREAM: return "STREAM";
+        case FileDigestMode::TREE:   return "TREE";
+    }
+    return "UNKNOWN";
+}
+
+inline const char* chunk_list_str(ChunkListFormat f) {
+    switch (f) {
+        case ChunkListFormat::ROWS:   return "ROWS";
+        case ChunkListFormat::PACKED: return "PACKED";
+    }
+    return "UNKNOWN";
+}
+
+// ─── Compression Counters ────────────────────────────────────────────
+// What happened to new chunks on the way through the compressor (only
+// counted when the job compresses). Per file from ChunkStore::store_file,
+// summed per job by the backup worker.
+struct CompressStats {
+    uint64_t chunks        = 0;  // new chunks
+    uint64_t skipped       = 0;  //   judged incompressible without trying
+    uint64_t stored_raw    = 0;  //   compressed, not smaller, stored raw
+    uint64_t skipped_bytes = 0;
+    uint64_t tried_bytes   = 0;  // input bytes handed to the codec
+    uint64_t compress_ns   = 0;  // time in the codec
+    uint64_t check_ns      = 0;  // time in the pre-check
+
+    void add(const CompressStats& o) {
+        chunks += o.chunks;
+        skipped += o.skipped;
+        stored_raw += o.stored_raw;
+        skipped_bytes += o.skipped_bytes;
+        tried_bytes += o.tried_bytes;
+        compress_ns += o.compress_ns;
+        check_ns += o.check_ns;
+    }
+
+    // Estimated codec time avoided: skipped bytes at the job's measured
+    // codec speed, minus what the pre-check cost. 0 if under 1 MiB was
+    // tried: a few calls are dominated by first-use setup, not throughput.
+    uint64_t saved_ns() const {
+        if (tried_bytes < (1u << 20)) return 0;
+        double est = static_cast<double>(skipped_bytes) * compress_ns / tried_bytes;
+        return est > check_ns ? static_cast<uint64_t>(est) - check_ns : 0;
+    }
+};
+
 struct BackupJob {
     int              job_id          = -1;
     std::string      source_path;
@@ -136,6 +312,10 @@ struct BackupJob {
     uint64_t         dedup_savings   = 0;
     int              file_count      = 0;
     std::string      error_message;
+    uint64_t         compress_chunks   = 0;   // CompressStats::chunks
+    uint64_t         compress_skipped  = 0;   // CompressStats::skipped
+    uint64_t         compress_raw      = 0;   // CompressStats::stored_raw
+    uint64_t         compress_saved_ns = 0;   // CompressStats::saved_ns()
     std::vector<int> dependencies;
 };
 
@@ -210,4 +390,15 @@ inline std::string format_bytes(uint64_t bytes) {
     return buf;
 }
 
+// "12 of 40 new chunks skipped (30.0%), 3 stored raw, ~1.2 ms saved"
+inline std::string compress_summary(const BackupJob& j) {
+    char buf[160];
+    double pct = j.compress_chunks ? 100.0 * j.compress_skipped / j.compress_chunks : 0.0;
+    std::snprintf(buf, sizeof(buf), "%llu of %llu new chunks skipped (%.1f%%), %llu stored raw, ~%.1f ms saved",
+                  static_cast<unsigned long long>(j.compress_skipped),
+                  static_cast<unsigned long long>(j.compress_chunks), pct,
+                  static_cast<unsigned long long>(j.compress_raw), j.compress_saved_ns / 1e6);
+    return buf;
+}
+
 } // namespace ecpb
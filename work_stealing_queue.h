@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+namespace ecpb {
+
+// One deque per worker. A worker takes from the front of its own deque and,
+// once that is empty, steals from the back of the others, so neighbouring
+// items tend to stay on one worker and contention only happens while
+// stealing. Meant for a fixed batch of work distributed up front.
+template<typename T>
+class WorkStealingQueue {
+public:
+    explicit WorkStealingQueue(size_t workers) {
+        if (workers == 0) workers = 1;
+        for (size_t i = 0; i < workers; ++i) lanes_.push_back(std::make_unique<Lane>());
+    }
+
+    size_t workers() const { return lanes_.size(); }
+
+    void push(size_t worker, T item) {
+        Lane& lane = *lanes_[worker % lanes_.size()];
+        std::lock_guard<std::mutex> lock(lane.mtx);
+        lane.items.push_back(std::move(item));
+    }
+
+    // Split `items` into contiguous runs, one per worker
+    void distribute(std::vector<T> items) {
+        size_t n = lanes_.size();
+        size_t per = (items.size() + n - 1) / n;
+        for (size_t i = 0; i < items.size(); ++i) push(per ? i / per : 0, std::move(items[i]));
+    }
+
+    // False once every lane is empty
+    bool pop(size_t worker, T& out) {
+        size_t n = lanes_.size();
+        size_t self = worker % n;
+        if (take(*lanes_[self], out, true)) return true;
+        for (size_t k = 1; k < n; ++k) {
+            if (take(*lanes_[(self + k) % n], out, false)) {
+                steals_.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    uint64_t steals() const { return steals_.load(std::memory_order_relaxed); }
+
+private:
+    struct Lane {
+        std::mutex mtx;
+        std::deque<T> items;
+    };
+
+    std::vector<std::unique_ptr<Lane>> lanes_;
+    std::atomic<uint64_t> steals_{0};
+
+    static bool take(Lane& lane, T& out, bool front) {
+        std::lock_guard<std::mutex> lock(lane.mtx);
+        if (lane.items.empty()) return false;
+        if (front) {
+            out = std::move(lane.items.front());
+            lane.items.pop_front();
+        } else {
+            out = std::move(lane.items.back());
+            lane.items.pop_back();
+        }
+        return true;
+    }
+};
+
+} // namespace ecpb
@@ -6,10 +6,15 @@
 #include "storage/database.h"
 #include "backup/snapshot.h"
 #include "ipc/ipc.h"
+#include "datastructures/work_stealing_queue.h"
 
 #include <string>
 #include <vector>
-#include <sys/stat.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
 #include <unistd.h>
 
 namespace ecpb {
@@ -22,18 +27,29 @@ public:
         uint64_t total_bytes = 0;
         uint64_t stored_bytes = 0;
         uint64_t dedup_savings = 0;
-        int file_count = 0;
+        int file_count = 0;             // files stored
+        int failed_files = 0;           // files that could not be stored
+        CompressStats compress;
+        uint64_t commits = 0;           // metadata transactions (group commits)
+        uint64_t committed_rows = 0;
+        double commits_per_sec = 0;
         std::string error;
     };
 
     BackupWorker(Database& db, ChunkStore& store, SnapshotManager& snap_mgr)
         : db_(db), store_(store), snap_mgr_(snap_mgr) {}
 
+    // Files processed concurrently within a job (0 = one per core, up to
+    // MAX_FILE_THREADS)
+    void set_threads(size_t n) { threads_ = n; }
+
     // Execute a backup job. Returns result struct.
     Result execute(BackupJob& job, const AES256::Key& aes_key,
                    MessageQueue* msg_queue = nullptr) {
         Result result;
         result.job_id = job.job_id;
+        GroupCommit::Stats commits_before = store_.commit_stats();
+        auto started = std::chrono::steady_clock::now();
 
         LOG_INFO("Worker[%d]: starting backup job %d for %s",
                  getpid(), job.job_id, job.source_path.c_str());
@@ -51,79 +67,132 @@ public:
             return result;
         }
 
-        // List all files in the snapshot
-        std::vector<std::string> files = snap_mgr_.list_files(snap);
+        // List all files in the snapshot; their sizes come from the same walk
+        std::vector<std::string> files = snap_mgr_.list_files(snap, &result.total_bytes);
         result.file_count = static_cast<int>(files.size());
 
         if (files.empty()) {
             LOG_WARN("Worker[%d]: no files found in %s", getpid(), job.source_path.c_str());
         }
 
-        // Compute total bytes
-        for (auto& f : files) {
-            struct stat st;
-            if (stat(f.c_str(), &st) == 0) {
-                result.total_bytes += static_cast<uint64_t>(st.st_size);
-            }
-        }
-
-        // Process each file
-        uint64_t processed = 0;
+        // Process files on a work-stealing pool: each thread starts on a
+        // contiguous run of the list and steals from the others when done.
+        // Tallies are per thread and merged afterwards; only progress
+        // reporting takes a lock, once per file.
         std::string snap_base = snap.snapshot_path;
         if (!snap_base.empty() && snap_base.back() != '/') snap_base += '/';
 
-        for (size_t i = 0; i < files.size(); ++i) {
-            auto& file_path = files[i];
-            struct stat st;
-            if (stat(file_path.c_str(), &st) != 0) continue;
-
-            // Compute relative path from snapshot directory
-            std::string rel_path;
-            if (file_path.substr(0, snap_base.size()) == snap_base) {
-                rel_path = file_path.substr(snap_base.size());
-            } else {
-                rel_path = file_path;
-                auto pos = rel_path.rfind('/');
-                if (pos != std::string::npos) rel_path = rel_path.substr(pos + 1);
-            }
+        size_t threads = resolve_threads(files.size());
+        std::vector<size_t> indices(files.size());
+        for (size_t i = 0; i < files.size(); ++i) indices[i] = i;
+        WorkStealingQueue<size_t> queue(threads);
+        queue.distribute(std::move(indices));
+
+        store_.dictionaries().begin_job(job.job_id, job.source_path);
+
+        std::vector<Tally> tallies(threads);
+        std::atomic<uint64_t> processed_bytes{0};
+        std::mutex progress_mtx;
+        uint64_t progress_sent = 0;
+
+        auto run = [&](size_t w) {
+            Tally& tally = tallies[w];
+            size_t i;
+            while (queue.pop(w, i)) {
+                CompressStats compress;
+                auto stored = store_.store_file(
+                    files[i], job.compression, job.encrypt, aes_key, job.job_id,
+                    relative_path(snap_base, files[i]), &compress);
+                tally.compress.add(compress);
+                if (!stored) {
+                    tally.failed_files++;
+                    continue;
+                }
+                const FileManifest& manifest = *stored;
 
-            FileManifest manifest = store_.store_file(
-                file_path, job.compression, job.encrypt, aes_key, job.job_id, rel_path);
-
-            // Tally stats
-            for (auto& chunk : manifest.chunks) {
-                if (chunk.deduplicated) {
-                    result.dedup_savings += chunk.size;
-                } else {
-                    auto meta = db_.get_chunk_meta(chunk.hash.str());
-                    if (meta) {
-                        result.stored_bytes += meta->stored_size;
+                // Tally stats
+                for (auto& chunk : manifest.chunks) {
+                    if (chunk.zero_run) continue;  // nothing stored
+                    if (chunk.deduplicated) {
+                        tally.dedup_savings += chunk.size;
+                    } else {
+                        auto meta = store_.chunk_meta(chunk.hash);
+                        if (meta) {
+                            tally.stored_bytes += meta->stored_size;
+                        }
+                    }
+                }
+                processed_bytes.fetch_add(manifest.file_size, std::memory_order_relaxed);
+
+                // Send progress (monotonic: read and sent under the lock)
+                if (msg_queue) {
+                    std::lock_guard<std::mutex> lock(progress_mtx);
+                    uint64_t now = processed_bytes.load(std::memory_order_relaxed);
+                    if (now > progress_sent) {
+                        progress_sent = now;
+                        send_progress(msg_queue, job.job_id, IPCMessageType::JOB_PROGRESS,
+                                      now, result.total_bytes);
                     }
                 }
             }
+        };
 
-            processed += manifest.file_size;
+        std::vector<std::thread> pool;
+        for (size_t w = 1; w < threads; ++w) pool.emplace_back(run, w);
+        run(0);
+        for (auto& t : pool) t.join();
 
-            // Send progress
-            if (msg_queue) {
-                send_progress(msg_queue, job.job_id, IPCMessageType::JOB_PROGRESS,
-                              processed, result.total_bytes);
-            }
+        for (auto& tally : tallies) {
+            result.stored_bytes += tally.stored_bytes;
+            result.dedup_savings += tally.dedup_savings;
+            result.compress.add(tally.compress);
+            result.failed_files += tally.failed_files;
         }
-
-        // Store encryption key
-        if (job.encrypt) {
-            db_.store_encryption_key(job.job_id, AES256::key_to_hex(aes_key));
+        result.file_count -= result.failed_files;
+        uint64_t processed = processed_bytes.load();
+        if (threads > 1) {
+            LOG_DEBUG("Worker[%d]: %zu threads, %llu files stolen", getpid(), threads,
+                      static_cast<unsigned long long>(queue.steals()));
         }
 
+        // Scopes that collected some samples but never reached the training
+        // size get their dictionary now, for the next job
+        size_t trained = store_.dictionaries().finish_job();
+        if (trained) LOG_DEBUG("Worker[%d]: %zu dictionaries trained at job end", getpid(), trained);
+
+        // Make pack data and the last rows durable before the job is
+        // marked complete
+        bool flushed = store_.flush();
+        GroupCommit::Stats commits = store_.commit_stats();
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        result.commits = commits.commits - commits_before.commits;
+        result.committed_rows = commits.rows - commits_before.rows;
+        result.commits_per_sec = secs > 0 ? result.commits / secs : 0.0;
+
         // Update final stats
         db_.update_job_stats(job.job_id, result.total_bytes, processed,
                             result.stored_bytes, result.dedup_savings, result.file_count);
-        db_.update_job_status(job.job_id, JobStatus::COMPLETED);
+        db_.update_job_compression(job.job_id, result.compress);
 
         // Cleanup snapshot
         snap_mgr_.remove_snapshot(snap);
 
+        // A file left out fails the job: its backup is not complete
+        if (!flushed) {
+            result.error = "pack data or metadata could not be committed";
+        } else if (result.failed_files) {
+            result.error = std::to_string(result.failed_files) + " of " +
+                           std::to_string(files.size()) + " files could not be stored";
+        }
+        if (!result.error.empty()) {
+            db_.update_job_status(job.job_id, JobStatus::FAILED, result.error);
+            if (msg_queue) send_progress(msg_queue, job.job_id, IPCMessageType::JOB_FAILED,
+                                         processed, result.total_bytes);
+            LOG_ERR("Worker[%d]: job %d failed - %s", getpid(), job.job_id, result.error.c_str());
+            return result;
+        }
+
+        db_.update_job_status(job.job_id, JobStatus::COMPLETED);
         result.success = true;
         if (msg_queue) send_progress(msg_queue, job.job_id, IPCMessageType::JOB_COMPLETE,
                                      processed, result.total_bytes);
@@ -132,6 +201,19 @@ public:
                  getpid(), job.job_id, result.file_count,
                  format_bytes(result.stored_bytes).c_str(),
                  format_bytes(result.dedup_savings).c_str());
+        if (result.compress.chunks) {
+            LOG_INFO("Worker[%d]: job %d compression - %llu of %llu new chunks skipped by pre-check, "
+                     "%llu stored raw after trying, ~%.1f ms codec time saved",
+                     getpid(), job.job_id,
+                     static_cast<unsigned long long>(result.compress.skipped),
+                     static_cast<unsigned long long>(result.compress.chunks),
+                     static_cast<unsigned long long>(result.compress.stored_raw),
+                     result.compress.saved_ns() / 1e6);
+        }
+        LOG_INFO("Worker[%d]: job %d metadata - %llu rows in %llu transactions (%.1f commits/s)",
+                 getpid(), job.job_id,
+                 static_cast<unsigned long long>(result.committed_rows),
+                 static_cast<unsigned long long>(result.commits), result.commits_per_sec);
         return result;
     }
 
@@ -139,6 +221,33 @@ private:
     Database& db_;
     ChunkStore& store_;
     SnapshotManager& snap_mgr_;
+    size_t threads_ = 0;
+
+    // Per-thread counters, padded so threads never share a cache line
+    struct alignas(64) Tally {
+        uint64_t stored_bytes = 0;
+        uint64_t dedup_savings = 0;
+        int failed_files = 0;
+        CompressStats compress;
+    };
+
+    size_t resolve_threads(size_t file_count) const {
+        size_t n = threads_;
+        if (n == 0) {
+            size_t hw = std::thread::hardware_concurrency();
+            n = std::min<size_t>(hw ? hw : 1, MAX_FILE_THREADS);
+        }
+        return std::max<size_t>(std::min(n, file_count), 1);
+    }
+
+    // Path relative to the snapshot directory (basename if outside it)
+    static std::string relative_path(const std::string& snap_base, const std::string& file_path) {
+        if (file_path.compare(0, snap_base.size(), snap_base) == 0) {
+            return file_path.substr(snap_base.size());
+        }
+        auto pos = file_path.rfind('/');
+        return pos != std::string::npos ? file_path.substr(pos + 1) : file_path;
+    }
 
     void send_progress(MessageQueue* mq, int job_id, IPCMessageType type,
                        uint64_t v1, uint64_t v2) {